@@ -3212,3 +3212,22 @@ iw_scan(int			skfd,
   /* End - return -1 or 0 */
   return(delay);
 }
+
+/*------------------------------------------------------------------*/
+/*
+ * Free the results of a scan, like iw_scan_release() of libiw. In this
+ * copy, each cell has its own malloc().
+ */
+void
+iw_scan_release(wireless_scan_head *	context)
+{
+  wireless_scan *	wscan;
+  wireless_scan *	next;
+
+  for(wscan = context->result; wscan != NULL; wscan = next)
+    {
+      next = wscan->next;
+      free(wscan);
+    }
+  context->result = NULL;
+}
@@ -476,6 +476,8 @@ int
 		char *			ifname,
 		int			we_version,
 		wireless_scan_head *	context);
+void
+	iw_scan_release(wireless_scan_head *	context);
 
 /**************************** VARIABLES ****************************/
 
@@ -1198,14 +1198,18 @@ int main(void) {
     }
     
     printf("traverse\n");
-    /* Traverse the results */
+    /* Traverse the results, freeing each cell as we go */
     result = head.result;
     
     while (NULL != result) {
+        wireless_scan *next = result->next;
         printf("%s\n", result->b.essid);
-        result = result->next;
+        free(result);
+        result = next;
     }
+    head.result = NULL;
     
+    iw_sockets_close(sock);
     exit(0);
 }
 
@@ -16,6 +16,9 @@ int main(void) {
     iwrange range;
     int sock;
     
+    /* The scan context owns the results, it must start zeroed */
+    memset(&head, 0, sizeof(head));
+    
     /* Open socket to kernel */
     sock = iw_sockets_open();
     
@@ -38,5 +41,8 @@ int main(void) {
         result = result->next;
     }
     
+    /* Give the memory of the results back */
+    iw_scan_release(&head);
+    iw_sockets_close(sock);
     exit(0);
 }
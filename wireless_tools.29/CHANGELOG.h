@@ -740,6 +740,114 @@
  *	---
  *		(Bug reported by Florent Daignire)
  *	o Don't look for "fixed" out of array in set_txpower_info() [iwconfig]
+ *	---
+ *	o Add iw_scan_iter_*() to walk scan results in place [iwlib]
+ *	---
+ *	o Allocate scan results in an arena owned by the context [iwlib]
+ *	o Add iw_scan_free()/iw_scan_release(), no need to walk the list [iwlib]
+ *	---
+ *	o Decode events with a single lookup in a flat per-WE table [iwlib]
+ *	---
+ *	o Add iw_get_event_decoder(), decoders specialised for WE-18,
+ *	  WE-19+ native and WE-19+ 32-on-64 compat [iwlib]
+ *	o Select the event decoder once per interface [iwlist/iwevent]
+ *	---
+ *	o Keep all bit rates, modulation, protocol name, IEs and custom
+ *	  elements in wireless_scan, IEs and custom point in the scan buffer [iwlib]
+ *	o Fix SIOCGIWRATE falling through in iw_process_scanning_token() [iwlib]
+ *	o Scan buffer belong to the context and is reused between scans [iwlib]
+ *	---
+ *	o Wait for the rtnetlink scan completion event rather than polling,
+ *	  keep the timer as fallback [iwlib/iwlist]
+ *	o Add iw_scan_event_open(), iw_scan_event_check() and iw_scan_wait() [iwlib]
+ *	---
+ *	o Add iw_scan_start(), iw_scan_get_fd() and iw_scan_handle_ready() :
+ *	  asynchronous scan driven by a pollable fd, no sleep [iwlib]
+ *	---
+ *	o Scan all interfaces in parallel when no interface is given [iwlist]
+ *	o Keep the length of raw results in the scan context [iwlib]
+ *	---
+ *	o Count scan buffer hits and misses (E2BIG) in the scan context [iwlib]
+ *	---
+ *	o Add iw_scan_capture_write()/iw_scan_capture_read() [iwlib]
+ *	o Add 'capture' and 'replay' scanning options [iwlist]
+ *	---
+ *	o Add pluggable transport, iw_set_transport() and IW_TRANSPORT [iwlib]
+ *	o Add simulated driver for testing without hardware [iwsim]
+ *		(only in the library with BUILD_SIM, otherwise in iwscangen)
+ *	o Don't grow the scan buffer beyond the 16 bit iw_point length [iwlib/iwlist]
+ *	---
+ *	o Make the scan results of the simulated driver configurable [iwsim]
+ *	o Add iw_scan_decode(), decoding of scan results from any buffer [iwlib]
+ *	o Skip events before the first cell instead of crashing [iwlib]
+ *	o Add iwscangen, to generate scan results and benchmark decoding [iwscangen]
+ *	---
+ *	o Add iw_parse_ies()/iw_scan_parse_ies(), table driven decoding of IEs [iwlib]
+ *	o Display WPA/RSN IEs from the decoded IEs, use RSN defaults for short IEs [iwlist]
+ *	o Add IE decoding to the benchmark [iwscangen]
+ *	---
+ *	o Add iw_ie_index_build()/iw_ie_find(), one pass IE validation and index [iwlib]
+ *	o Add IE lookup to the benchmark [iwscangen]
+ *	---
+ *	o Format scan results in a reusable buffer, one write per interface [iwlist]
+ *	---
+ *	o Add --format=json|csv to scanning, streamed from the events [iwlist]
+ *	---
+ *	o Add binary scan snapshots, iw_snapshot_write()/iw_snapshot_open() [iwlib]
+ *	o Add --snapshot FILE to scanning [iwlist]
+ *	---
+ *	o Add columnar scan tables, with radix sort, top-N and filters [iwlib]
+ *	o Add iw_qual_level(), flag decodable levels in snapshots [iwlib]
+ *	---
+ *	o Add persistent BSS tables, merged from each scan, with aging, smoothed levels and hashed lookups by BSSID and ESSID [iwlib]
+ *	---
+ *	o Add --delta to scanning, display only the cells new, lost or changed since the previous scan [iwlist]
+ *	---
+ *	o Add channel, freq, passive, active and dwell options to scanning [iwlist]
+ *	o Restrict the simulated scans to the channels requested [iwsim]
+ *	---
+ *	o Add iw_scan_listen(), read the results of the scans done by others without triggering any [iwlib]
+ *	o Add listen to scanning, display the results of each scan done by others [iwlist]
+ *	---
+ *	o Add a scan scheduler, scanning often when the link degrades or the cells change, rarely when all is stable [iwlib]
+ *	o Move BSSID matching of scan tables to iw_scan_table_match() [iwlib]
+ *	---
+ *	o Add iw_essid_pool, interned ESSIDs with stable IDs, compared as ints [iwlib]
+ *	o Optionally intern the ESSIDs of scan results in a pool (wireless_scan_head->essids) [iwlib]
+ *	o BSS tables keep their ESSIDs in an iw_essid_pool [iwlib]
+ *	---
+ *	o Add iw_compact_cell, packed scan cell with bit field presence flags, ESSID and protocol as IDs of a pool [iwlib]
+ *	o Add iw_compact_cell_pack()/unpack() to convert from and to wireless_scan [iwlib]
+ *	---
+ *	o Bump WT_VERSION to 30, the soname becomes libiw.so.30 [iwlib/Makefile]
+ *		wireless_scan_head and wireless_scan changed layout. API change :
+ *		the scan context must be set with iw_scan_init() (or zeroed),
+ *		the cells belong to the context and must not be freed by the
+ *		caller, use iw_scan_free() and iw_scan_release() [iwlib]
+ *	o Add iw_scan_init() [iwlib]
+ *	---
+ *	o JSON output escapes the bytes that are not UTF-8 and adds essid_hex [iwlist]
+ *	---
+ *	o iw_bss_table_init() sets up the table without freeing it first [iwlib]
+ *	---
+ *	o 32 bits userspace always uses the compat event decoder, no uname() [iwlib]
+ *	---
+ *	o Count a buffer hit only when the first read is big enough [iwlib]
+ *	o Add buf_hint to wireless_scan_head, size to start reading with [iwlib]
+ *	o Start reading the results with the size of the previous device [iwlist]
+ *	---
+ *	o Fill the flat event tables when the library is loaded, no racy ready flag [iwlib]
+ *	---
+ *	o Add --iter to --bench, allocations per cell of the iterator and of the list [iwscangen]
+ *	---
+ *	o Reject negative and overflowing dwell times, clamp to 32 bits of TU [iwlist]
+ *	---
+ *	o Scanning all devices : report failed triggers as before, and wait for the scans one at a time if we can't allocate the poll set [iwlist]
+ *	---
+ *	o Truncated WPA/RSN IE : don't print the default ciphers as if they were in the IE [iwlist]
+ *	---
+ *	o Display all the suites of WPA/RSN IEs, and the TKIP defaults of short IEs, as before [iwlist]
+ *	o Add IW_IE_RSN_SUITES_CUT, set when a suite list is longer than IW_IE_MAX_SUITES [iwlib]
  */
 
 /* ----------------------------- TODO ----------------------------- */
@@ -49,6 +49,7 @@ typedef struct wireless_iface
   char			ifname[IFNAMSIZ + 1];	/* Interface name */
   struct iw_range	range;			/* Wireless static data */
   int			has_range;
+  iw_event_decoder	decode;			/* Event decoder for range */
 } wireless_iface;
 
 /**************************** VARIABLES ****************************/
@@ -212,6 +213,8 @@ iw_get_interface_data(int	ifindex)
       return(NULL);
     }
   curr->has_range = (iw_get_range_info(skfd, curr->ifname, &curr->range) >= 0);
+  /* Pick the decoder once, not for every event */
+  curr->decode = iw_get_event_decoder(curr->range.we_version_compiled);
   //printf("Cache : create %d-%s\n", curr->ifindex, curr->ifname);
 
   /* Done */
@@ -524,8 +527,8 @@ print_event_stream(int		ifindex,
   do
     {
       /* Extract an event and print it */
-      ret = iw_extract_event_stream(&stream, &iwe,
-				    wireless_data->range.we_version_compiled);
+      ret = wireless_data->decode(&stream, &iwe,
+				  wireless_data->range.we_version_compiled);
       if(ret != 0)
 	{
 	  if(i++ == 0)
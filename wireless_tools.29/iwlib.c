@@ -11,7 +11,16 @@
 
 /***************************** INCLUDES *****************************/
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		/* secure_getenv */
+#endif
 #include "iwlib.h"		/* Header */
+#include <linux/netlink.h>	/* Scan completion events */
+#include <linux/rtnetlink.h>
+#include <sys/epoll.h>		/* Asynchronous scan */
+#include <sys/timerfd.h>
+#include <sys/mman.h>		/* Scan snapshots */
+#include <sys/stat.h>
 
 /************************ CONSTANTS & MACROS ************************/
 
@@ -25,6 +34,18 @@
 #define IW15_MAX_SPY		8
 #define IW15_MAX_AP		8
 
+/* Rtnetlink attribute carrying Wireless Events */
+#ifndef IFLA_WIRELESS
+#define IFLA_WIRELESS	(IFLA_MASTER + 1)
+#endif /* IFLA_WIRELESS */
+
+/*
+ * Scan arena : size of the first block, alignment of allocations
+ */
+#define IW_ARENA_BLOCK_SIZE	16384
+#define IW_ARENA_ALIGN		16
+#define IW_ARENA_ROUND(x)	(((x) + IW_ARENA_ALIGN - 1) & ~(IW_ARENA_ALIGN - 1))
+
 /****************************** TYPES ******************************/
 
 /*
@@ -90,6 +111,63 @@ union	iw_range_raw
 #define iwr_off(f)	( ((char *) &(((struct iw_range *) NULL)->f)) - \
 			  (char *) NULL)
 
+/*
+ * A block of memory of the scan arena. Data follow the header.
+ */
+struct iw_scan_block
+{
+  struct iw_scan_block *	next;		/* Next block in arena */
+  size_t			size;		/* Size of data */
+  size_t			used;		/* Data allocated */
+};
+#define IW_ARENA_HDR_SIZE	IW_ARENA_ROUND(sizeof(struct iw_scan_block))
+
+/*
+ * Arena holding all the results of a scan. Blocks are never freed
+ * between scans, only rewinded, so that a long running scanner reuse
+ * the same memory over and over instead of fragmenting the heap.
+ */
+struct iw_scan_arena
+{
+  struct iw_scan_block *	first;		/* Head of list of blocks */
+  struct iw_scan_block *	current;	/* Block we allocate from */
+  struct iw_scan_block *	last;		/* Tail of list of blocks */
+};
+
+/*
+ * State of an asynchronous scan. The caller only see a single fd
+ * (an epoll set), we hide behind it the timer and the rtnetlink socket.
+ */
+struct iw_scan_async
+{
+  char		ifname[IFNAMSIZ + 1];	/* Interface being scanned */
+  int		ifindex;
+  int		we_version;
+  int		epfd;			/* What the caller poll */
+  int		timerfd;		/* Fallback timer */
+  int		nlfd;			/* Scan completion events, or -1 */
+  int		listen;			/* Only read the scans of others */
+};
+
+/*
+ * Header of a capture file of scan results. It is followed by the
+ * range (if any) and the raw results. Everything is in host order,
+ * captures are meant to be replayed on the same architecture.
+ */
+struct iw_capture_hdr
+{
+  char		magic[8];		/* IW_CAPTURE_MAGIC */
+  __u32		version;		/* IW_CAPTURE_VERSION */
+  __u32		we_version;		/* WE version of the driver */
+  char		ifname[IFNAMSIZ];	/* Interface scanned */
+  __u32		range_len;		/* Size of range, 0 if none */
+  __u32		data_len;		/* Size of raw results */
+};
+#define IW_CAPTURE_MAGIC	"IWSCAN\0\0"
+#define IW_CAPTURE_VERSION	1
+/* Way more than what SIOCGIWSCAN can return, catch corrupted files */
+#define IW_CAPTURE_MAX_DATA	(16 * 1024 * 1024)
+
 /**************************** VARIABLES ****************************/
 
 /* Modes as human readable strings */
@@ -141,8 +219,77 @@ const struct iw_modul_descr	iw_modul_list[] = {
 /* Disable runtime version warning in iw_get_range_info() */
 int	iw_ignore_version = 0;
 
+/* Where the Wireless Extension requests go, NULL for the kernel */
+const iw_transport *	iw_current_transport = NULL;
+
+/* Transports that can be selected by name */
+static const iw_transport * const	iw_transports[] = {
+#if defined(IW_SIM) && !defined(WE_ESSENTIAL)
+  &iw_sim_transport,
+#endif	/* IW_SIM && !WE_ESSENTIAL */
+  NULL
+};
+
 /************************ SOCKET SUBROUTINES *************************/
 
+/*------------------------------------------------------------------*/
+/*
+ * Find a transport by name. "kernel" is the default (NULL).
+ */
+const iw_transport *
+iw_find_transport(const char *	name)
+{
+  int	i;
+
+  for(i = 0; iw_transports[i] != NULL; i++)
+    if(!strcmp(iw_transports[i]->name, name))
+      return(iw_transports[i]);
+  return(NULL);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Divert all the Wireless Extension requests to a transport.
+ * NULL goes back to the kernel.
+ */
+void
+iw_set_transport(const iw_transport *	transport)
+{
+  iw_current_transport = transport;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Select the transport from the environment (IW_TRANSPORT), so that
+ * all the tools can be used with the simulated driver.
+ * Only done once, and only if the application did not pick one.
+ * Ignored in setuid programs, and unknown names are left to the
+ * tools to report (the kernel is used).
+ */
+static void
+iw_transport_from_env(void)
+{
+  static int		done = 0;
+  const char *		name;
+
+  if(done || (iw_transports[0] == NULL))
+    return;
+  done = 1;
+
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 17))
+  name = secure_getenv("IW_TRANSPORT");
+#else
+  if((getuid() != geteuid()) || (getgid() != getegid()))
+    return;
+  name = getenv("IW_TRANSPORT");
+#endif
+  if((name == NULL) || (iw_current_transport != NULL)
+     || (!strcmp(name, "kernel")))
+    return;
+
+  iw_current_transport = iw_find_transport(name);
+}
+
 /*------------------------------------------------------------------*/
 /*
  * Open a socket.
@@ -158,6 +305,9 @@ iw_sockets_open(void)
   unsigned int	i;
   int		sock;
 
+  /* Check if the user want to divert the requests (testing) */
+  iw_transport_from_env();
+
   /*
    * Now pick any (exisiting) useful socket family for generic queries
    * Note : don't open all the socket, only returns when one matches,
@@ -238,6 +388,14 @@ iw_enum_devices(int		skfd,
   struct ifreq *ifr;
   int		i;
 
+  /* The transport may have its own devices */
+  if((iw_current_transport != NULL)
+     && (iw_current_transport->enum_devices != NULL))
+    {
+      (*iw_current_transport->enum_devices)(skfd, fn, args, count);
+      return;
+    }
+
 #ifndef IW_RESTRIC_ENUM
   /* Check if /proc/net/dev is available */
   fh = fopen(PROC_NET_DEV, "r");
@@ -1918,6 +2076,19 @@ iw_print_timeval(char *				buffer,
 		s % 60, (u_int32_t) timev->tv_usec);
 }
 
+/*------------------------------------------------------------------*/
+/*
+ * Current time in us, for the tables and schedulers that take a time.
+ */
+static __u64
+iw_time_us(void)
+{
+  struct timeval	tv;
+
+  gettimeofday(&tv, NULL);
+  return((__u64) tv.tv_sec * 1000000 + tv.tv_usec);
+}
+
 /*********************** ADDRESS SUBROUTINES ************************/
 /*
  * This section is mostly a cut & past from net-tools-1.2.0
@@ -2382,6 +2553,24 @@ struct iw_ioctl_description
 	__u32	flags;			/* Special handling of the request */
 };
 
+/*
+ * Describe how an event looks like in the event stream.
+ * This merge the description of the ioctl or event with the size of
+ * the fixed part in the stream for a given WE version, so that the
+ * decoder need a single lookup per event. Entries are small and
+ * aligned, so that each one sit in a single cache line.
+ */
+struct iw_event_descr
+{
+	__u8	header_type;		/* NULL, iw_point or other */
+	__u8	value_off;		/* Where fixed part go in iw_event */
+	__u16	header_len;		/* Fixed part in stream, without LCP */
+	__u16	token_size;		/* Granularity of payload */
+	__u16	min_tokens;		/* Min acceptable token number */
+	__u16	max_tokens;		/* Max acceptable token number */
+	__u32	flags;			/* Special handling of the request */
+} __attribute__ ((aligned (16)));
+
 /* -------------------------- VARIABLES -------------------------- */
 
 /*
@@ -2685,6 +2874,75 @@ static const int event_type_size[] = {
 	IW_EV_QUAL_PK_LEN,	/* IW_HEADER_TYPE_QUAL */
 };
 
+/* Number of entries in the flat event tables : all the ioctls, then
+ * the events we know about. Indexed by (cmd - SIOCIWFIRST). */
+#define IW_EVENT_DESCR_NUM	((IWEVFIRST - SIOCIWFIRST) + \
+				 (sizeof(standard_event_descr) / \
+				  sizeof(struct iw_ioctl_description)))
+
+/* Flat event tables, for WE-18 and before, and for WE-19 and later.
+ * The two versions only differ in the size of iw_point events. */
+static struct iw_event_descr	event_descr_table[2][IW_EVENT_DESCR_NUM];
+
+/*------------------------------------------------------------------*/
+/*
+ * Fill one entry of the flat event tables.
+ */
+static void
+iw_fill_event_descr(unsigned int			index,
+		    const struct iw_ioctl_description *	descr)
+{
+  int	v;
+
+  for(v = 0; v < 2; v++)
+    {
+      struct iw_event_descr *	entry = &event_descr_table[v][index];
+      int	header_len = event_type_size[descr->header_type];
+
+      /* Unknown events -> header_len = 0 -> skipped */
+      if(header_len <= IW_EV_LCP_PK_LEN)
+	continue;
+      header_len -= IW_EV_LCP_PK_LEN;
+      /* Fixup for earlier version of WE : pointer in the stream.
+       * WE-19 and later : pointer no longer in the stream. */
+      entry->value_off = IW_EV_LCP_LEN;
+      if(descr->header_type == IW_HEADER_TYPE_POINT)
+	{
+	  if(v == 0)
+	    header_len += IW_EV_POINT_OFF;
+	  else
+	    entry->value_off += IW_EV_POINT_OFF;
+	}
+
+      entry->header_type = descr->header_type;
+      entry->header_len = header_len;
+      entry->token_size = descr->token_size;
+      entry->min_tokens = descr->min_tokens;
+      entry->max_tokens = descr->max_tokens;
+      entry->flags = descr->flags;
+    }
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Generate the flat event tables from the ioctl and event descriptions.
+ * This is done when the library is loaded, before main() and before
+ * any thread may decode events, so the tables are never written while
+ * being read, and there is no "ready" flag to race on. After that,
+ * decoding an event only does a single lookup in the tables.
+ */
+static void __attribute__((constructor))
+iw_init_event_tables(void)
+{
+  unsigned int	i;
+
+  for(i = 0; i < standard_ioctl_num; i++)
+    iw_fill_event_descr(i, &standard_ioctl_descr[i]);
+  for(i = 0; i < standard_event_num; i++)
+    iw_fill_event_descr((IWEVFIRST - SIOCIWFIRST) + i,
+			&standard_event_descr[i]);
+}
+
 /*------------------------------------------------------------------*/
 /*
  * Initialise the struct stream_descr so that we can extract
@@ -2706,15 +2964,19 @@ iw_init_event_stream(struct stream_descr *	stream,	/* Stream of events */
 /*------------------------------------------------------------------*/
 /*
  * Extract the next event from the event stream.
+ * This is the body shared by all our decoders. The event table and
+ * the 32-on-64 fixups are constant in each decoder, so the compiler
+ * can drop the branches that don't apply to it.
  */
-int
-iw_extract_event_stream(struct stream_descr *	stream,	/* Stream of events */
-			struct iw_event *	iwe,	/* Extracted event */
-			int			we_version)
+static inline __attribute__((always_inline)) int
+iw_extract_event_core(struct stream_descr *		stream,
+		      struct iw_event *			iwe,
+		      const struct iw_event_descr *	table,
+		      int				compat)
 {
-  const struct iw_ioctl_description *	descr = NULL;
-  int		event_type = 0;
-  unsigned int	event_len = 1;		/* Invalid */
+  const struct iw_event_descr *	descr;
+  int		event_type;
+  unsigned int	event_len;
   char *	pointer;
   /* Don't "optimise" the following variable, it will crash */
   unsigned	cmd_index;		/* *MUST* be unsigned */
@@ -2741,35 +3003,22 @@ iw_extract_event_stream(struct stream_descr *	stream,	/* Stream of events */
   if(iwe->len <= IW_EV_LCP_PK_LEN)
     return(-1);
 
-  /* Get the type and length of that event */
-  if(iwe->cmd <= SIOCIWLAST)
-    {
-      cmd_index = iwe->cmd - SIOCIWFIRST;
-      if(cmd_index < standard_ioctl_num)
-	descr = &(standard_ioctl_descr[cmd_index]);
-    }
-  else
-    {
-      cmd_index = iwe->cmd - IWEVFIRST;
-      if(cmd_index < standard_event_num)
-	descr = &(standard_event_descr[cmd_index]);
-    }
-  if(descr != NULL)
-    event_type = descr->header_type;
-  /* Unknown events -> event_type=0 => IW_EV_LCP_PK_LEN */
-  event_len = event_type_size[event_type];
-  /* Fixup for earlier version of WE */
-  if((we_version <= 18) && (event_type == IW_HEADER_TYPE_POINT))
-    event_len += IW_EV_POINT_OFF;
+  /* Get the type and length of that event, with the WE fixup.
+   * Unknown events -> event_len=0 */
+  cmd_index = iwe->cmd - SIOCIWFIRST;
+  if(cmd_index >= IW_EVENT_DESCR_NUM)
+    cmd_index = SIOCSIWCOMMIT - SIOCIWFIRST;	/* Never in stream */
+  descr = &table[cmd_index];
+  event_type = descr->header_type;
+  event_len = descr->header_len;
 
   /* Check if we know about this event */
-  if(event_len <= IW_EV_LCP_PK_LEN)
+  if(event_len == 0)
     {
       /* Skip to next event */
       stream->current += iwe->len;
       return(2);
     }
-  event_len -= IW_EV_LCP_PK_LEN;
 
   /* Set pointer on data */
   if(stream->value != NULL)
@@ -2789,13 +3038,9 @@ iw_extract_event_stream(struct stream_descr *	stream,	/* Stream of events */
       stream->current += iwe->len;
       return(-2);
     }
-  /* Fixup for WE-19 and later : pointer no longer in the stream */
+  /* Fixup for WE-19 and later is in the table (value_off) */
   /* Beware of alignement. Dest has local alignement, not packed */
-  if((we_version > 18) && (event_type == IW_HEADER_TYPE_POINT))
-    memcpy((char *) iwe + IW_EV_LCP_LEN + IW_EV_POINT_OFF,
-	   pointer, event_len);
-  else
-    memcpy((char *) iwe + IW_EV_LCP_LEN, pointer, event_len);
+  memcpy((char *) iwe + descr->value_off, pointer, event_len);
 
   /* Skip event in the stream */
   pointer += event_len;
@@ -2811,7 +3056,7 @@ iw_extract_event_stream(struct stream_descr *	stream,	/* Stream of events */
 	  iwe->u.data.pointer = pointer;
 
 	  /* Check that we have a descriptor for the command */
-	  if(descr == NULL)
+	  if(descr->token_size == 0)
 	    /* Can't check payload -> unsafe... */
 	    iwe->u.data.pointer = NULL;	/* Discard paylod */
 	  else
@@ -2825,7 +3070,7 @@ iw_extract_event_stream(struct stream_descr *	stream,	/* Stream of events */
 	       * If the kernel is 64 bits and userspace 32 bits,
 	       * we have an extra 4+4 bytes.
 	       * Fixing that in the kernel would break 64 bits userspace. */
-	      if((token_len != extra_len) && (extra_len >= 4))
+	      if(compat && (token_len != extra_len) && (extra_len >= 4))
 		{
 		  __u16		alt_dlen = *((__u16 *) pointer);
 		  unsigned int	alt_token_len = alt_dlen * descr->token_size;
@@ -2877,7 +3122,7 @@ iw_extract_event_stream(struct stream_descr *	stream,	/* Stream of events */
        * If the kernel is 64 bits and userspace 32 bits,
        * we have an extra 4 bytes.
        * Fixing that in the kernel would break 64 bits userspace. */
-      if((stream->value == NULL)
+      if(compat && (stream->value == NULL)
 	 && ((((iwe->len - IW_EV_LCP_PK_LEN) % event_len) == 4)
 	     || ((iwe->len == 12) && ((event_type == IW_HEADER_TYPE_UINT) ||
 				      (event_type == IW_HEADER_TYPE_QUAL))) ))
@@ -2906,12 +3151,105 @@ iw_extract_event_stream(struct stream_descr *	stream,	/* Stream of events */
   return(1);
 }
 
+/*------------------------------------------------------------------*/
+/*
+ * Decoder for WE-18 and earlier : pointer in the stream.
+ * Those are old kernels, keep all the alignement fixups.
+ */
+static int
+iw_extract_event_we18(struct stream_descr *	stream,
+		      struct iw_event *		iwe,
+		      int			we_version)
+{
+  /* Avoid "Unused parameter" warning */
+  we_version = we_version;
+
+  return(iw_extract_event_core(stream, iwe, event_descr_table[0], 1));
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Decoder for WE-19 and later, when the kernel and userspace agree
+ * on the layout of events. No alignement fixups.
+ */
+static int
+iw_extract_event_native(struct stream_descr *	stream,
+			struct iw_event *	iwe,
+			int			we_version)
+{
+  /* Avoid "Unused parameter" warning */
+  we_version = we_version;
+
+  return(iw_extract_event_core(stream, iwe, event_descr_table[1], 0));
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Decoder for WE-19 and later, when the kernel is 64 bits and
+ * userspace 32 bits, or when the kernel predates packed events (WE-22)
+ * and may pad them. Keep the alignement fixups.
+ */
+static int
+iw_extract_event_compat(struct stream_descr *	stream,
+			struct iw_event *	iwe,
+			int			we_version)
+{
+  /* Avoid "Unused parameter" warning */
+  we_version = we_version;
+
+  return(iw_extract_event_core(stream, iwe, event_descr_table[1], 1));
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Select the event decoder for a WE version.
+ * The parameter we_version should be range.we_version_compiled (see
+ * iw_get_range_info()). Do this once per interface, and call the
+ * decoder through the pointer for every event, this avoid to redo
+ * the version and alignement checks for every event.
+ * The decoder has the same semantic as iw_extract_event_stream().
+ */
+iw_event_decoder
+iw_get_event_decoder(int	we_version)
+{
+  /* Old style, pointer in the stream */
+  if(we_version <= 18)
+    return(iw_extract_event_we18);
+
+  /* Before WE-22, 64 bits kernels did pad events. 32 bits userspace
+   * may run on a 64 bits kernel, and guessing the kernel from uname()
+   * is not reliable (personality, containers), so it always gets the
+   * fixups, they are harmless on a 32 bits kernel. */
+  if((we_version >= 22) && (sizeof(long) >= 8))
+    return(iw_extract_event_native);
+  return(iw_extract_event_compat);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Extract the next event from the event stream.
+ * Generic version, that works with all versions of WE and kernels.
+ * If you decode many events, use iw_get_event_decoder().
+ */
+int
+iw_extract_event_stream(struct stream_descr *	stream,	/* Stream of events */
+			struct iw_event *	iwe,	/* Extracted event */
+			int			we_version)
+{
+  /* Always do the alignement fixups, we don't know where the stream
+   * is coming from... */
+  if(we_version <= 18)
+    return(iw_extract_event_we18(stream, iwe, we_version));
+  return(iw_extract_event_compat(stream, iwe, we_version));
+}
+
 /*********************** SCANNING SUBROUTINES ***********************/
 /*
  * The Wireless Extension API 14 and greater define Wireless Scanning.
  * The normal API is complex, this is an easy API that return
- * a subset of the scanning results. This should be enough for most
- * applications that want to use Scanning.
+ * the scanning results in a simple structure. The common elements
+ * are decoded, the IEs and custom elements are given as is.
+ * This should be enough for most applications that want to use Scanning.
  * If you want to have use the full/normal API, check iwlist.c...
  *
  * Precaution when using scanning :
@@ -2936,15 +3274,145 @@ iw_extract_event_stream(struct stream_descr *	stream,	/* Stream of events */
  * Jean II
  */
 
+/*------------------------------------------------------------------*/
+/*
+ * Allocate memory for the scan results out of the arena.
+ * We first try the current block, then blocks left over by previous
+ * scans, and only then we go to the heap.
+ */
+static void *
+iw_scan_alloc(struct iw_scan_arena *	arena,
+	      size_t			size)
+{
+  struct iw_scan_block *	block = arena->current;
+  size_t			bsize;
+  void *			ptr;
+
+  size = IW_ARENA_ROUND(size);
+
+  /* Find a block with enough room */
+  while((block != NULL) && ((block->used + size) > block->size))
+    {
+      block = block->next;
+      /* Blocks after current were used by the previous scan */
+      if(block != NULL)
+	block->used = 0;
+    }
+
+  if(block == NULL)
+    {
+      /* Make the arena grow geometrically, to limit the number of blocks */
+      bsize = (arena->last != NULL) ? 2 * arena->last->size :
+				      IW_ARENA_BLOCK_SIZE;
+      if(bsize < size)
+	bsize = size;
+      block = (struct iw_scan_block *) malloc(IW_ARENA_HDR_SIZE + bsize);
+      if(block == NULL)
+	return(NULL);
+      block->next = NULL;
+      block->size = bsize;
+      block->used = 0;
+
+      /* Link at the end of the list */
+      if(arena->last != NULL)
+	arena->last->next = block;
+      else
+	arena->first = block;
+      arena->last = block;
+    }
+
+  arena->current = block;
+  ptr = ((char *) block) + IW_ARENA_HDR_SIZE + block->used;
+  block->used += size;
+  return(ptr);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Make room for one more element in an array allocated in the arena.
+ * Arrays start with 4 elements, and double each time they are full.
+ * The elements of a cell usually come together, so most of the time
+ * the array is the last allocation of the block and we can simply
+ * extend it in place.
+ */
+static void *
+iw_scan_grow(struct iw_scan_arena *	arena,
+	     void *			array,
+	     int			num,
+	     size_t			elsize)
+{
+  struct iw_scan_block *	block = arena->current;
+  size_t			oldsize;
+  size_t			newsize;
+  void *			newarray;
+
+  /* First element */
+  if(num == 0)
+    return(iw_scan_alloc(arena, 4 * elsize));
+
+  /* Still some room ? */
+  if((num < 4) || (num & (num - 1)))
+    return(array);
+
+  /* Last allocation of the current block, and enough room after it ? */
+  oldsize = IW_ARENA_ROUND(num * elsize);
+  newsize = IW_ARENA_ROUND(2 * num * elsize);
+  if((block != NULL)
+     && (((char *) array) + oldsize
+	 == ((char *) block) + IW_ARENA_HDR_SIZE + block->used)
+     && ((block->used + newsize - oldsize) <= block->size))
+    {
+      block->used += newsize - oldsize;
+      return(array);
+    }
+
+  /* Move it. The old array is lost until the next scan */
+  newarray = iw_scan_alloc(arena, newsize);
+  if(newarray != NULL)
+    memcpy(newarray, array, num * elsize);
+  return(newarray);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add the payload of an iw_point event to an array of slices.
+ * We don't copy the payload, the slice point in the scan buffer.
+ * Return -1 if out of memory.
+ */
+static int
+iw_scan_add_slice(struct iw_scan_arena *	arena,
+		  iw_scan_slice **		array,
+		  int *				num,
+		  struct iw_event *		event)
+{
+  iw_scan_slice *	slices;
+
+  /* Payload discarded by the decoder, or empty */
+  if((event->u.data.pointer == NULL) || (event->u.data.length == 0))
+    return(0);
+
+  slices = iw_scan_grow(arena, *array, *num, sizeof(iw_scan_slice));
+  if(slices == NULL)
+    return(-1);
+  slices[*num].data = event->u.data.pointer;
+  slices[*num].len = event->u.data.length;
+  *array = slices;
+  (*num)++;
+  return(0);
+}
+
 /*------------------------------------------------------------------*/
 /*
  * Process/store one element from the scanning results in wireless_scan
  */
 static inline struct wireless_scan *
 iw_process_scanning_token(struct iw_event *		event,
-			  struct wireless_scan *	wscan)
+			  struct wireless_scan *	wscan,
+			  struct iw_scan_arena *	arena,
+			  iw_essid_pool *		essids)
 {
   struct wireless_scan *	oldwscan;
+  __s32 *			rates;
 
   /* Now, let's decode the event */
   switch(event->cmd)
@@ -2952,7 +3420,8 @@ iw_process_scanning_token(struct iw_event *		event,
     case SIOCGIWAP:
       /* New cell description. Allocate new cell descriptor, zero it. */
       oldwscan = wscan;
-      wscan = (struct wireless_scan *) malloc(sizeof(struct wireless_scan));
+      wscan = (struct wireless_scan *) iw_scan_alloc(arena,
+						      sizeof(struct wireless_scan));
       if(wscan == NULL)
 	return(wscan);
       /* Link at the end of the list */
@@ -2961,11 +3430,17 @@ iw_process_scanning_token(struct iw_event *		event,
 
       /* Reset it */
       bzero(wscan, sizeof(struct wireless_scan));
+      wscan->essid_id = -1;
 
       /* Save cell identifier */
       wscan->has_ap_addr = 1;
       memcpy(&(wscan->ap_addr), &(event->u.ap_addr), sizeof (sockaddr));
       break;
+    case SIOCGIWNAME:
+      /* Protocol name, such as "IEEE 802.11b" */
+      strncpy(wscan->b.name, event->u.name, IFNAMSIZ);
+      wscan->b.name[IFNAMSIZ] = '\0';
+      break;
     case SIOCGIWNWID:
       wscan->b.has_nwid = 1;
       memcpy(&(wscan->b.nwid), &(event->u.nwid), sizeof(iwparam));
@@ -2986,6 +3461,13 @@ iw_process_scanning_token(struct iw_event *		event,
       memset(wscan->b.essid, '\0', IW_ESSID_MAX_SIZE+1);
       if((event->u.essid.pointer) && (event->u.essid.length))
 	memcpy(wscan->b.essid, event->u.essid.pointer, event->u.essid.length);
+      if(essids != NULL)
+	{
+	  iw_essid_pool_put(essids, wscan->essid_id);
+	  wscan->essid_id = iw_essid_pool_get(essids, wscan->b.essid);
+	  if(wscan->essid_id < 0)
+	    return(NULL);
+	}
       break;
     case SIOCGIWENCODE:
       wscan->b.has_key = 1;
@@ -3002,16 +3484,38 @@ iw_process_scanning_token(struct iw_event *		event,
       memcpy(&wscan->stats.qual, &event->u.qual, sizeof(struct iw_quality));
       break;
     case SIOCGIWRATE:
-      /* Scan may return a list of bitrates. As we have space for only
-       * a single bitrate, we only keep the largest one. */
+      /* Scan may return a list of bitrates. Keep them all, and also
+       * the largest one for the benefit of simple applications. */
       if((!wscan->has_maxbitrate) ||
 	 (event->u.bitrate.value > wscan->maxbitrate.value))
 	{
 	  wscan->has_maxbitrate = 1;
 	  memcpy(&(wscan->maxbitrate), &(event->u.bitrate), sizeof(iwparam));
 	}
+      rates = iw_scan_grow(arena, wscan->bitrates, wscan->num_bitrates,
+			   sizeof(__s32));
+      if(rates == NULL)
+	return(NULL);
+      rates[wscan->num_bitrates++] = event->u.bitrate.value;
+      wscan->bitrates = rates;
+      break;
+    case SIOCGIWMODUL:
+      wscan->has_modul = 1;
+      memcpy(&(wscan->modul), &(event->u.param), sizeof(iwparam));
+      break;
+    case IWEVGENIE:
+      /* Raw IEs, the caller can parse them */
+      if(iw_scan_add_slice(arena, &(wscan->genie), &(wscan->num_genie),
+			   event) < 0)
+	return(NULL);
+      break;
     case IWEVCUSTOM:
-      /* How can we deal with those sanely ? Jean II */
+      /* How can we deal with those sanely ? Give them to the caller
+       * as is, only the driver know what they mean. Jean II */
+      if(iw_scan_add_slice(arena, &(wscan->custom), &(wscan->num_custom),
+			   event) < 0)
+	return(NULL);
+      break;
     default:
       break;
    }	/* switch(event->cmd) */
@@ -3021,72 +3525,260 @@ iw_process_scanning_token(struct iw_event *		event,
 
 /*------------------------------------------------------------------*/
 /*
- * Initiate the scan procedure, and process results.
- * This is a non-blocking procedure and it will return each time
- * it would block, returning the amount of time the caller should wait
- * before calling again.
- * Return -1 for error, delay to wait for (in ms), or 0 for success.
- * Error code is in errno
+ * Open a rtnetlink socket to get the scan completion events.
+ * Do it before triggering the scan, otherwise the event may be gone
+ * before we listen...
+ * Return the socket, or -1 if rtnetlink is not available, in which
+ * case we will just use a timer.
  */
 int
-iw_process_scan(int			skfd,
-		char *			ifname,
-		int			we_version,
-		wireless_scan_head *	context)
+iw_scan_event_open(void)
 {
-  struct iwreq		wrq;
-  unsigned char *	buffer = NULL;		/* Results */
-  int			buflen = IW_SCAN_MAX_DATA; /* Min for compat WE<17 */
-  unsigned char *	newbuf;
+  struct sockaddr_nl	local;
+  int			fd;
 
-  /* Don't waste too much time on interfaces (150 * 100 = 15s) */
-  context->retry++;
-  if(context->retry > 150)
+  fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE);
+  if(fd < 0)
+    return(-1);
+
+  memset(&local, 0, sizeof(local));
+  local.nl_family = AF_NETLINK;
+  local.nl_groups = RTMGRP_LINK;
+  if((bind(fd, (struct sockaddr *) &local, sizeof(local)) < 0)
+     || (fcntl(fd, F_SETFL, O_NONBLOCK) < 0))
     {
-      errno = ETIME;
+      close(fd);
       return(-1);
     }
+  return(fd);
+}
 
-  /* If we have not yet initiated scanning on the interface */
-  if(context->retry == 1)
-    {
-      /* Initiate Scan */
-      wrq.u.data.pointer = NULL;		/* Later */
-      wrq.u.data.flags = 0;
-      wrq.u.data.length = 0;
-      /* Remember that as non-root, we will get an EPERM here */
-      if((iw_set_ext(skfd, ifname, SIOCSIWSCAN, &wrq) < 0)
-	 && (errno != EPERM))
-	return(-1);
-      /* Success : now, just wait for event or results */
-      return(250);	/* Wait 250 ms */
-    }
+/*------------------------------------------------------------------*/
+/*
+ * Check if a stream of Wireless Events contains the scan completion
+ * event. We only need the event id, so just hop over the headers.
+ */
+static int
+iw_stream_has_scan_event(char *	data,
+			 int	len)
+{
+  char *	end = data + len;
+  __u16		ev_len;
+  __u16		ev_cmd;
 
- realloc:
-  /* (Re)allocate the buffer - realloc(NULL, len) == malloc(len) */
-  newbuf = realloc(buffer, buflen);
-  if(newbuf == NULL)
+  while((data + IW_EV_LCP_PK_LEN) <= end)
     {
-      /* man says : If realloc() fails the original block is left untouched */
-      if(buffer)
-	free(buffer);
-      errno = ENOMEM;
-      return(-1);
+      memcpy(&ev_len, data, sizeof(__u16));
+      memcpy(&ev_cmd, data + sizeof(__u16), sizeof(__u16));
+      if(ev_cmd == SIOCGIWSCAN)
+	return(1);
+      if(ev_len <= IW_EV_LCP_PK_LEN)
+	break;
+      data += ev_len;
     }
-  buffer = newbuf;
+  return(0);
+}
 
-  /* Try to read the results */
-  wrq.u.data.pointer = buffer;
-  wrq.u.data.flags = 0;
-  wrq.u.data.length = buflen;
-  if(iw_get_ext(skfd, ifname, SIOCGIWSCAN, &wrq) < 0)
-    {
-      /* Check if buffer was too small (WE-17 only) */
-      if((errno == E2BIG) && (we_version > 16))
-	{
-	  /* Some driver may return very large scan results, either
-	   * because there are many cells, or because they have many
-	   * large elements in cells (like IWEVCUSTOM). Most will
+/*------------------------------------------------------------------*/
+/*
+ * Read all pending messages on the rtnetlink socket, and check if
+ * the driver of the interface has signaled the end of the scan.
+ * If ifindex is 0, accept the event for any interface.
+ * Return 1 if the scan results are ready, 0 if not, -1 on error.
+ */
+int
+iw_scan_event_check(int	fd,
+		    int	ifindex)
+{
+  char			buf[8192];
+  struct nlmsghdr *	h;
+  struct ifinfomsg *	ifi;
+  struct rtattr *	attr;
+  int			attrlen;
+  int			amt;
+  int			len;
+  int			done = 0;
+
+  while(1)
+    {
+      amt = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+      if(amt < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  if(errno == EAGAIN)
+	    return(done);
+	  return(-1);
+	}
+      if(amt == 0)
+	return(done);
+
+      h = (struct nlmsghdr *) buf;
+      while(amt >= (int) sizeof(*h))
+	{
+	  len = h->nlmsg_len;
+	  if((len < (int) sizeof(*h)) || (len > amt))
+	    break;
+
+	  /* Only wireless events of the interface */
+	  ifi = NLMSG_DATA(h);
+	  if((h->nlmsg_type == RTM_NEWLINK)
+	     && (len > (int) NLMSG_LENGTH(sizeof(struct ifinfomsg)))
+	     && ((ifindex == 0) || (ifi->ifi_index == ifindex)))
+	    {
+	      attrlen = len - NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	      attr = (struct rtattr *) (((char *) ifi) +
+					NLMSG_ALIGN(sizeof(struct ifinfomsg)));
+	      while(RTA_OK(attr, attrlen))
+		{
+		  if((attr->rta_type == IFLA_WIRELESS)
+		     && (iw_stream_has_scan_event(RTA_DATA(attr),
+						  RTA_PAYLOAD(attr))))
+		    done = 1;
+		  attr = RTA_NEXT(attr, attrlen);
+		}
+	    }
+
+	  len = NLMSG_ALIGN(len);
+	  amt -= len;
+	  h = (struct nlmsghdr *) ((char *) h + len);
+	}
+    }
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Wait for the scan results : wait for delay (in ms), but return as
+ * soon as the driver tell us the scan is completed.
+ * If fd is -1 (no rtnetlink), this is a simple sleep.
+ * Return 1 if the scan is completed, 0 on timeout, -1 on error.
+ */
+int
+iw_scan_wait(int	fd,
+	     int	ifindex,
+	     int	delay)
+{
+  struct timeval	tv;
+  fd_set		rfds;
+  int			ret;
+
+  /* Good old timer */
+  if(fd < 0)
+    {
+      usleep(delay * 1000);
+      return(0);
+    }
+
+  tv.tv_sec = delay / 1000;
+  tv.tv_usec = (delay % 1000) * 1000;
+  while(1)
+    {
+      FD_ZERO(&rfds);
+      FD_SET(fd, &rfds);
+
+      /* Linux update tv with the time left, which is what we want
+       * if we get events for other interfaces */
+      ret = select(fd + 1, &rfds, NULL, NULL, &tv);
+      if(ret < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  return(-1);
+	}
+      if(ret == 0)
+	return(0);
+
+      ret = iw_scan_event_check(fd, ifindex);
+      if(ret != 0)
+	return(ret);
+    }
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Initiate the scan procedure, and process results.
+ * This is a non-blocking procedure and it will return each time
+ * it would block, returning the amount of time the caller should wait
+ * before calling again.
+ * Return -1 for error, delay to wait for (in ms), or 0 for success.
+ * Error code is in errno
+ */
+int
+iw_process_scan(int			skfd,
+		char *			ifname,
+		int			we_version,
+		wireless_scan_head *	context)
+{
+  struct iwreq		wrq;
+  unsigned char *	buffer;			/* Results */
+  int			buflen = IW_SCAN_MAX_DATA; /* Min for compat WE<17 */
+  unsigned char *	newbuf;
+  int			grown = 0;		/* Buffer was too small */
+
+  /* Don't waste too much time on interfaces (150 * 100 = 15s) */
+  context->retry++;
+  if(context->retry > 150)
+    {
+      errno = ETIME;
+      return(-1);
+    }
+
+  /* If we have not yet initiated scanning on the interface */
+  if(context->retry == 1)
+    {
+      /* Initiate Scan */
+      wrq.u.data.pointer = NULL;		/* Later */
+      wrq.u.data.flags = 0;
+      wrq.u.data.length = 0;
+      /* Remember that as non-root, we will get an EPERM here */
+      if((iw_set_ext(skfd, ifname, SIOCSIWSCAN, &wrq) < 0)
+	 && (errno != EPERM))
+	return(-1);
+      /* Success : now, just wait for event or results */
+      return(250);	/* Wait 250 ms */
+    }
+
+  /* The buffer belong to the context, as the results point in it.
+   * Start with the size that was good enough for the previous scan,
+   * or the size the caller expects. */
+  if(context->buflen > buflen)
+    buflen = context->buflen;
+  if((context->buf_hint > buflen) && (context->buf_hint <= 0xFFFF))
+    buflen = context->buf_hint;
+
+ realloc:
+  /* (Re)allocate the buffer - realloc(NULL, len) == malloc(len) */
+  if(buflen > context->buflen)
+    {
+      /* The buffer may move, drop the results pointing in it */
+      iw_scan_free(context);
+      newbuf = realloc(context->buffer, buflen);
+      if(newbuf == NULL)
+	{
+	  /* man says : If realloc() fails the original block is left
+	   * untouched, it will be freed with the context */
+	  errno = ENOMEM;
+	  return(-1);
+	}
+      context->buffer = newbuf;
+      context->buflen = buflen;
+    }
+  buffer = context->buffer;
+
+  /* Try to read the results */
+  wrq.u.data.pointer = buffer;
+  wrq.u.data.flags = 0;
+  wrq.u.data.length = buflen;
+  if(iw_get_ext(skfd, ifname, SIOCGIWSCAN, &wrq) < 0)
+    {
+      /* Check if buffer was too small (WE-17 only). The length of
+       * iw_point is 16 bits, we can't go beyond 0xFFFF. */
+      if((errno == E2BIG) && (we_version > 16)
+	   && (buflen < 0xFFFF))
+	{
+	  /* Some driver may return very large scan results, either
+	   * because there are many cells, or because they have many
+	   * large elements in cells (like IWEVCUSTOM). Most will
 	   * only need the regular sized buffer. We now use a dynamic
 	   * allocation of the buffer to satisfy everybody. Of course,
 	   * as we don't know in advance the size of the array, we try
@@ -3098,6 +3790,15 @@ iw_process_scan(int			skfd,
 	  else
 	    buflen *= 2;
 
+	  /* Don't overflow the 16 bit length */
+	  if(buflen > 0xFFFF)
+	    buflen = 0xFFFF;
+
+	  /* The size is remembered in the context, so this should
+	   * only happen when the results get bigger. */
+	  context->buf_miss++;
+	  grown = 1;
+
 	  /* Try again */
 	  goto realloc;
 	}
@@ -3105,63 +3806,117 @@ iw_process_scan(int			skfd,
       /* Check if results not available yet */
       if(errno == EAGAIN)
 	{
-	  free(buffer);
 	  /* Wait for only 100ms from now on */
 	  return(100);	/* Wait 100 ms */
 	}
 
-      free(buffer);
       /* Bad error, please don't come back... */
       return(-1);
     }
 
   /* We have the results, process them */
-  if(wrq.u.data.length)
-    {
-      struct iw_event		iwe;
-      struct stream_descr	stream;
-      struct wireless_scan *	wscan = NULL;
-      int			ret;
 #ifdef DEBUG
-      /* Debugging code. In theory useless, because it's debugged ;-) */
-      int	i;
-      printf("Scan result [%02X", buffer[0]);
-      for(i = 1; i < wrq.u.data.length; i++)
-	printf(":%02X", buffer[i]);
-      printf("]\n");
+  {
+    /* Debugging code. In theory useless, because it's debugged ;-) */
+    int	i;
+    printf("Scan result [%02X", buffer[0]);
+    for(i = 1; i < wrq.u.data.length; i++)
+      printf(":%02X", buffer[i]);
+    printf("]\n");
+  }
 #endif
+  if(iw_scan_decode(context, (char *) buffer, wrq.u.data.length,
+		    we_version) < 0)
+    return(-1);
 
-      /* Init */
-      iw_init_event_stream(&stream, (char *) buffer, wrq.u.data.length);
-      /* This is dangerous, we may leak user data... */
-      context->result = NULL;
+  /* Keep the raw results for the caller */
+  context->datalen = wrq.u.data.length;
+  if(!grown)
+    context->buf_hit++;
+
+  /* Done with this interface - return success */
+  return(0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Forget the results of the context, and release their ESSIDs.
+ */
+static void
+iw_scan_forget(wireless_scan_head *	context)
+{
+  struct wireless_scan *	wscan;
+
+  if(context->essids != NULL)
+    for(wscan = context->result; wscan != NULL; wscan = wscan->next)
+      {
+	iw_essid_pool_put(context->essids, wscan->essid_id);
+	wscan->essid_id = -1;
+      }
+  context->result = NULL;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Decode raw scan results into the linked list of wireless_scan of
+ * the context, replacing the previous results.
+ * This is what iw_process_scan() does with the results of SIOCGIWSCAN,
+ * but the data may come from anywhere (capture, generator...). The
+ * payload of IWEVGENIE and IWEVCUSTOM is not copied, so the data must
+ * stay valid as long as the results are used.
+ * Return -1 for error (in errno) and 0 for success.
+ */
+int
+iw_scan_decode(wireless_scan_head *	context,
+	       char *			data,
+	       int			len,
+	       int			we_version)
+{
+  struct iw_event		iwe;
+  struct stream_descr		stream;
+  struct wireless_scan *	wscan = NULL;
+  iw_event_decoder		decode = iw_get_event_decoder(we_version);
+  int				ret;
+
+  /* Reuse the memory of the previous results */
+  iw_scan_free(context);
+  if(context->arena == NULL)
+    {
+      context->arena = calloc(1, sizeof(struct iw_scan_arena));
+      if(context->arena == NULL)
+	{
+	  errno = ENOMEM;
+	  return(-1);
+	}
+    }
 
-      /* Look every token */
-      do
+  /* Look every token */
+  iw_init_event_stream(&stream, data, len);
+  do
+    {
+      /* Extract an event and store it */
+      ret = decode(&stream, &iwe, we_version);
+      if(ret > 0)
 	{
-	  /* Extract an event and print it */
-	  ret = iw_extract_event_stream(&stream, &iwe, we_version);
-	  if(ret > 0)
+	  /* Events before the first cell are meaningless */
+	  if((wscan == NULL) && (iwe.cmd != SIOCGIWAP))
+	    continue;
+	  /* Convert to wireless_scan struct */
+	  wscan = iw_process_scanning_token(&iwe, wscan, context->arena,
+					    context->essids);
+	  /* Check problems */
+	  if(wscan == NULL)
 	    {
-	      /* Convert to wireless_scan struct */
-	      wscan = iw_process_scanning_token(&iwe, wscan);
-	      /* Check problems */
-	      if(wscan == NULL)
-		{
-		  free(buffer);
-		  errno = ENOMEM;
-		  return(-1);
-		}
-	      /* Save head of list */
-	      if(context->result == NULL)
-		context->result = wscan;
+	      errno = ENOMEM;
+	      return(-1);
 	    }
+	  /* Save head of list */
+	  if(context->result == NULL)
+	    context->result = wscan;
 	}
-      while(ret > 0);
     }
+  while(ret > 0);
 
-  /* Done with this interface - return success */
-  free(buffer);
   return(0);
 }
 
@@ -3172,7 +3927,11 @@ iw_process_scan(int			skfd,
  * or when an error occur.
  *
  * The scan results are given in a linked list of wireless_scan objects.
- * The caller *must* free the result himself (by walking the list).
+ * The context must be set with iw_scan_init() before its first use.
+ * The result belong to the context, and stay valid until the next scan
+ * using the same context or until iw_scan_free(). The cells must not
+ * be freed one by one. Memory is reused between scans, the caller must
+ * call iw_scan_release() when done with the context.
  * If there is an error, -1 is returned and the error code is available
  * in errno.
  *
@@ -3181,6 +3940,10 @@ iw_process_scan(int			skfd,
  * iw_get_kernel_we_version(). For performance reason, you should
  * cache this parameter when possible rather than querying it every time.
  *
+ * The driver signal the end of the scan with a rtnetlink event, we
+ * read the results as soon as we get it. Drivers that don't send the
+ * event, or if rtnetlink is not available, fall back to polling.
+ *
  * Return -1 for error and 0 for success.
  */
 int
@@ -3190,11 +3953,17 @@ iw_scan(int			skfd,
 	wireless_scan_head *	context)
 {
   int		delay;		/* in ms */
+  int		nlfd;		/* Rtnetlink socket */
+  int		ifindex;
 
-  /* Clean up context. Potential memory leak if(context.result != NULL) */
-  context->result = NULL;
+  /* Clean up context. The arena is kept for the new results */
+  iw_scan_forget(context);
   context->retry = 0;
 
+  /* Listen to scan completion events before triggering the scan */
+  nlfd = iw_scan_event_open();
+  ifindex = if_nametoindex(ifname);
+
   /* Wait until we get results or error */
   while(1)
     {
@@ -3205,10 +3974,3129 @@ iw_scan(int			skfd,
       if(delay <= 0)
 	break;
 
-      /* Wait a bit */
-      usleep(delay * 1000);
+      /* Wait a bit, or until the driver tell us it's done */
+      iw_scan_wait(nlfd, ifindex, delay);
     }
 
+  if(nlfd >= 0)
+    close(nlfd);
+
   /* End - return -1 or 0 */
   return(delay);
 }
+
+/*------------------------------------------------------------------*/
+/*
+ * Initialise a scan context, before its first use. Since version 30
+ * the context owns the results and keeps memory between scans, so it
+ * can't be left uninitialised on the stack like before.
+ */
+void
+iw_scan_init(wireless_scan_head *	context)
+{
+  memset(context, 0, sizeof(wireless_scan_head));
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Free the results of a scan.
+ * All the wireless_scan of the result belong to the arena of the
+ * context, so we don't need to free them one by one, we just rewind
+ * the arena (after releasing their ESSIDs, if they are interned).
+ * The memory is kept for the next scan.
+ */
+void
+iw_scan_free(wireless_scan_head *	context)
+{
+  struct iw_scan_arena *	arena = context->arena;
+
+  iw_scan_forget(context);
+  context->datalen = 0;
+  if((arena != NULL) && (arena->first != NULL))
+    {
+      arena->first->used = 0;
+      arena->current = arena->first;
+    }
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Release all the memory associated with the scan context.
+ */
+void
+iw_scan_release(wireless_scan_head *	context)
+{
+  struct iw_scan_arena *	arena = context->arena;
+  struct iw_scan_block *	block;
+  struct iw_scan_block *	next;
+
+  iw_scan_forget(context);
+  if(context->buffer != NULL)
+    {
+      free(context->buffer);
+      context->buffer = NULL;
+      context->buflen = 0;
+      context->datalen = 0;
+    }
+  if(context->async != NULL)
+    {
+      if(context->async->nlfd >= 0)
+	close(context->async->nlfd);
+      close(context->async->timerfd);
+      close(context->async->epfd);
+      free(context->async);
+      context->async = NULL;
+    }
+  if(arena == NULL)
+    return;
+
+  for(block = arena->first; block != NULL; block = next)
+    {
+      next = block->next;
+      free(block);
+    }
+  free(arena);
+  context->arena = NULL;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Arm the timer of an asynchronous scan (in ms), 0 to disarm.
+ */
+static int
+iw_scan_async_timer(struct iw_scan_async *	async,
+		    int				delay)
+{
+  struct itimerspec	its;
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = delay / 1000;
+  its.it_value.tv_nsec = (delay % 1000) * 1000000;
+  return(timerfd_settime(async->timerfd, 0, &its, NULL));
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Create the fds of an asynchronous scan.
+ */
+static struct iw_scan_async *
+iw_scan_async_open(void)
+{
+  struct iw_scan_async *	async;
+  struct epoll_event		ev;
+
+  async = calloc(1, sizeof(struct iw_scan_async));
+  if(async == NULL)
+    return(NULL);
+
+  async->epfd = epoll_create(2);
+  async->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  /* Rtnetlink is optional, we can live with the timer */
+  async->nlfd = iw_scan_event_open();
+  if((async->epfd < 0) || (async->timerfd < 0))
+    goto fail;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = async->timerfd;
+  if(epoll_ctl(async->epfd, EPOLL_CTL_ADD, async->timerfd, &ev) < 0)
+    goto fail;
+  if(async->nlfd >= 0)
+    {
+      ev.data.fd = async->nlfd;
+      if(epoll_ctl(async->epfd, EPOLL_CTL_ADD, async->nlfd, &ev) < 0)
+	goto fail;
+    }
+  return(async);
+
+ fail:
+  if(async->nlfd >= 0)
+    close(async->nlfd);
+  if(async->timerfd >= 0)
+    close(async->timerfd);
+  if(async->epfd >= 0)
+    close(async->epfd);
+  free(async);
+  return(NULL);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Start an asynchronous scan on the interface.
+ * This trigger the scan and return immediately. The caller should then
+ * wait for iw_scan_get_fd() to be readable (poll/select/epoll), and
+ * call iw_scan_handle_ready() each time it is.
+ * This way, a single thread can drive scans on many interfaces, using
+ * one context per interface. The context must be zeroed before its
+ * first use, and released with iw_scan_release(). The fd is kept open
+ * and can be reused by the next scan using the same context.
+ * Return -1 for error (in errno), 0 for success.
+ */
+int
+iw_scan_start(int			skfd,
+	      char *			ifname,
+	      int			we_version,
+	      wireless_scan_head *	context)
+{
+  struct iw_scan_async *	async = context->async;
+  int				delay;
+
+  /* First scan with this context */
+  if(async == NULL)
+    {
+      async = iw_scan_async_open();
+      if(async == NULL)
+	return(-1);
+      context->async = async;
+    }
+
+  strncpy(async->ifname, ifname, IFNAMSIZ);
+  async->ifname[IFNAMSIZ] = '\0';
+  async->ifindex = if_nametoindex(ifname);
+  async->we_version = we_version;
+  async->listen = 0;
+
+  /* Forget events left over by previous scans */
+  if(async->nlfd >= 0)
+    iw_scan_event_check(async->nlfd, async->ifindex);
+
+  /* Clean up context. The arena is kept for the new results */
+  iw_scan_forget(context);
+  context->retry = 0;
+
+  /* Trigger the scan, we get the time to wait for the results */
+  delay = iw_process_scan(skfd, async->ifname, we_version, context);
+  if(delay <= 0)
+    return(-1);
+  return(iw_scan_async_timer(async, delay));
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Listen to the scans done by others on the interface (supplicant,
+ * network manager...), and read their results, without triggering any
+ * scan, so the radio does not spend more time off channel for us.
+ * As with iw_scan_start(), wait for iw_scan_get_fd() to be readable
+ * and call iw_scan_handle_ready(). Each time it returns 0, the context
+ * has the results of the latest scan, and keeps listening for the next.
+ * This needs the scan completion events of rtnetlink.
+ * Return -1 for error (in errno), 0 for success.
+ */
+int
+iw_scan_listen(char *			ifname,
+	       int			we_version,
+	       wireless_scan_head *	context)
+{
+  struct iw_scan_async *	async = context->async;
+
+  if(async == NULL)
+    {
+      async = iw_scan_async_open();
+      if(async == NULL)
+	return(-1);
+      context->async = async;
+    }
+  /* Without events, we would have to poll the driver */
+  if(async->nlfd < 0)
+    {
+      errno = EOPNOTSUPP;
+      return(-1);
+    }
+
+  strncpy(async->ifname, ifname, IFNAMSIZ);
+  async->ifname[IFNAMSIZ] = '\0';
+  async->ifindex = if_nametoindex(ifname);
+  async->we_version = we_version;
+  async->listen = 1;
+
+  /* Only the scans that complete from now on */
+  iw_scan_event_check(async->nlfd, async->ifindex);
+  return(iw_scan_async_timer(async, 0));
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Get the fd to wait on for an asynchronous scan.
+ * Wait for it to be readable (POLLIN/EPOLLIN).
+ * Return -1 if no scan was started with this context.
+ */
+int
+iw_scan_get_fd(wireless_scan_head *	context)
+{
+  if(context->async == NULL)
+    return(-1);
+  return(context->async->epfd);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Process an asynchronous scan, when its fd is readable.
+ * Return -1 for error (in errno), 0 when the scan is completed and the
+ * results are in the context, or a positive value if the scan is still
+ * going on (the caller should wait for the fd again).
+ */
+int
+iw_scan_handle_ready(int			skfd,
+		     wireless_scan_head *	context)
+{
+  struct iw_scan_async *	async = context->async;
+  __u64				expirations;
+  int				fired;
+  int				ready = 0;
+  int				delay;
+
+  if(async == NULL)
+    {
+      errno = EINVAL;
+      return(-1);
+    }
+
+  /* What woke us up ? */
+  fired = (read(async->timerfd, &expirations, sizeof(expirations)) > 0);
+  if(async->nlfd >= 0)
+    /* If we lost some events, better check the results */
+    ready = (iw_scan_event_check(async->nlfd, async->ifindex) != 0);
+
+  /* Not for us, keep waiting */
+  if((!fired) && (!ready))
+    return(1);
+
+  /* Somebody else scanned, just read the results */
+  if(async->listen && ready)
+    context->retry = 1;
+
+  delay = iw_process_scan(skfd, async->ifname, async->we_version, context);
+  if(delay > 0)
+    {
+      /* Not yet, try again later */
+      if(iw_scan_async_timer(async, delay) < 0)
+	return(-1);
+      return(delay);
+    }
+
+  /* Done (or failed), we don't want the timer anymore */
+  iw_scan_async_timer(async, 0);
+  return(delay);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Initialise an iterator over the cells of a buffer of scan results.
+ * The buffer is the raw result of SIOCGIWSCAN, and is walked in place,
+ * so it must not be modified or freed while the iterator is in use.
+ */
+void
+iw_scan_iter_init(iw_scan_iter *	iter,
+		  char *		data,
+		  int			len,
+		  int			we_version)
+{
+  iter->current = data;
+  iter->end = data + len;
+  iter->we_version = we_version;
+  iter->decode = iw_get_event_decoder(we_version);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Get a view of the next cell of the scan results.
+ * As opposed to iw_process_scan(), nothing is allocated or decoded,
+ * we only hop over the headers of the events until the start of the
+ * next cell (SIOCGIWAP). Only the cell address is extracted, so that
+ * the caller can identify the cell without decoding it.
+ * Events that preceed the first cell are skipped.
+ * Return 1 if a cell was found, 0 at the end of the buffer.
+ */
+int
+iw_scan_iter_next_cell(iw_scan_iter *	iter,
+		       iw_scan_cell *	cell)
+{
+  char *		pos = iter->current;
+  char *		start = NULL;
+  __u16			ev_len;
+  __u16			ev_cmd;
+  struct stream_descr	stream;
+  struct iw_event	iwe;
+
+  /* Walk the event headers. The stream may be unaligned, therefore copy */
+  while((pos + IW_EV_LCP_PK_LEN) <= iter->end)
+    {
+      memcpy(&ev_len, pos, sizeof(__u16));
+      memcpy(&ev_cmd, pos + sizeof(__u16), sizeof(__u16));
+
+      /* Invalid event, can't go any further */
+      if(ev_len <= IW_EV_LCP_PK_LEN)
+	{
+	  iter->end = pos;
+	  break;
+	}
+
+      /* Start of a cell ? */
+      if(ev_cmd == SIOCGIWAP)
+	{
+	  /* Start of the cell after ours, we are done */
+	  if(start != NULL)
+	    break;
+	  start = pos;
+	}
+
+      pos += ev_len;
+    }
+
+  /* Last event may be truncated */
+  if(pos > iter->end)
+    pos = iter->end;
+  iter->current = pos;
+
+  if(start == NULL)
+    return(0);
+
+  cell->data = start;
+  cell->len = pos - start;
+
+  /* Decode the address, it's the first event of the cell */
+  iw_init_event_stream(&stream, cell->data, cell->len);
+  if((iter->decode(&stream, &iwe, iter->we_version) > 0)
+     && (iwe.cmd == SIOCGIWAP))
+    memcpy(&(cell->ap_addr), &(iwe.u.ap_addr), sizeof(sockaddr));
+  else
+    memset(&(cell->ap_addr), 0, sizeof(sockaddr));
+
+  return(1);
+}
+
+/***************** INFORMATION ELEMENT SUBROUTINES *****************/
+/*
+ * Decoding of the information elements of the beacons, that the
+ * drivers give us in IWEVGENIE. Applications that select networks
+ * need the security, capabilities and load of each cell, in binary
+ * form rather than as text. Each IE is decoded by its own parser,
+ * found through a table indexed by the element ID, and nothing is
+ * allocated.
+ */
+
+/* Parser for one IE, gets the body of the IE (after ID and length) */
+typedef void (*iw_ie_parser)(const unsigned char *	data,
+			     int			len,
+			     iw_ie_info *		info);
+
+/* OUIs of the cipher/AKM suites */
+static const unsigned char	iw_ie_wpa_oui[3] = {0x00, 0x50, 0xf2};
+static const unsigned char	iw_ie_rsn_oui[3] = {0x00, 0x0f, 0xac};
+
+/*------------------------------------------------------------------*/
+/*
+ * Read a little endian value from an IE.
+ */
+static inline __u16
+iw_ie_le16(const unsigned char *	data)
+{
+  return(data[0] | (data[1] << 8));
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Decode a cipher or AKM suite : the type if it has our OUI.
+ */
+static inline __u8
+iw_ie_suite(const unsigned char *	data,
+	    const unsigned char *	oui)
+{
+  if(memcmp(data, oui, 3) != 0)
+    return(IW_IE_SUITE_PROPRIETARY);
+  return(data[3]);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Decode a list of suites, return the new offset or -1 if the list
+ * doesn't fit in the IE. Only the first IW_IE_MAX_SUITES are kept,
+ * if there are more IW_IE_RSN_SUITES_CUT is set in fields.
+ */
+static int
+iw_ie_suite_list(const unsigned char *	data,
+		 int			len,
+		 int			offset,
+		 const unsigned char *	oui,
+		 __u8 *			num,
+		 __u8 *			suites,
+		 __u8 *			fields)
+{
+  int	cnt;
+  int	i;
+
+  if(len < (offset + 2))
+    return(-1);
+  cnt = iw_ie_le16(data + offset);
+  offset += 2;
+  if(len < (offset + 4 * cnt))
+    return(-1);
+
+  *num = (cnt > 255) ? 255 : cnt;
+  if(cnt > IW_IE_MAX_SUITES)
+    *fields |= IW_IE_RSN_SUITES_CUT;
+  for(i = 0; (i < cnt) && (i < IW_IE_MAX_SUITES); i++)
+    suites[i] = iw_ie_suite(data + offset + 4 * i, oui);
+  return(offset + 4 * cnt);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Decode the body of a WPA or RSN IE (after the OUI for WPA).
+ * Everything after the version is optional, missing fields keep the
+ * default of the standard.
+ */
+static void
+iw_ie_parse_security(const unsigned char *	data,
+		     int			len,
+		     const unsigned char *	oui,
+		     int			def_cipher,
+		     iw_ie_rsn *		rsn)
+{
+  int	offset = 2;
+
+  memset(rsn, 0, sizeof(iw_ie_rsn));
+  rsn->version = iw_ie_le16(data);
+  rsn->group = def_cipher;
+  rsn->num_pairwise = 1;
+  rsn->pairwise[0] = def_cipher;
+  rsn->num_akm = 1;
+  rsn->akm[0] = IW_IE_KEY_MGMT_802_1X;
+
+  /* Group cipher */
+  if(len < (offset + 4))
+    return;
+  rsn->group = iw_ie_suite(data + offset, oui);
+  rsn->fields |= IW_IE_RSN_GROUP;
+  offset += 4;
+
+  /* Pairwise ciphers */
+  offset = iw_ie_suite_list(data, len, offset, oui,
+			    &rsn->num_pairwise, rsn->pairwise,
+			    &rsn->fields);
+  if(offset < 0)
+    return;
+  rsn->fields |= IW_IE_RSN_PAIRWISE;
+
+  /* Authentication suites */
+  offset = iw_ie_suite_list(data, len, offset, oui,
+			    &rsn->num_akm, rsn->akm,
+			    &rsn->fields);
+  if(offset < 0)
+    return;
+  rsn->fields |= IW_IE_RSN_AKM;
+
+  /* Capabilities */
+  if(len < (offset + 2))
+    return;
+  rsn->capabilities = iw_ie_le16(data + offset);
+  rsn->fields |= IW_IE_RSN_CAPA;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * RSN (WPA2) IE.
+ */
+static void
+iw_ie_parse_rsn(const unsigned char *	data,
+		int			len,
+		iw_ie_info *		info)
+{
+  iw_ie_parse_security(data, len, iw_ie_rsn_oui, IW_IE_CIPHER_CCMP,
+		       &info->rsn);
+  info->present |= IW_IE_HAS_RSN;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Vendor specific IE. We remember the OUI and type of all of them,
+ * and decode WPA.
+ */
+static void
+iw_ie_parse_vendor(const unsigned char *	data,
+		   int				len,
+		   iw_ie_info *			info)
+{
+  __u32	vendor = (data[0] << 16) | (data[1] << 8) | data[2];
+
+  vendor = (vendor << 8) | ((len > 3) ? data[3] : 0);
+  if(info->num_vendors < IW_IE_MAX_VENDORS)
+    info->vendors[info->num_vendors++] = vendor;
+  info->present |= IW_IE_HAS_VENDOR;
+
+  /* WPA : OUI, type 1, then like RSN */
+  if((vendor == 0x0050f201) && (len >= 6))
+    {
+      iw_ie_parse_security(data + 4, len - 4, iw_ie_wpa_oui,
+			   IW_IE_CIPHER_TKIP, &info->wpa);
+      info->present |= IW_IE_HAS_WPA;
+    }
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * HT Capabilities IE.
+ */
+static void
+iw_ie_parse_ht(const unsigned char *	data,
+	       int			len,
+	       iw_ie_info *		info)
+{
+  int	i;
+
+  /* Avoid "Unused parameter" warning */
+  len = len;
+
+  info->ht_capa = iw_ie_le16(data);
+  info->ht_ampdu = data[2];
+  /* One byte of the Rx MCS bitmask per spatial stream */
+  info->ht_streams = 0;
+  for(i = 0; i < 4; i++)
+    if(data[3 + i] != 0)
+      info->ht_streams = i + 1;
+  info->present |= IW_IE_HAS_HT;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * VHT Capabilities IE.
+ */
+static void
+iw_ie_parse_vht(const unsigned char *	data,
+		int			len,
+		iw_ie_info *		info)
+{
+  int	i;
+
+  /* Avoid "Unused parameter" warning */
+  len = len;
+
+  info->vht_capa = iw_ie_le16(data) | (iw_ie_le16(data + 2) << 16);
+  info->vht_rx_mcs = iw_ie_le16(data + 4);
+  info->vht_tx_mcs = iw_ie_le16(data + 8);
+  /* Two bits per spatial stream, 3 = not supported */
+  info->vht_streams = 0;
+  for(i = 0; i < 8; i++)
+    if(((info->vht_rx_mcs >> (2 * i)) & 0x3) != 0x3)
+      info->vht_streams = i + 1;
+  info->present |= IW_IE_HAS_VHT;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Country IE : code, then a list of subbands.
+ */
+static void
+iw_ie_parse_country(const unsigned char *	data,
+		    int				len,
+		    iw_ie_info *		info)
+{
+  int	offset;
+
+  memcpy(info->country, data, 3);
+  info->max_txpower = 0;
+  for(offset = 3; (offset + 3) <= len; offset += 3)
+    {
+      /* First channel above 200 are operating extensions */
+      if((data[offset] <= 200)
+	 && ((__s8) data[offset + 2] > info->max_txpower))
+	info->max_txpower = data[offset + 2];
+    }
+  info->present |= IW_IE_HAS_COUNTRY;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * BSS Load IE.
+ */
+static void
+iw_ie_parse_bss_load(const unsigned char *	data,
+		     int			len,
+		     iw_ie_info *		info)
+{
+  /* Avoid "Unused parameter" warning */
+  len = len;
+
+  info->sta_count = iw_ie_le16(data);
+  info->chan_util = data[2];
+  info->avail_capacity = iw_ie_le16(data + 3);
+  info->present |= IW_IE_HAS_BSS_LOAD;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Supported Rates and Extended Supported Rates IEs, merged.
+ */
+static void
+iw_ie_parse_rates(const unsigned char *	data,
+		  int			len,
+		  iw_ie_info *		info)
+{
+  int	i;
+
+  for(i = 0; (i < len) && (info->num_rates < IW_IE_MAX_RATES); i++)
+    info->rates[info->num_rates++] = data[i];
+  info->present |= IW_IE_HAS_RATES;
+}
+
+/* The parsers, with the minimum length of the body of their IE */
+static const struct iw_ie_descr
+{
+  iw_ie_parser	parse;
+  int		min_len;
+} iw_ie_descr_table[] = {
+  { NULL, 0 },				/* Ignored IEs */
+  { iw_ie_parse_rates, 1 },
+  { iw_ie_parse_country, 3 },
+  { iw_ie_parse_bss_load, 5 },
+  { iw_ie_parse_ht, 26 },
+  { iw_ie_parse_rsn, 2 },
+  { iw_ie_parse_vht, 12 },
+  { iw_ie_parse_vendor, 3 },
+};
+
+/* Element ID -> parser in the table above */
+static const unsigned char	iw_ie_descr_index[256] = {
+  [0x01] = 1,			/* Supported Rates */
+  [0x07] = 2,			/* Country */
+  [0x0b] = 3,			/* BSS Load */
+  [0x2d] = 4,			/* HT Capabilities */
+  [0x30] = 5,			/* RSN */
+  [0x32] = 1,			/* Extended Supported Rates */
+  [0xbf] = 6,			/* VHT Capabilities */
+  [0xdd] = 7,			/* Vendor Specific */
+};
+
+/*------------------------------------------------------------------*/
+/*
+ * Walk a chain of IEs, and decode the ones we know in info.
+ * Return the number of IEs.
+ */
+static int
+iw_ie_parse_chain(const unsigned char *	buffer,
+		  int			buflen,
+		  iw_ie_info *		info)
+{
+  const struct iw_ie_descr *	descr;
+  int				offset = 0;
+  int				len;
+  int				num = 0;
+
+  /* Each IE is at least 2 bytes */
+  while((offset + 2) <= buflen)
+    {
+      len = buffer[offset + 1];
+      if((offset + 2 + len) > buflen)
+	break;
+
+      descr = &iw_ie_descr_table[iw_ie_descr_index[buffer[offset]]];
+      if((descr->parse != NULL) && (len >= descr->min_len))
+	descr->parse(buffer + offset + 2, len, info);
+
+      offset += 2 + len;
+      num++;
+    }
+
+  /* Some drivers cut the IEs... */
+  if(offset != buflen)
+    info->present |= IW_IE_MALFORMED;
+  return(num);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Decode a buffer of IEs, such as the payload of IWEVGENIE.
+ * Return the number of IEs ; if the last IE was truncated, the flag
+ * IW_IE_MALFORMED is set in info->present.
+ */
+int
+iw_parse_ies(const unsigned char *	buffer,
+	     int			buflen,
+	     iw_ie_info *		info)
+{
+  memset(info, 0, sizeof(iw_ie_info));
+  return(iw_ie_parse_chain(buffer, buflen, info));
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Decode all the IEs of a cell of the scan results (see iw_scan()).
+ * Some drivers give each IE in its own IWEVGENIE, so look at them all.
+ * Return the number of IEs.
+ */
+int
+iw_scan_parse_ies(const struct wireless_scan *	wscan,
+		  iw_ie_info *			info)
+{
+  int	num = 0;
+  int	i;
+
+  memset(info, 0, sizeof(iw_ie_info));
+  for(i = 0; i < wscan->num_genie; i++)
+    num += iw_ie_parse_chain((const unsigned char *) wscan->genie[i].data,
+			     wscan->genie[i].len, info);
+  return(num);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Validate a chain of IEs and index it by element ID, in a single
+ * pass. Each step only need one check against the end of the buffer,
+ * an IE overflowing the buffer is detected (and dropped) at the end.
+ * After that, iw_ie_find() find an IE without walking the chain, and
+ * walking the chain needs no more bound checks.
+ * The IEs are not copied, the buffer must stay valid while the index
+ * is used.
+ * Return the number of valid IEs, or -1 if the chain is malformed, in
+ * which case the index is still valid for the IEs before the error.
+ */
+int
+iw_ie_index_build(iw_ie_index *		index,
+		  const unsigned char *	buffer,
+		  int			buflen)
+{
+  int		offset = 0;
+  int		last = 0;
+  int		num = 0;
+  int		id;
+
+  memset(index->ids, 0, sizeof(index->ids));
+  index->buffer = buffer;
+
+  /* The IWEVGENIE length is 16 bits, and so are our offsets */
+  if(buflen > 0xFFFF)
+    buflen = 0xFFFF;
+
+  while((offset + 2) <= buflen)
+    {
+      id = buffer[offset];
+      if(!(index->ids[id >> 5] & (1U << (id & 0x1F))))
+	{
+	  index->ids[id >> 5] |= 1U << (id & 0x1F);
+	  index->first[id] = offset;
+	}
+      last = offset;
+      offset += buffer[offset + 1] + 2;
+      num++;
+    }
+
+  /* Complete chain */
+  if(offset == buflen)
+    {
+      index->buflen = buflen;
+      index->num_ies = num;
+      return(num);
+    }
+
+  /* The last IE overflows the buffer (or there is a stray byte).
+   * Forget about it, if we indexed it. */
+  if(offset > buflen)
+    {
+      id = buffer[last];
+      if(index->first[id] == last)
+	index->ids[id >> 5] &= ~(1U << (id & 0x1F));
+      offset = last;
+      num--;
+    }
+  index->buflen = offset;
+  index->num_ies = num;
+  return(-1);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Find the next IE with this ID after ie (which must be in the index).
+ * Useful for IDs present multiple times, such as vendor specific IEs.
+ * Return NULL if there is no more.
+ */
+const unsigned char *
+iw_ie_find_next(const iw_ie_index *	index,
+		const unsigned char *	ie,
+		int			id)
+{
+  const unsigned char *	end = index->buffer + index->buflen;
+
+  /* The chain is validated, no need to check the lengths */
+  for(ie += ie[1] + 2; ie < end; ie += ie[1] + 2)
+    if(ie[0] == id)
+      return(ie);
+  return(NULL);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Find the vendor specific IE with this OUI and type, such as WPA
+ * (0x0050f2, 1) or WMM (0x0050f2, 2).
+ * Return NULL if not found.
+ */
+const unsigned char *
+iw_ie_find_vendor(const iw_ie_index *	index,
+		  __u32			oui,
+		  int			type)
+{
+  const unsigned char *	ie;
+
+  for(ie = iw_ie_find(index, 0xdd); ie != NULL;
+      ie = iw_ie_find_next(index, ie, 0xdd))
+    {
+      if((ie[1] >= 4)
+	 && (ie[2] == ((oui >> 16) & 0xFF))
+	 && (ie[3] == ((oui >> 8) & 0xFF))
+	 && (ie[4] == (oui & 0xFF))
+	 && (ie[5] == type))
+	return(ie);
+    }
+  return(NULL);
+}
+
+/********************* SCAN CAPTURE SUBROUTINES *********************/
+/*
+ * Capture of the raw scan results, so that they can be replayed through
+ * the regular decoding path without the hardware. This is used to debug
+ * drivers remotely (users send us the file) and to benchmark decoding
+ * on real world results.
+ */
+
+/*------------------------------------------------------------------*/
+/*
+ * Write the raw scan results and the range of the interface to a file.
+ * range may be NULL if the range is not available.
+ * Return -1 for error (in errno), 0 for success.
+ */
+int
+iw_scan_capture_write(const char *		filename,
+		      const char *		ifname,
+		      const struct iw_range *	range,
+		      int			we_version,
+		      const unsigned char *	data,
+		      int			len)
+{
+  struct iw_capture_hdr	hdr;
+  FILE *		stream;
+  int			ret = 0;
+  int			err;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, IW_CAPTURE_MAGIC, sizeof(hdr.magic));
+  hdr.version = IW_CAPTURE_VERSION;
+  hdr.we_version = we_version;
+  strncpy(hdr.ifname, ifname, IFNAMSIZ);
+  hdr.range_len = (range != NULL) ? sizeof(struct iw_range) : 0;
+  hdr.data_len = len;
+
+  stream = fopen(filename, "w");
+  if(stream == NULL)
+    return(-1);
+
+  if((fwrite(&hdr, sizeof(hdr), 1, stream) != 1)
+     || ((range != NULL)
+	 && (fwrite(range, sizeof(struct iw_range), 1, stream) != 1))
+     || ((len > 0) && (fwrite(data, len, 1, stream) != 1)))
+    ret = -1;
+
+  /* Keep the error of the first failure */
+  err = errno;
+  if((fclose(stream) != 0) && (ret == 0))
+    return(-1);
+  errno = err;
+  return(ret);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Read a capture of scan results.
+ * The results are allocated with malloc(), the caller must free them.
+ * ifname must be at least IFNAMSIZ + 1 long. If the capture has no
+ * range, *has_range is set to 0 and range is zeroed.
+ * Return -1 for error (in errno), 0 for success.
+ */
+int
+iw_scan_capture_read(const char *	filename,
+		     char *		ifname,
+		     struct iw_range *	range,
+		     int *		has_range,
+		     int *		we_version,
+		     unsigned char **	data,
+		     int *		len)
+{
+  struct iw_capture_hdr	hdr;
+  FILE *		stream;
+  unsigned char *	buffer = NULL;
+  unsigned int		range_len;
+
+  stream = fopen(filename, "r");
+  if(stream == NULL)
+    return(-1);
+
+  /* Check header */
+  if(fread(&hdr, sizeof(hdr), 1, stream) != 1)
+    goto bad;
+  if((memcmp(hdr.magic, IW_CAPTURE_MAGIC, sizeof(hdr.magic)))
+     || (hdr.version != IW_CAPTURE_VERSION)
+     || (hdr.data_len > IW_CAPTURE_MAX_DATA))
+    goto bad;
+
+  /* The range may have been captured by a different version of WT,
+   * use what we know about and skip the rest */
+  memset(range, 0, sizeof(struct iw_range));
+  range_len = hdr.range_len;
+  if(range_len > sizeof(struct iw_range))
+    range_len = sizeof(struct iw_range);
+  if((range_len > 0) && (fread(range, range_len, 1, stream) != 1))
+    goto bad;
+  if((hdr.range_len > range_len)
+     && (fseek(stream, hdr.range_len - range_len, SEEK_CUR) < 0))
+    goto bad;
+
+  /* Raw results. Always allocate, so that the caller can free */
+  buffer = malloc(hdr.data_len + 1);
+  if(buffer == NULL)
+    {
+      fclose(stream);
+      errno = ENOMEM;
+      return(-1);
+    }
+  if((hdr.data_len > 0) && (fread(buffer, hdr.data_len, 1, stream) != 1))
+    goto bad;
+  fclose(stream);
+
+  memcpy(ifname, hdr.ifname, IFNAMSIZ);
+  ifname[IFNAMSIZ] = '\0';
+  *has_range = (hdr.range_len > 0);
+  *we_version = hdr.we_version;
+  *data = buffer;
+  *len = hdr.data_len;
+  return(0);
+
+ bad:
+  if(buffer)
+    free(buffer);
+  fclose(stream);
+  errno = EINVAL;
+  return(-1);
+}
+
+/******************** SCAN SNAPSHOT SUBROUTINES ********************/
+/*
+ * Snapshot of decoded scan results. One process scans and writes the
+ * snapshot, any number of processes map it and use the cells in place,
+ * without parsing anything. The file is replaced atomically (rename),
+ * so readers always see a complete snapshot, and keep the previous one
+ * for as long as they have it mapped.
+ */
+
+/* Way more cells than any scan, catch corrupted files */
+#define IW_SNAPSHOT_MAX_CELLS	(1024 * 1024)
+
+/*------------------------------------------------------------------*/
+/*
+ * Hash of an ESSID (FNV-1a).
+ */
+static __u32
+iw_essid_hash(const char *	essid,
+	      int		len)
+{
+  __u32		hash = 2166136261U;
+  int		i;
+
+  for(i = 0; i < len; i++)
+    hash = (hash ^ (unsigned char) essid[i]) * 16777619U;
+  return(hash);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Look for an ESSID in a pool of ESSIDs (snapshot or scan table). Only
+ * the first len bytes of essid are the ESSID.
+ * The hash table has offsets in the pool plus one, 0 is a free slot.
+ * Return the offset of the ESSID in the pool, or -1 if it's not there,
+ * and in *pslot where it should go.
+ */
+static int
+iw_essid_find(const char *	pool,
+	      const __u32 *	hash,
+	      unsigned int	mask,
+	      const char *	essid,
+	      int		len,
+	      unsigned int *	pslot)
+{
+  unsigned int	slot;
+  const char *	name;
+
+  for(slot = iw_essid_hash(essid, len) & mask; hash[slot] != 0; slot = (slot + 1) & mask)
+    {
+      name = pool + hash[slot] - 1;
+      if(!strncmp(name, essid, len) && (name[len] == '\0'))
+	{
+	  *pslot = slot;
+	  return(hash[slot] - 1);
+	}
+    }
+  *pslot = slot;
+  return(-1);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add an ESSID to a pool of ESSIDs, unless it's already there. Only the
+ * first len bytes of essid are the ESSID. The hash table must never be
+ * more than half full.
+ * Return the offset of the ESSID in the pool, -1 if there is no room.
+ */
+static int
+iw_essid_intern(char *		pool,
+		int *		pool_len,
+		int		pool_size,
+		__u32 *		hash,
+		unsigned int	mask,
+		const char *	essid,
+		int		len)
+{
+  unsigned int	slot;
+  int		offset;
+
+  offset = iw_essid_find(pool, hash, mask, essid, len, &slot);
+  if(offset >= 0)
+    return(offset);
+
+  /* First time we see it */
+  if(*pool_len + len + 1 > pool_size)
+    return(-1);
+  memcpy(pool + *pool_len, essid, len);
+  pool[*pool_len + len] = '\0';
+  hash[slot] = *pool_len + 1;
+  *pool_len += len + 1;
+  return(hash[slot] - 1);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Size of the hash table of a pool of ESSIDs (minus one), so that it is
+ * at most half full.
+ */
+static unsigned int
+iw_essid_hash_mask(int	num_essids)
+{
+  unsigned int	mask;
+
+  for(mask = 15; mask < (unsigned int) (2 * num_essids); mask = 2 * mask + 1)
+    ;
+  return(mask);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Convert a cell of the scan results to a snapshot cell.
+ * The ESSID is done by the caller.
+ */
+static void
+iw_snapshot_cell_fill(iw_snapshot_cell *		cell,
+		      const struct wireless_scan *	wscan,
+		      const struct iw_range *		range)
+{
+  iw_ie_info	info;
+  double	freq;
+  int		channel;
+
+  memcpy(cell->bssid, wscan->ap_addr.sa_data, ETH_ALEN);
+  cell->channel = -1;
+
+  if(wscan->b.has_freq)
+    {
+      /* The driver may give a channel or a frequency */
+      if(wscan->b.freq < KILO)
+	{
+	  cell->channel = (int) wscan->b.freq;
+	  cell->flags |= IW_SNAPSHOT_CHANNEL;
+	  if((range != NULL)
+	     && (iw_channel_to_freq(cell->channel, &freq, range) >= 0))
+	    {
+	      cell->freq = freq / KILO;
+	      cell->flags |= IW_SNAPSHOT_FREQ;
+	    }
+	}
+      else
+	{
+	  cell->freq = wscan->b.freq / KILO;
+	  cell->flags |= IW_SNAPSHOT_FREQ;
+	  if((range != NULL)
+	     && ((channel = iw_freq_to_channel(wscan->b.freq, range)) >= 0))
+	    {
+	      cell->channel = channel;
+	      cell->flags |= IW_SNAPSHOT_CHANNEL;
+	    }
+	}
+    }
+  if(wscan->b.has_mode)
+    {
+      cell->mode = wscan->b.mode;
+      cell->flags |= IW_SNAPSHOT_MODE;
+    }
+  if(wscan->has_stats)
+    {
+      int	level;
+      int	dbm;
+      cell->qual = wscan->stats.qual;
+      cell->flags |= IW_SNAPSHOT_QUAL;
+      dbm = iw_qual_level(&wscan->stats.qual,
+			  range ? &range->max_qual : NULL, &level);
+      if(dbm >= 0)
+	cell->flags |= IW_SNAPSHOT_LEVEL;
+      if(dbm > 0)
+	cell->flags |= IW_SNAPSHOT_DBM;
+    }
+  if(wscan->b.has_key)
+    {
+      cell->flags |= IW_SNAPSHOT_KEY;
+      if(!(wscan->b.key_flags & IW_ENCODE_DISABLED))
+	cell->flags |= IW_SNAPSHOT_ENCRYPTED;
+    }
+  if(wscan->has_maxbitrate)
+    {
+      cell->maxbitrate = wscan->maxbitrate.value;
+      cell->flags |= IW_SNAPSHOT_BITRATE;
+    }
+  if(wscan->num_genie > 0)
+    {
+      iw_scan_parse_ies(wscan, &info);
+      cell->ies = info.present;
+    }
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Write decoded scan results (see iw_scan_decode()) in a snapshot file.
+ * The snapshot is written in a temporary file in the same directory,
+ * and renamed over filename, so readers never see a partial snapshot.
+ * range may be NULL, but then channels and frequencies are not
+ * converted and the quality can't be interpreted.
+ * Return -1 for error (in errno), 0 for success.
+ */
+int
+iw_snapshot_write(const char *			filename,
+		  const char *			ifname,
+		  const struct wireless_scan *	list,
+		  const struct iw_range *	range,
+		  int				we_version)
+{
+  const struct wireless_scan *	wscan;
+  iw_snapshot_header *	header;
+  iw_snapshot_cell *	cell;
+  struct timeval	now;
+  size_t		header_len;
+  size_t		cells_len;
+  size_t		len;
+  char *		image;
+  char *		pool;
+  int			pool_len;
+  int			pool_size;
+  __u32 *		table;
+  unsigned int		mask;
+  char *		tmpname;
+  int			num_cells = 0;
+  int			fd;
+  ssize_t		done;
+  int			ret = -1;
+  int			err;
+
+  for(wscan = list; wscan != NULL; wscan = wscan->next)
+    num_cells++;
+  if(num_cells > IW_SNAPSHOT_MAX_CELLS)
+    {
+      errno = E2BIG;
+      return(-1);
+    }
+
+  mask = iw_essid_hash_mask(num_cells);
+
+  /* Build the whole file in memory, the pool is allocated for the worst
+   * case (all ESSIDs different), the offset 0 is the empty ESSID */
+  header_len = (sizeof(iw_snapshot_header) + 7) & ~7;
+  cells_len = num_cells * sizeof(iw_snapshot_cell);
+  pool_size = 1 + num_cells * (IW_ESSID_MAX_SIZE + 1);
+  image = calloc(1, header_len + cells_len + pool_size);
+  table = calloc(mask + 1, sizeof(__u32));
+  tmpname = malloc(strlen(filename) + 8);
+  if((image == NULL) || (table == NULL) || (tmpname == NULL))
+    {
+      errno = ENOMEM;
+      goto out;
+    }
+  header = (iw_snapshot_header *) image;
+  cell = (iw_snapshot_cell *) (image + header_len);
+  pool = image + header_len + cells_len;
+  pool_len = 1;
+
+  for(wscan = list; wscan != NULL; wscan = wscan->next, cell++)
+    {
+      iw_snapshot_cell_fill(cell, wscan, range);
+      if(wscan->b.has_essid)
+	{
+	  cell->essid_len = strlen(wscan->b.essid);
+	  cell->essid_offset = iw_essid_intern(pool, &pool_len, pool_size,
+					       table, mask, wscan->b.essid,
+					       cell->essid_len);
+	  cell->flags |= IW_SNAPSHOT_ESSID;
+	  if(wscan->b.essid_on)
+	    cell->flags |= IW_SNAPSHOT_ESSID_ON;
+	}
+    }
+
+  gettimeofday(&now, NULL);
+  header->magic = IW_SNAPSHOT_MAGIC;
+  header->version = IW_SNAPSHOT_VERSION;
+  header->header_len = header_len;
+  header->cell_len = sizeof(iw_snapshot_cell);
+  header->we_version = we_version;
+  header->num_cells = num_cells;
+  header->pool_offset = header_len + cells_len;
+  header->pool_len = pool_len;
+  if(range != NULL)
+    {
+      header->flags |= IW_SNAPSHOT_HAS_RANGE;
+      header->max_qual = range->max_qual;
+    }
+  header->timestamp = (__u64) now.tv_sec * 1000000 + now.tv_usec;
+  strncpy(header->ifname, ifname, IFNAMSIZ);
+  len = header->pool_offset + pool_len;
+
+  /* Write it next to the final file, and rename */
+  sprintf(tmpname, "%s.XXXXXX", filename);
+  fd = mkstemp(tmpname);
+  if(fd < 0)
+    goto out;
+  /* mkstemp() is private, but readers may be other users */
+  fchmod(fd, 0644);
+  for(done = 0; done < (ssize_t) len; )
+    {
+      ssize_t	n = write(fd, image + done, len - done);
+      if(n < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  break;
+	}
+      done += n;
+    }
+  if(done == (ssize_t) len)
+    errno = 0;
+  err = errno;
+  if((close(fd) < 0) && (err == 0))
+    err = errno;
+  if((err == 0) && (rename(tmpname, filename) < 0))
+    err = errno;
+  if(err != 0)
+    unlink(tmpname);
+  else
+    ret = 0;
+  errno = err;
+
+ out:
+  err = errno;
+  free(image);
+  free(table);
+  free(tmpname);
+  errno = err;
+  return(ret);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Map a snapshot of scan results in memory.
+ * The snapshot is checked once here, after that the cells and the
+ * ESSIDs can be used directly. The file can be replaced while mapped.
+ * Return -1 for error (in errno), 0 for success.
+ */
+int
+iw_snapshot_open(const char *	filename,
+		 iw_snapshot *	snap)
+{
+  const iw_snapshot_header *	header;
+  const iw_snapshot_cell *	cells;
+  const char *			pool;
+  struct stat			st;
+  void *			map;
+  int				fd;
+  __u32				i;
+
+  memset(snap, 0, sizeof(iw_snapshot));
+
+  fd = open(filename, O_RDONLY);
+  if(fd < 0)
+    return(-1);
+  if(fstat(fd, &st) < 0)
+    {
+      close(fd);
+      return(-1);
+    }
+  if((size_t) st.st_size < sizeof(iw_snapshot_header))
+    {
+      close(fd);
+      errno = EINVAL;
+      return(-1);
+    }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED)
+    return(-1);
+
+  /* Check that everything is inside the file, once and for all */
+  header = map;
+  if((header->magic != IW_SNAPSHOT_MAGIC)
+     || (header->version != IW_SNAPSHOT_VERSION)
+     || (header->header_len < sizeof(iw_snapshot_header))
+     || (header->header_len & 7)
+     || (header->cell_len != sizeof(iw_snapshot_cell))
+     || (header->num_cells > IW_SNAPSHOT_MAX_CELLS)
+     || (header->pool_offset < (header->header_len
+				+ header->num_cells * sizeof(iw_snapshot_cell)))
+     || (header->pool_offset > st.st_size)
+     || (header->pool_len < 1)
+     || (header->pool_len > (st.st_size - header->pool_offset))
+     || (((const char *) map)[header->pool_offset + header->pool_len - 1]
+	 != '\0'))
+    goto bad;
+  cells = (const iw_snapshot_cell *) ((const char *) map
+				      + header->header_len);
+  pool = (const char *) map + header->pool_offset;
+  for(i = 0; i < header->num_cells; i++)
+    if((cells[i].essid_offset >= header->pool_len)
+       || (cells[i].essid_len >= header->pool_len - cells[i].essid_offset)
+       || (pool[cells[i].essid_offset + cells[i].essid_len] != '\0'))
+      goto bad;
+
+  snap->map = map;
+  snap->len = st.st_size;
+  snap->header = header;
+  snap->cells = cells;
+  snap->num_cells = header->num_cells;
+  snap->pool = pool;
+  return(0);
+
+ bad:
+  munmap(map, st.st_size);
+  errno = EINVAL;
+  return(-1);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Unmap a snapshot mapped by iw_snapshot_open().
+ */
+void
+iw_snapshot_close(iw_snapshot *	snap)
+{
+  if(snap->map != NULL)
+    munmap(snap->map, snap->len);
+  memset(snap, 0, sizeof(iw_snapshot));
+}
+
+/********************* SCAN TABLE SUBROUTINES *********************/
+/*
+ * Scan results stored by column rather than by cell. Sorting by signal
+ * or filtering by channel only touches the arrays of those fields,
+ * instead of walking a list of big wireless_scan structures. Sorting
+ * and filtering work on arrays of cell indexes, the columns are never
+ * moved, so the results of a filter can be sorted and so on.
+ */
+
+/* Key of the cells without the field, always sorted last */
+#define IW_SCAN_KEY_MISSING	0xFFFFFFFFU
+
+/*------------------------------------------------------------------*/
+/*
+ * Decode the signal level of a quality, same rules as iw_print_stats().
+ * max_qual is the one of the range, NULL if it's unknown.
+ * Return 1 if the level is in dBm, 0 if it's relative, -1 if invalid.
+ */
+int
+iw_qual_level(const struct iw_quality *	qual,
+	      const struct iw_quality *	max_qual,
+	      int *			plevel)
+{
+  if(qual->updated & IW_QUAL_LEVEL_INVALID)
+    return(-1);
+
+  /* Without the range, we don't know what it is */
+  *plevel = qual->level;
+  if((max_qual == NULL)
+     || ((qual->level == 0)
+	 && !(qual->updated & (IW_QUAL_DBM | IW_QUAL_RCPI))))
+    return(0);
+
+  /* RCPI = int{(Power in dBm +110)*2} */
+  if(qual->updated & IW_QUAL_RCPI)
+    {
+      *plevel = (qual->level / 2) - 110;
+      return(1);
+    }
+  /* dBm are in the range [-192; 63] */
+  if((qual->updated & IW_QUAL_DBM) || (qual->level > max_qual->level))
+    {
+      if(qual->level >= 64)
+	*plevel -= 0x100;
+      return(1);
+    }
+  return(0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Make room in a table for num_cells cells and pool_size bytes of
+ * ESSIDs, and empty it.
+ * Return -1 for error (in errno), 0 for success.
+ */
+static int
+iw_scan_table_alloc(iw_scan_table *	table,
+		    int			num_cells,
+		    int			pool_size)
+{
+  unsigned int	mask = iw_essid_hash_mask(num_cells);
+  size_t	len4;
+  size_t	len2;
+  size_t	len1;
+  char *	mem;
+
+  if((table->mem == NULL) || (num_cells > table->size)
+     || (pool_size > table->pool_size) || (mask > table->hash_mask))
+    {
+      /* All the arrays in one block, the biggest types first so that
+       * everything is aligned */
+      len4 = (2 * num_cells + mask + 1) * sizeof(__u32);
+      len2 = 3 * num_cells * sizeof(__u16);
+      len1 = (ETH_ALEN + 1) * num_cells + pool_size;
+      mem = malloc(len4 + len2 + len1);
+      if(mem == NULL)
+	{
+	  errno = ENOMEM;
+	  return(-1);
+	}
+      free(table->mem);
+      table->mem = mem;
+      table->size = num_cells;
+      table->pool_size = pool_size;
+      table->hash_mask = mask;
+
+      table->freq = (__u32 *) mem;
+      table->essid = table->freq + num_cells;
+      table->hash = table->essid + num_cells;
+      table->level = (__s16 *) (table->hash + mask + 1);
+      table->channel = table->level + num_cells;
+      table->flags = (__u16 *) (table->channel + num_cells);
+      table->qual = (__u8 *) (table->flags + num_cells);
+      table->bssid = table->qual + num_cells;
+      table->pool = (char *) table->bssid + ETH_ALEN * num_cells;
+    }
+
+  memset(table->hash, 0, (table->hash_mask + 1) * sizeof(__u32));
+  table->pool[0] = '\0';
+  table->pool_len = 1;
+  table->num_cells = 0;
+  return(0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Store a snapshot cell in the columns of a table.
+ * Return -1 if the pool of the table is full, 0 for success.
+ */
+static int
+iw_scan_table_put(iw_scan_table *		table,
+		  const iw_snapshot_cell *	cell,
+		  const char *			essid,
+		  const struct iw_quality *	max_qual)
+{
+  int	i = table->num_cells++;
+  int	level = 0;
+  int	dbm = -1;
+  int	len = strlen(essid);
+  int	offset;
+
+  memcpy(table->bssid + ETH_ALEN * i, cell->bssid, ETH_ALEN);
+  table->freq[i] = cell->freq;
+  table->channel[i] = cell->channel;
+  table->flags[i] = cell->flags & ~(IW_SNAPSHOT_LEVEL | IW_SNAPSHOT_DBM);
+  table->qual[i] = cell->qual.qual;
+  if(cell->flags & IW_SNAPSHOT_QUAL)
+    dbm = iw_qual_level(&cell->qual, max_qual, &level);
+  if(dbm >= 0)
+    table->flags[i] |= IW_SNAPSHOT_LEVEL;
+  if(dbm > 0)
+    table->flags[i] |= IW_SNAPSHOT_DBM;
+  table->level[i] = level;
+  /* Trust the string, not the length that came with it */
+  if(len > IW_ESSID_MAX_SIZE)
+    len = IW_ESSID_MAX_SIZE;
+  offset = iw_essid_intern(table->pool, &table->pool_len, table->pool_size,
+			   table->hash, table->hash_mask, essid, len);
+  if(offset < 0)
+    return(-1);
+  table->essid[i] = offset;
+  return(0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Fill a table with decoded scan results (see iw_scan_decode()).
+ * range may be NULL, but then levels are relative.
+ * Return -1 for error (in errno), 0 for success.
+ */
+int
+iw_scan_table_build(iw_scan_table *			table,
+		    const struct wireless_scan *	list,
+		    const struct iw_range *		range)
+{
+  const struct wireless_scan *	wscan;
+  iw_snapshot_cell		cell;
+  int				num_cells = 0;
+
+  for(wscan = list; wscan != NULL; wscan = wscan->next)
+    num_cells++;
+  if(iw_scan_table_alloc(table, num_cells,
+			 1 + num_cells * (IW_ESSID_MAX_SIZE + 1)) < 0)
+    return(-1);
+
+  for(wscan = list; wscan != NULL; wscan = wscan->next)
+    {
+      memset(&cell, 0, sizeof(cell));
+      iw_snapshot_cell_fill(&cell, wscan, range);
+      cell.essid_len = wscan->b.has_essid ? strlen(wscan->b.essid) : 0;
+      if(wscan->b.has_essid)
+	cell.flags |= IW_SNAPSHOT_ESSID
+		      | (wscan->b.essid_on ? IW_SNAPSHOT_ESSID_ON : 0);
+      /* The pool is sized for the worst case, it can't be full */
+      iw_scan_table_put(table, &cell,
+			wscan->b.has_essid ? wscan->b.essid : "",
+			range ? &range->max_qual : NULL);
+    }
+  return(0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Fill a table with the cells of a snapshot (see iw_snapshot_open()).
+ * Return -1 for error (in errno), 0 for success.
+ */
+int
+iw_scan_table_load(iw_scan_table *	table,
+		   const iw_snapshot *	snap)
+{
+  int	i;
+
+  /* The pool of a good snapshot has no duplicate, so the same size is
+   * enough, plus the empty ESSID which has its own place in the table.
+   * A snapshot that doesn't fit was not written by us. */
+  if(iw_scan_table_alloc(table, snap->num_cells,
+			 snap->header->pool_len + 1) < 0)
+    return(-1);
+
+  for(i = 0; i < snap->num_cells; i++)
+    if(iw_scan_table_put(table, &snap->cells[i],
+			 iw_snapshot_essid(snap, &snap->cells[i]),
+			 (snap->header->flags & IW_SNAPSHOT_HAS_RANGE) ?
+			 &snap->header->max_qual : NULL) < 0)
+      {
+	table->num_cells = 0;
+	errno = EINVAL;
+	return(-1);
+      }
+  return(0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Free the memory of a table.
+ */
+void
+iw_scan_table_free(iw_scan_table *	table)
+{
+  free(table->mem);
+  memset(table, 0, sizeof(iw_scan_table));
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Select the cells matching all the criteria of the filter.
+ * order must have room for all the cells. If filter is NULL, all the
+ * cells are selected.
+ * Return the number of cells in order.
+ */
+int
+iw_scan_table_filter(const iw_scan_table *	table,
+		     const iw_scan_filter *	filter,
+		     int *			order)
+{
+  int		num = table->num_cells;
+  int		i;
+  int		j;
+
+  for(i = 0; i < num; i++)
+    order[i] = i;
+  if(filter == NULL)
+    return(num);
+
+  /* Each criteria goes through one column and keeps the cells that
+   * match, the most selective first */
+  if(filter->what & IW_SCAN_FILTER_ESSID)
+    {
+      unsigned int	slot;
+      int		essid;
+      essid = iw_essid_find(table->pool, table->hash, table->hash_mask,
+			    filter->essid, strlen(filter->essid), &slot);
+      /* Not in the pool, no cell has it */
+      if(essid < 0)
+	return(0);
+      for(i = 0, j = 0; i < num; i++)
+	if(table->essid[order[i]] == (__u32) essid)
+	  order[j++] = order[i];
+      num = j;
+    }
+  if(filter->what & IW_SCAN_FILTER_CHANNEL)
+    {
+      for(i = 0, j = 0; i < num; i++)
+	if((table->flags[order[i]] & IW_SNAPSHOT_CHANNEL)
+	   && (table->channel[order[i]] == filter->channel))
+	  order[j++] = order[i];
+      num = j;
+    }
+  if(filter->what & IW_SCAN_FILTER_FREQ)
+    {
+      for(i = 0, j = 0; i < num; i++)
+	if((table->flags[order[i]] & IW_SNAPSHOT_FREQ)
+	   && (table->freq[order[i]] >= filter->min_freq)
+	   && (table->freq[order[i]] <= filter->max_freq))
+	  order[j++] = order[i];
+      num = j;
+    }
+  if(filter->what & IW_SCAN_FILTER_LEVEL)
+    {
+      for(i = 0, j = 0; i < num; i++)
+	if((table->flags[order[i]] & IW_SNAPSHOT_LEVEL)
+	   && (table->level[order[i]] >= filter->min_level))
+	  order[j++] = order[i];
+      num = j;
+    }
+  if(filter->what & IW_SCAN_FILTER_FLAGS)
+    {
+      for(i = 0, j = 0; i < num; i++)
+	if((table->flags[order[i]] & filter->flags_mask)
+	   == filter->flags_value)
+	  order[j++] = order[i];
+      num = j;
+    }
+  return(num);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Compute the sort keys of some cells. Keys sort in ascending order,
+ * cells without the field are always last.
+ * Return -1 if the key is unknown.
+ */
+static int
+iw_scan_table_keys(const iw_scan_table *	table,
+		   int				key,
+		   const int *			order,
+		   int				num,
+		   __u32 *			keys)
+{
+  const __u16 *	flags = table->flags;
+  int		i;
+
+  switch(key & ~IW_SCAN_KEY_DESC)
+    {
+    case IW_SCAN_KEY_LEVEL:
+      for(i = 0; i < num; i++)
+	keys[i] = (flags[order[i]] & IW_SNAPSHOT_LEVEL) ?
+		  (__u32) (table->level[order[i]] + 0x8000) :
+		  IW_SCAN_KEY_MISSING;
+      break;
+    case IW_SCAN_KEY_QUAL:
+      for(i = 0; i < num; i++)
+	keys[i] = (flags[order[i]] & IW_SNAPSHOT_QUAL) ?
+		  table->qual[order[i]] : IW_SCAN_KEY_MISSING;
+      break;
+    case IW_SCAN_KEY_FREQ:
+      for(i = 0; i < num; i++)
+	keys[i] = (flags[order[i]] & IW_SNAPSHOT_FREQ) ?
+		  table->freq[order[i]] : IW_SCAN_KEY_MISSING;
+      break;
+    case IW_SCAN_KEY_CHANNEL:
+      for(i = 0; i < num; i++)
+	keys[i] = (flags[order[i]] & IW_SNAPSHOT_CHANNEL) ?
+		  (__u32) (table->channel[order[i]] + 0x8000) :
+		  IW_SCAN_KEY_MISSING;
+      break;
+    default:
+      return(-1);
+    }
+
+  if(key & IW_SCAN_KEY_DESC)
+    for(i = 0; i < num; i++)
+      if(keys[i] != IW_SCAN_KEY_MISSING)
+	keys[i] = (IW_SCAN_KEY_MISSING - 1) - keys[i];
+  return(0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Sort the cells in order (as returned by iw_scan_table_filter())
+ * by key (IW_SCAN_KEY_XXX). The sort is stable.
+ * This is a radix sort on the keys, linear in the number of cells.
+ * Return -1 for error (in errno), 0 for success.
+ */
+int
+iw_scan_table_sort(const iw_scan_table *	table,
+		   int				key,
+		   int *			order,
+		   int				num)
+{
+  __u32 *	block;
+  __u32 *	keys;
+  __u32 *	keys2;
+  int *		order2;
+  int *		src_order;
+  unsigned int	count[257];
+  int		shift;
+  int		i;
+
+  if(num < 2)
+    return(0);
+  block = malloc(num * (2 * sizeof(__u32) + sizeof(int)));
+  if(block == NULL)
+    {
+      errno = ENOMEM;
+      return(-1);
+    }
+  keys = block;
+  keys2 = keys + num;
+  order2 = (int *) (keys2 + num);
+  if(iw_scan_table_keys(table, key, order, num, keys) < 0)
+    {
+      free(block);
+      errno = EINVAL;
+      return(-1);
+    }
+
+  /* One pass per byte of the key, skip bytes that are all the same */
+  src_order = order;
+  for(shift = 0; shift < 32; shift += 8)
+    {
+      memset(count, 0, sizeof(count));
+      for(i = 0; i < num; i++)
+	count[((keys[i] >> shift) & 0xFF) + 1]++;
+      if(count[((keys[0] >> shift) & 0xFF) + 1] == (unsigned int) num)
+	continue;
+      for(i = 1; i < 257; i++)
+	count[i] += count[i - 1];
+      for(i = 0; i < num; i++)
+	{
+	  unsigned int	d = count[(keys[i] >> shift) & 0xFF]++;
+	  keys2[d] = keys[i];
+	  order2[d] = src_order[i];
+	}
+      /* Swap the buffers */
+      {
+	__u32 *	k = keys;
+	int *	o = src_order;
+	keys = keys2;
+	keys2 = k;
+	src_order = order2;
+	order2 = o;
+      }
+    }
+
+  /* Make sure the result is where the caller want it */
+  if(src_order != order)
+    memcpy(order, src_order, num * sizeof(int));
+  free(block);
+  return(0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Move down an entry of a max-heap until the heap is valid again.
+ */
+static void
+iw_scan_heap_down(__u64 *	heap,
+		  int		num,
+		  int		i)
+{
+  __u64		item = heap[i];
+  int		child;
+
+  while((child = 2 * i + 1) < num)
+    {
+      if(((child + 1) < num) && (heap[child + 1] > heap[child]))
+	child++;
+      if(heap[child] <= item)
+	break;
+      heap[i] = heap[child];
+      i = child;
+    }
+  heap[i] = item;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Keep only the n first cells of order by key (IW_SCAN_KEY_XXX), as if
+ * order was sorted and truncated, but without sorting all the cells.
+ * This keeps the n best cells in a heap, which is cheaper than a sort
+ * when n is small.
+ * Return the number of cells left in order, or -1 for error (in errno).
+ */
+int
+iw_scan_table_top(const iw_scan_table *	table,
+		  int			key,
+		  int *			order,
+		  int			num,
+		  int			n)
+{
+  __u32 *	keys;
+  __u64 *	heap;
+  __u64		item;
+  int		size = 0;
+  int		i;
+
+  if(n > num)
+    n = num;
+  if(n <= 0)
+    return(0);
+  keys = malloc(num * sizeof(__u32));
+  heap = malloc(n * sizeof(__u64));
+  if((keys == NULL) || (heap == NULL))
+    {
+      free(keys);
+      free(heap);
+      errno = ENOMEM;
+      return(-1);
+    }
+  if(iw_scan_table_keys(table, key, order, num, keys) < 0)
+    {
+      free(keys);
+      free(heap);
+      errno = EINVAL;
+      return(-1);
+    }
+
+  /* The position breaks ties, so that the result is the same as the
+   * one of the stable sort. The heap has the worst item on top */
+  for(i = 0; i < num; i++)
+    {
+      item = ((__u64) keys[i] << 32) | i;
+      if(size < n)
+	{
+	  int	j = size++;
+	  /* Move up */
+	  while((j > 0) && (heap[(j - 1) / 2] < item))
+	    {
+	      heap[j] = heap[(j - 1) / 2];
+	      j = (j - 1) / 2;
+	    }
+	  heap[j] = item;
+	}
+      else
+	if(item < heap[0])
+	  {
+	    heap[0] = item;
+	    iw_scan_heap_down(heap, n, 0);
+	  }
+    }
+
+  /* Sort the heap, best first */
+  for(i = n - 1; i > 0; i--)
+    {
+      item = heap[0];
+      heap[0] = heap[i];
+      heap[i] = item;
+      iw_scan_heap_down(heap, i, 0);
+    }
+  for(i = 0; i < n; i++)
+    keys[i] = order[heap[i] & 0xFFFFFFFF];
+  memcpy(order, keys, n * sizeof(int));
+
+  free(keys);
+  free(heap);
+  return(n);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Hash of a BSSID.
+ */
+static __u32
+iw_bssid_hash(const unsigned char *	bssid)
+{
+  __u64		value = 0;
+
+  memcpy(&value, bssid, ETH_ALEN);
+  return((value * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Find the cells of a table in an other table (usually, the previous
+ * scan), by BSSID. For each cell of cur, match gets the index of the
+ * cell of old with the same BSSID, or -1.
+ * Return -1 for error (in errno), the number of cells found in old for
+ * success.
+ */
+int
+iw_scan_table_match(const iw_scan_table *	old,
+		    const iw_scan_table *	cur,
+		    int *			match)
+{
+  unsigned int	mask = iw_essid_hash_mask(old->num_cells);
+  int *		slots;
+  unsigned int	s;
+  int		found = 0;
+  int		i;
+
+  slots = calloc(mask + 1, sizeof(int));
+  if(slots == NULL)
+    {
+      errno = ENOMEM;
+      return(-1);
+    }
+  for(i = 0; i < old->num_cells; i++)
+    {
+      for(s = iw_bssid_hash(old->bssid + ETH_ALEN * i) & mask; slots[s];
+	  s = (s + 1) & mask)
+	;
+      slots[s] = i + 1;
+    }
+
+  for(i = 0; i < cur->num_cells; i++)
+    {
+      match[i] = -1;
+      for(s = iw_bssid_hash(cur->bssid + ETH_ALEN * i) & mask; slots[s];
+	  s = (s + 1) & mask)
+	if(!memcmp(old->bssid + ETH_ALEN * (slots[s] - 1),
+		   cur->bssid + ETH_ALEN * i, ETH_ALEN))
+	  {
+	    match[i] = slots[s] - 1;
+	    found++;
+	    break;
+	  }
+    }
+
+  free(slots);
+  return(found);
+}
+
+/********************** ESSID POOL SUBROUTINES **********************/
+/*
+ * The same few ESSIDs come back in every scan, for many BSS. A pool
+ * keeps a single copy of each ESSID, with an ID that stays the same as
+ * long as it is used, so that ESSIDs can be stored and compared as
+ * ints. IDs are reference counted, and the IDs of forgotten ESSIDs are
+ * reused.
+ * The pool is a hash table of IDs, the hash of each entry is kept next
+ * to it (the BSS tables use the same tables for BSSIDs).
+ */
+
+/* One ESSID of a pool */
+struct iw_essid_entry
+{
+  char		name[IW_ESSID_MAX_SIZE + 1];
+  int		count;			/* References, 0 = free */
+  int		next_free;		/* Next free ID + 1 */
+};
+
+/*------------------------------------------------------------------*/
+/*
+ * Make sure a hash table of records can take num entries and stay at
+ * most half full. The hash of each entry is kept next to it, so that
+ * we don't need the records to move the entries around.
+ * Return -1 for error (in errno), 0 for success.
+ */
+static int
+iw_slots_reserve(int **		pslots,
+		 __u32 **	pkeys,
+		 unsigned int *	pmask,
+		 int		num)
+{
+  unsigned int	mask = *pmask;
+  int *		slots;
+  __u32 *	keys;
+  unsigned int	i;
+  unsigned int	s;
+
+  if((*pslots != NULL) && ((unsigned int) (2 * num) <= mask))
+    return(0);
+  mask = iw_essid_hash_mask(num);
+  if((*pslots != NULL) && (mask <= *pmask))
+    return(0);
+
+  slots = calloc(mask + 1, sizeof(int));
+  keys = malloc((mask + 1) * sizeof(__u32));
+  if((slots == NULL) || (keys == NULL))
+    {
+      free(slots);
+      free(keys);
+      errno = ENOMEM;
+      return(-1);
+    }
+  /* Move the old entries */
+  if(*pslots != NULL)
+    for(i = 0; i <= *pmask; i++)
+      if((*pslots)[i])
+	{
+	  for(s = (*pkeys)[i] & mask; slots[s]; s = (s + 1) & mask)
+	    ;
+	  slots[s] = (*pslots)[i];
+	  keys[s] = (*pkeys)[i];
+	}
+  free(*pslots);
+  free(*pkeys);
+  *pslots = slots;
+  *pkeys = keys;
+  *pmask = mask;
+  return(0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add a record in a hash table of records.
+ */
+static void
+iw_slots_insert(int *		slots,
+		__u32 *		keys,
+		unsigned int	mask,
+		__u32		hash,
+		int		record)
+{
+  unsigned int	s;
+
+  for(s = hash & mask; slots[s]; s = (s + 1) & mask)
+    ;
+  slots[s] = record + 1;
+  keys[s] = hash;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Remove the entry of a slot from a hash table of records, and move
+ * back the entries that follow, as if it never was there.
+ */
+static void
+iw_slots_remove(int *		slots,
+		__u32 *		keys,
+		unsigned int	mask,
+		unsigned int	i)
+{
+  unsigned int	j = i;
+
+  for(;;)
+    {
+      j = (j + 1) & mask;
+      if(!slots[j])
+	break;
+      /* The entry can move back to i only if its home slot is not
+       * between i and j */
+      if(((j - keys[j]) & mask) >= ((j - i) & mask))
+	{
+	  slots[i] = slots[j];
+	  keys[i] = keys[j];
+	  i = j;
+	}
+    }
+  slots[i] = 0;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Find the slot of an ESSID in a pool. The ESSID is cut to len.
+ * Return the slot, or -1.
+ */
+static int
+iw_essid_pool_slot(const iw_essid_pool *	pool,
+		   const char *			essid,
+		   int				len,
+		   __u32			hash)
+{
+  const char *	name;
+  unsigned int	s;
+
+  if(pool->slots == NULL)
+    return(-1);
+  for(s = hash & pool->mask; pool->slots[s]; s = (s + 1) & pool->mask)
+    if(pool->slot_keys[s] == hash)
+      {
+	name = pool->essid[pool->slots[s] - 1].name;
+	if(!memcmp(name, essid, len) && (name[len] == '\0'))
+	  return(s);
+      }
+  return(-1);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Length of an ESSID, as it is stored in a pool.
+ */
+static int
+iw_essid_pool_len(const char *	essid)
+{
+  int	len = strlen(essid);
+
+  if(len > IW_ESSID_MAX_SIZE)
+    len = IW_ESSID_MAX_SIZE;
+  return(len);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Get the ID of an ESSID, add it to the pool if needed. The caller
+ * gets a reference on the ID, to release with iw_essid_pool_put().
+ * Return -1 for error (in errno), the ID for success.
+ */
+int
+iw_essid_pool_get(iw_essid_pool *	pool,
+		  const char *		essid)
+{
+  struct iw_essid_entry *	entry;
+  int				len = iw_essid_pool_len(essid);
+  __u32				hash = iw_essid_hash(essid, len);
+  int				s;
+  int				id;
+
+  s = iw_essid_pool_slot(pool, essid, len, hash);
+  if(s >= 0)
+    {
+      id = pool->slots[s] - 1;
+      pool->essid[id].count++;
+      return(id);
+    }
+
+  /* New ESSID, take a free ID */
+  if(iw_slots_reserve(&pool->slots, &pool->slot_keys, &pool->mask,
+		      pool->num_essids + 1) < 0)
+    return(-1);
+  if(pool->free_essid == 0)
+    {
+      int	size = pool->size ? 2 * pool->size : 16;
+      entry = realloc(pool->essid, size * sizeof(struct iw_essid_entry));
+      if(entry == NULL)
+	{
+	  errno = ENOMEM;
+	  return(-1);
+	}
+      pool->essid = entry;
+      for(id = size - 1; id >= pool->size; id--)
+	{
+	  entry[id].count = 0;
+	  entry[id].next_free = pool->free_essid;
+	  pool->free_essid = id + 1;
+	}
+      pool->size = size;
+    }
+  id = pool->free_essid - 1;
+  entry = &pool->essid[id];
+  pool->free_essid = entry->next_free;
+  memcpy(entry->name, essid, len);
+  entry->name[len] = '\0';
+  entry->count = 1;
+  iw_slots_insert(pool->slots, pool->slot_keys, pool->mask, hash, id);
+  pool->num_essids++;
+  return(id);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Find the ID of an ESSID, without adding it or taking a reference.
+ * Return the ID, or -1 if the ESSID is not in the pool.
+ */
+int
+iw_essid_pool_find(const iw_essid_pool *	pool,
+		   const char *			essid)
+{
+  int		len = iw_essid_pool_len(essid);
+  int		s;
+
+  s = iw_essid_pool_slot(pool, essid, len, iw_essid_hash(essid, len));
+  if(s < 0)
+    return(-1);
+  return(pool->slots[s] - 1);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Release a reference on an ID, and forget the ESSID if that was the
+ * last one. -1 is ignored.
+ */
+void
+iw_essid_pool_put(iw_essid_pool *	pool,
+		  int			id)
+{
+  struct iw_essid_entry *	entry;
+  int				len;
+
+  if(id < 0)
+    return;
+  entry = &pool->essid[id];
+  if(--entry->count > 0)
+    return;
+
+  len = strlen(entry->name);
+  iw_slots_remove(pool->slots, pool->slot_keys, pool->mask,
+		  iw_essid_pool_slot(pool, entry->name, len,
+				     iw_essid_hash(entry->name, len)));
+  entry->next_free = pool->free_essid;
+  pool->free_essid = id + 1;
+  pool->num_essids--;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * ESSID of an ID, "" for -1.
+ */
+const char *
+iw_essid_pool_name(const iw_essid_pool *	pool,
+		   int				id)
+{
+  if(id < 0)
+    return("");
+  return(pool->essid[id].name);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Free the memory of a pool, and empty it.
+ */
+void
+iw_essid_pool_free(iw_essid_pool *	pool)
+{
+  free(pool->essid);
+  free(pool->slots);
+  free(pool->slot_keys);
+  memset(pool, 0, sizeof(iw_essid_pool));
+}
+
+/********************* COMPACT CELL SUBROUTINES *********************/
+/*
+ * A wireless_scan carries a full wireless_config (with room for a key)
+ * and full stats, most of it is never set by a scan. Applications that
+ * keep many cells around (history, BSS lists...) can pack them in the
+ * much smaller iw_compact_cell, with the ESSIDs and protocol names
+ * interned in a pool, and unpack them for the code that expect a
+ * wireless_scan.
+ */
+
+/*------------------------------------------------------------------*/
+/*
+ * Pack a cell of the scan results. The ESSID and the protocol name are
+ * added to the pool, the cell gets a reference on them, to release
+ * with iw_compact_cell_release().
+ * The bit rates (except the largest), IEs, custom data and keys are
+ * not kept.
+ * Return -1 for error (in errno), 0 for success.
+ */
+int
+iw_compact_cell_pack(iw_compact_cell *		cell,
+		     const wireless_scan *	wscan,
+		     iw_essid_pool *		pool)
+{
+  memset(cell, 0, sizeof(iw_compact_cell));
+  cell->essid = -1;
+  cell->name = -1;
+
+  /* Strings first, they are the only thing that can fail */
+  if(wscan->b.name[0] != '\0')
+    {
+      cell->name = iw_essid_pool_get(pool, wscan->b.name);
+      if(cell->name < 0)
+	return(-1);
+    }
+  if(wscan->b.has_essid)
+    {
+      cell->essid = iw_essid_pool_get(pool, wscan->b.essid);
+      if(cell->essid < 0)
+	{
+	  iw_essid_pool_put(pool, cell->name);
+	  cell->name = -1;
+	  return(-1);
+	}
+      cell->has_essid = 1;
+      cell->essid_flags = wscan->b.essid_on;
+    }
+
+  if(wscan->has_ap_addr)
+    {
+      cell->has_bssid = 1;
+      memcpy(cell->bssid, wscan->ap_addr.sa_data, ETH_ALEN);
+    }
+  if(wscan->b.has_nwid)
+    {
+      cell->has_nwid = 1;
+      cell->nwid = wscan->b.nwid.value;
+      cell->nwid_disabled = (wscan->b.nwid.disabled != 0);
+    }
+  if(wscan->b.has_freq)
+    {
+      cell->has_freq = 1;
+      cell->freq = wscan->b.freq;
+      cell->freq_flags = wscan->b.freq_flags;
+    }
+  if(wscan->b.has_key)
+    {
+      cell->has_key = 1;
+      cell->key_flags = wscan->b.key_flags;
+    }
+  if(wscan->b.has_mode)
+    {
+      cell->has_mode = 1;
+      cell->mode = wscan->b.mode;
+    }
+  if(wscan->has_stats)
+    {
+      cell->has_qual = 1;
+      memcpy(&cell->qual, &wscan->stats.qual, sizeof(struct iw_quality));
+    }
+  if(wscan->has_maxbitrate)
+    {
+      cell->has_maxbitrate = 1;
+      cell->maxbitrate = wscan->maxbitrate.value;
+    }
+  if(wscan->has_modul)
+    {
+      cell->has_modul = 1;
+      cell->modul = wscan->modul.value;
+    }
+  return(0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Unpack a cell into a wireless_scan, for the code that want one.
+ * The wireless_scan is not linked, and has no bit rates, IEs or custom
+ * data. The pool is the one used to pack the cell.
+ */
+void
+iw_compact_cell_unpack(wireless_scan *		wscan,
+		       const iw_compact_cell *	cell,
+		       const iw_essid_pool *	pool)
+{
+  memset(wscan, 0, sizeof(wireless_scan));
+  wscan->essid_id = -1;
+
+  if(cell->has_bssid)
+    {
+      wscan->has_ap_addr = 1;
+      wscan->ap_addr.sa_family = ARPHRD_ETHER;
+      memcpy(wscan->ap_addr.sa_data, cell->bssid, ETH_ALEN);
+    }
+  if(cell->name >= 0)
+    strncpy(wscan->b.name, iw_essid_pool_name(pool, cell->name), IFNAMSIZ);
+  if(cell->has_nwid)
+    {
+      wscan->b.has_nwid = 1;
+      wscan->b.nwid.value = cell->nwid;
+      wscan->b.nwid.disabled = cell->nwid_disabled;
+    }
+  if(cell->has_freq)
+    {
+      wscan->b.has_freq = 1;
+      wscan->b.freq = cell->freq;
+      wscan->b.freq_flags = cell->freq_flags;
+    }
+  if(cell->has_key)
+    {
+      /* The key itself is never in the scan results */
+      wscan->b.has_key = 1;
+      wscan->b.key_flags = cell->key_flags | IW_ENCODE_NOKEY;
+    }
+  if(cell->has_essid)
+    {
+      wscan->b.has_essid = 1;
+      wscan->b.essid_on = cell->essid_flags;
+      strcpy(wscan->b.essid, iw_essid_pool_name(pool, cell->essid));
+    }
+  if(cell->has_mode)
+    {
+      wscan->b.has_mode = 1;
+      wscan->b.mode = cell->mode;
+    }
+  if(cell->has_qual)
+    {
+      wscan->has_stats = 1;
+      memcpy(&wscan->stats.qual, &cell->qual, sizeof(struct iw_quality));
+    }
+  if(cell->has_maxbitrate)
+    {
+      wscan->has_maxbitrate = 1;
+      wscan->maxbitrate.value = cell->maxbitrate;
+    }
+  if(cell->has_modul)
+    {
+      wscan->has_modul = 1;
+      wscan->modul.value = cell->modul;
+    }
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Release the strings of a cell.
+ */
+void
+iw_compact_cell_release(iw_compact_cell *	cell,
+			iw_essid_pool *		pool)
+{
+  iw_essid_pool_put(pool, cell->essid);
+  iw_essid_pool_put(pool, cell->name);
+  cell->essid = -1;
+  cell->name = -1;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Pack a list of scan results in an array of cells, in the same order.
+ * The array is allocated, the caller must free it with
+ * iw_compact_cells_free().
+ * Return -1 for error (in errno), the number of cells for success.
+ */
+int
+iw_compact_cells_pack(iw_compact_cell **	pcells,
+		      const wireless_scan *	list,
+		      iw_essid_pool *		pool)
+{
+  const wireless_scan *	wscan;
+  iw_compact_cell *	cells;
+  int			num = 0;
+  int			i;
+
+  for(wscan = list; wscan != NULL; wscan = wscan->next)
+    num++;
+  cells = malloc((num + 1) * sizeof(iw_compact_cell));
+  if(cells == NULL)
+    {
+      errno = ENOMEM;
+      return(-1);
+    }
+
+  for(wscan = list, i = 0; wscan != NULL; wscan = wscan->next, i++)
+    if(iw_compact_cell_pack(&cells[i], wscan, pool) < 0)
+      {
+	iw_compact_cells_free(cells, i, pool);
+	return(-1);
+      }
+  *pcells = cells;
+  return(num);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Free an array of cells, and release their strings.
+ */
+void
+iw_compact_cells_free(iw_compact_cell *	cells,
+		      int		num_cells,
+		      iw_essid_pool *	pool)
+{
+  int		i;
+
+  for(i = 0; i < num_cells; i++)
+    iw_compact_cell_release(&cells[i], pool);
+  free(cells);
+}
+
+/********************** BSS TABLE SUBROUTINES **********************/
+/*
+ * Long lived table of the BSS seen by successive scans, for the daemons
+ * (roaming, location...) that need to know what changed between scans
+ * and a signal level smoothed over time.
+ * The records are in an array, indexed by BSSID and by ESSID with hash
+ * tables using linear probing. Removing an entry shifts back the ones
+ * that follow, so there are no tombstones, and lookups stay short even
+ * after many BSS came and went.
+ * The records may move when the table grows, so pointers to them are
+ * only valid until the next merge.
+ */
+
+/* Default weight of a new level in the average, in 1/256 */
+#define IW_BSS_SMOOTHING	64
+
+/* ESSIDs of a BSS table, with the list of BSS of each */
+struct iw_bss_essids
+{
+  iw_essid_pool		pool;
+  int *			head;		/* First BSS of each ID */
+  int			size;		/* IDs allocated */
+};
+
+/*------------------------------------------------------------------*/
+/*
+ * Find the slot of a BSSID in a BSS table.
+ * Return the slot, or -1.
+ */
+static int
+iw_bss_slot(const iw_bss_table *	table,
+	    const unsigned char *	bssid)
+{
+  __u32		hash = iw_bssid_hash(bssid);
+  unsigned int	s;
+
+  if(table->slots == NULL)
+    return(-1);
+  for(s = hash & table->mask; table->slots[s]; s = (s + 1) & table->mask)
+    if((table->slot_keys[s] == hash)
+       && !memcmp(table->bss[table->slots[s] - 1].bssid, bssid, ETH_ALEN))
+      return(s);
+  return(-1);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Get the ID of an ESSID in a BSS table, add it if needed. The caller
+ * owns a reference on the ID.
+ * Return -1 for error (in errno), the ID for success.
+ */
+static int
+iw_bss_essid_get(iw_bss_table *	table,
+		 const char *	name)
+{
+  struct iw_bss_essids *	essids = table->essids;
+  int *				head;
+  int				id;
+
+  if(essids == NULL)
+    {
+      essids = table->essids = calloc(1, sizeof(struct iw_bss_essids));
+      if(essids == NULL)
+	{
+	  errno = ENOMEM;
+	  return(-1);
+	}
+    }
+  id = iw_essid_pool_get(&essids->pool, name);
+  if(id < 0)
+    return(-1);
+
+  /* New ID, grow the lists with it */
+  if(id >= essids->size)
+    {
+      int	size = essids->pool.size;
+      head = realloc(essids->head, size * sizeof(int));
+      if(head == NULL)
+	{
+	  iw_essid_pool_put(&essids->pool, id);
+	  errno = ENOMEM;
+	  return(-1);
+	}
+      for(; essids->size < size; essids->size++)
+	head[essids->size] = -1;
+      essids->head = head;
+    }
+  return(id);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add a BSS to the list of BSS of an ESSID. The BSS takes the reference
+ * of the caller on the ID.
+ */
+static void
+iw_bss_essid_link(iw_bss_table *	table,
+		  int			record,
+		  int			id)
+{
+  int *		head = &table->essids->head[id];
+  iw_bss *		bss = &table->bss[record];
+
+  bss->essid = id;
+  bss->essid_prev = -1;
+  bss->essid_next = *head;
+  if(*head >= 0)
+    table->bss[*head].essid_prev = record;
+  *head = record;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Remove a BSS from the list of BSS of its ESSID, and forget the ESSID
+ * if that was the last one.
+ */
+static void
+iw_bss_essid_unlink(iw_bss_table *	table,
+		    int			record)
+{
+  struct iw_bss_essids *	essids = table->essids;
+  iw_bss *			bss = &table->bss[record];
+
+  if(bss->essid < 0)
+    return;
+  if(bss->essid_prev >= 0)
+    table->bss[bss->essid_prev].essid_next = bss->essid_next;
+  else
+    essids->head[bss->essid] = bss->essid_next;
+  if(bss->essid_next >= 0)
+    table->bss[bss->essid_next].essid_prev = bss->essid_prev;
+
+  iw_essid_pool_put(&essids->pool, bss->essid);
+  bss->essid = -1;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Get a free record in a BSS table.
+ * Return -1 for error (in errno), the record for success.
+ */
+static int
+iw_bss_alloc(iw_bss_table *	table)
+{
+  iw_bss *	bss;
+  int		record;
+
+  if(table->free_bss == 0)
+    {
+      int	size = table->size ? 2 * table->size : 16;
+      bss = realloc(table->bss, size * sizeof(iw_bss));
+      if(bss == NULL)
+	{
+	  errno = ENOMEM;
+	  return(-1);
+	}
+      table->bss = bss;
+      for(record = size - 1; record >= table->size; record--)
+	{
+	  bss[record].seen = 0;
+	  bss[record].essid_next = table->free_bss;
+	  table->free_bss = record + 1;
+	}
+      table->size = size;
+    }
+  record = table->free_bss - 1;
+  table->free_bss = table->bss[record].essid_next;
+  return(record);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Set up a new, empty, BSS table. The previous content of the table is
+ * ignored, use iw_bss_table_free() to empty a table in use.
+ * BSS not seen for max_age seconds are removed, 0 to keep them forever.
+ * smoothing is the weight of a new level in the average, in 1/256,
+ * 0 for the default (64, 1/4).
+ */
+void
+iw_bss_table_init(iw_bss_table *	table,
+		  unsigned int		max_age,
+		  int			smoothing)
+{
+  memset(table, 0, sizeof(iw_bss_table));
+  table->max_age = (__u64) max_age * 1000000;
+  table->smoothing = smoothing;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Merge the results of a scan in a BSS table, and remove the BSS that
+ * are too old. now is the time of the scan in us, 0 for now.
+ * Return -1 for error (in errno), the number of BSS for success.
+ */
+int
+iw_bss_table_merge(iw_bss_table *		table,
+		   const iw_scan_table *	scan,
+		   __u64			now)
+{
+  const unsigned char *	bssid;
+  iw_bss *		bss;
+  int			weight;
+  int			record;
+  int			essid;
+  int			s;
+  int			i;
+
+  if(now == 0)
+    now = iw_time_us();
+  weight = ((table->smoothing > 0) && (table->smoothing <= 256)) ?
+	   table->smoothing : IW_BSS_SMOOTHING;
+
+  /* Worst case, all the cells are new */
+  if(iw_slots_reserve(&table->slots, &table->slot_keys, &table->mask,
+		      table->num_bss + scan->num_cells) < 0)
+    return(-1);
+
+  for(i = 0; i < scan->num_cells; i++)
+    {
+      bssid = scan->bssid + ETH_ALEN * i;
+      s = iw_bss_slot(table, bssid);
+      if(s >= 0)
+	record = table->slots[s] - 1;
+      else
+	{
+	  record = iw_bss_alloc(table);
+	  if(record < 0)
+	    return(-1);
+	  bss = &table->bss[record];
+	  memset(bss, 0, sizeof(iw_bss));
+	  memcpy(bss->bssid, bssid, ETH_ALEN);
+	  bss->first_seen = now;
+	  bss->essid = -1;
+	  iw_slots_insert(table->slots, table->slot_keys, table->mask,
+			  iw_bssid_hash(bssid), record);
+	  table->num_bss++;
+	}
+      bss = &table->bss[record];
+
+      /* Exponentially weighted moving average of the level */
+      if(scan->flags[i] & IW_SNAPSHOT_LEVEL)
+	{
+	  if(!(bss->flags & IW_SNAPSHOT_LEVEL))
+	    bss->level_avg = scan->level[i] * 256;
+	  else
+	    bss->level_avg += (weight * (scan->level[i] * 256
+					 - bss->level_avg)) / 256;
+	  bss->level = scan->level[i];
+	}
+      bss->flags = scan->flags[i]
+		   | (bss->flags & (IW_SNAPSHOT_LEVEL | IW_SNAPSHOT_DBM));
+      bss->freq = scan->freq[i];
+      bss->channel = scan->channel[i];
+      bss->qual = scan->qual[i];
+      bss->seen++;
+      bss->last_seen = now;
+
+      /* The ESSID may change (hidden, reconfigured...) */
+      essid = iw_bss_essid_get(table, scan->pool + scan->essid[i]);
+      if(essid < 0)
+	return(-1);
+      if(essid != bss->essid)
+	{
+	  iw_bss_essid_unlink(table, record);
+	  iw_bss_essid_link(table, record, essid);
+	}
+      else
+	iw_essid_pool_put(&table->essids->pool, essid);
+    }
+
+  iw_bss_table_expire(table, now);
+  return(table->num_bss);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Remove the BSS that were not seen for more than the max age of the
+ * table. now is the current time in us.
+ * Return the number of BSS removed.
+ */
+int
+iw_bss_table_expire(iw_bss_table *	table,
+		    __u64		now)
+{
+  iw_bss *	bss;
+  int		removed = 0;
+  int		record;
+
+  if(table->max_age == 0)
+    return(0);
+
+  for(record = 0; record < table->size; record++)
+    {
+      bss = &table->bss[record];
+      if((bss->seen == 0) || (now <= bss->last_seen)
+	 || ((now - bss->last_seen) <= table->max_age))
+	continue;
+      iw_slots_remove(table->slots, table->slot_keys, table->mask,
+		      iw_bss_slot(table, bss->bssid));
+      iw_bss_essid_unlink(table, record);
+      bss->seen = 0;
+      bss->essid_next = table->free_bss;
+      table->free_bss = record + 1;
+      table->num_bss--;
+      removed++;
+    }
+  return(removed);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Free the memory of a BSS table, and empty it.
+ */
+void
+iw_bss_table_free(iw_bss_table *	table)
+{
+  if(table->essids != NULL)
+    {
+      iw_essid_pool_free(&table->essids->pool);
+      free(table->essids->head);
+      free(table->essids);
+    }
+  free(table->bss);
+  free(table->slots);
+  free(table->slot_keys);
+  memset(table, 0, sizeof(iw_bss_table));
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Find a BSS by BSSID (ETH_ALEN bytes).
+ * Return NULL if it's not in the table.
+ */
+iw_bss *
+iw_bss_find(const iw_bss_table *	table,
+	    const unsigned char *	bssid)
+{
+  int	s = iw_bss_slot(table, bssid);
+
+  if(s < 0)
+    return(NULL);
+  return(&table->bss[table->slots[s] - 1]);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Find the first BSS of an ESSID, the others are found with
+ * iw_bss_next_essid().
+ * Return NULL if no BSS has this ESSID.
+ */
+iw_bss *
+iw_bss_find_essid(const iw_bss_table *	table,
+		  const char *		essid)
+{
+  int	id;
+
+  if(table->essids == NULL)
+    return(NULL);
+  id = iw_essid_pool_find(&table->essids->pool, essid);
+  if(id < 0)
+    return(NULL);
+  return(&table->bss[table->essids->head[id]]);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Next BSS with the same ESSID.
+ * Return NULL at the end.
+ */
+iw_bss *
+iw_bss_next_essid(const iw_bss_table *	table,
+		  const iw_bss *	bss)
+{
+  if(bss->essid_next < 0)
+    return(NULL);
+  return(&table->bss[bss->essid_next]);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * ESSID of a BSS.
+ */
+const char *
+iw_bss_essid(const iw_bss_table *	table,
+	     const iw_bss *		bss)
+{
+  if(bss->essid < 0)
+    return("");
+  return(iw_essid_pool_name(&table->essids->pool, bss->essid));
+}
+
+/******************** SCAN SCHEDULER SUBROUTINES ********************/
+/*
+ * Background scanning costs airtime and power, and disrupt the traffic
+ * of the associated link while the card is off channel. When the link
+ * is good and the scans find the same cells, there is little point in
+ * scanning often. When the link degrades, the next roaming decision
+ * needs fresh scan results.
+ * The scheduler keeps an interval, halved when scans see many changes,
+ * doubled when they see none. The link quality (from iw_get_stats())
+ * shortens it when the link is weak, falling or lost.
+ */
+
+/* Default intervals, in ms */
+#define IW_SCHED_MIN_INTERVAL	2000
+#define IW_SCHED_MAX_INTERVAL	300000
+#define IW_SCHED_INTERVAL	30000
+/* Default weak link, in dBm */
+#define IW_SCHED_WEAK_LEVEL	-75
+/* Change of level of a cell that counts, in dB */
+#define IW_SCHED_LEVEL_CHANGE	6
+/* Fraction of the cells that changed, in 1/256 */
+#define IW_SCHED_CHANGE_HIGH	64	/* Scan twice as often */
+#define IW_SCHED_CHANGE_LOW	16	/* Scan twice less often */
+/* Falling link, in 1/256 dB per sample */
+#define IW_SCHED_TREND_FALLING	(-2 * 256)
+
+/*------------------------------------------------------------------*/
+/*
+ * Clamp the interval of the scheduler to its limits.
+ */
+static void
+iw_scan_sched_clamp(iw_scan_sched *	sched)
+{
+  if(sched->interval > sched->max_interval)
+    sched->interval = sched->max_interval;
+  if(sched->interval < sched->min_interval)
+    sched->interval = sched->min_interval;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Initialise a scheduler. Intervals are in ms, 0 for the defaults.
+ * weak_level may be changed after this.
+ */
+void
+iw_scan_sched_init(iw_scan_sched *	sched,
+		   int			min_interval,
+		   int			max_interval)
+{
+  memset(sched, 0, sizeof(iw_scan_sched));
+  sched->min_interval = (min_interval > 0) ?
+			min_interval : IW_SCHED_MIN_INTERVAL;
+  sched->max_interval = (max_interval > 0) ?
+			max_interval : IW_SCHED_MAX_INTERVAL;
+  if(sched->max_interval < sched->min_interval)
+    sched->max_interval = sched->min_interval;
+  sched->weak_level = IW_SCHED_WEAK_LEVEL;
+  sched->interval = IW_SCHED_INTERVAL;
+  iw_scan_sched_clamp(sched);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Give the scheduler a sample of the link quality (usually from
+ * iw_get_stats()). max_qual is the one of the range, NULL if unknown.
+ * An invalid level means the link is lost.
+ */
+void
+iw_scan_sched_link(iw_scan_sched *		sched,
+		   const struct iw_quality *	qual,
+		   const struct iw_quality *	max_qual)
+{
+  int		level;
+  int		dbm;
+  int		delta;
+
+  dbm = iw_qual_level(qual, max_qual, &level);
+  if(dbm < 0)
+    {
+      if(sched->link > 0)
+	sched->link = -1;
+      return;
+    }
+
+  /* First sample, or the driver changed its mind : restart averages */
+  if((sched->link <= 0) || (sched->dbm != dbm))
+    {
+      sched->level = level * 256;
+      sched->trend = 0;
+    }
+  else
+    {
+      delta = level * 256 - sched->level;
+      sched->trend += (delta - sched->trend) / 4;
+      sched->level += delta / 4;
+    }
+  sched->link = 1;
+  sched->dbm = dbm;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Tell the scheduler that a scan was done. cur is the result of the
+ * scan, old the one of the previous scan (NULL if none). now is in us,
+ * 0 for the current time.
+ * Return -1 for error (in errno), 0 for success.
+ */
+int
+iw_scan_sched_scanned(iw_scan_sched *		sched,
+		      const iw_scan_table *	old,
+		      const iw_scan_table *	cur,
+		      __u64			now)
+{
+  int *		match;
+  int		total;
+  int		changed;
+  int		change;
+  int		found;
+  int		i;
+  int		j;
+
+  if(now == 0)
+    now = iw_time_us();
+
+  /* First scan, nothing to compare with */
+  if((old == NULL) || (old->num_cells + cur->num_cells == 0))
+    {
+      sched->last_scan = now;
+      return(0);
+    }
+
+  match = malloc((cur->num_cells + 1) * sizeof(int));
+  if(match == NULL)
+    {
+      errno = ENOMEM;
+      return(-1);
+    }
+  found = iw_scan_table_match(old, cur, match);
+  if(found < 0)
+    {
+      free(match);
+      return(-1);
+    }
+
+  /* New and lost cells, then the cells that moved */
+  total = old->num_cells + cur->num_cells - found;
+  changed = total - found;
+  for(i = 0; i < cur->num_cells; i++)
+    {
+      j = match[i];
+      if(j < 0)
+	continue;
+      if((cur->flags[i] ^ old->flags[j]) & (IW_SNAPSHOT_LEVEL |
+					     IW_SNAPSHOT_CHANNEL))
+	changed++;
+      else if((cur->flags[i] & IW_SNAPSHOT_CHANNEL)
+	      && (cur->channel[i] != old->channel[j]))
+	changed++;
+      else if((cur->flags[i] & IW_SNAPSHOT_LEVEL)
+	      && (abs(cur->level[i] - old->level[j])
+		  >= IW_SCHED_LEVEL_CHANGE))
+	changed++;
+    }
+  free(match);
+
+  change = (changed * 256) / total;
+  if(change >= IW_SCHED_CHANGE_HIGH)
+    sched->interval /= 2;
+  else if(change <= IW_SCHED_CHANGE_LOW)
+    sched->interval *= 2;
+  iw_scan_sched_clamp(sched);
+  sched->last_scan = now;
+  return(0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Time until the next scan is due, in ms, 0 if it is due now. now is
+ * in us, 0 for the current time.
+ */
+int
+iw_scan_sched_next(const iw_scan_sched *	sched,
+		   __u64			now)
+{
+  int		interval = sched->interval;
+  __u64		due;
+
+  if(sched->last_scan == 0)
+    return(0);
+
+  /* Link lost or falling : we will need to roam soon */
+  if((sched->link < 0)
+     || ((sched->link > 0) && (sched->trend <= IW_SCHED_TREND_FALLING)))
+    interval = sched->min_interval;
+  /* Weak link : be ready */
+  else if((sched->link > 0) && sched->dbm
+	  && (sched->level < sched->weak_level * 256))
+    {
+      interval /= 4;
+      if(interval < sched->min_interval)
+	interval = sched->min_interval;
+    }
+
+  if(now == 0)
+    now = iw_time_us();
+  due = sched->last_scan + (__u64) interval * 1000;
+  if(now >= due)
+    return(0);
+  return((int) ((due - now) / 1000));
+}
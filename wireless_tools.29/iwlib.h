@@ -106,7 +106,7 @@ extern "C" {
 /* Maximum forward compatibility built in this version of WT */
 #define WE_MAX_VERSION	22
 /* Version of Wireless Tools */
-#define WT_VERSION	29
+#define WT_VERSION	30
 
 /* Paths */
 #define PROC_NET_WIRELESS	"/proc/net/wireless"
@@ -154,6 +154,79 @@ struct	iw_pk_point
 
 #endif	/* IW_EV_LCP_PK_LEN */
 
+/* Information elements, see iw_parse_ies() */
+#define IW_IE_MAX_SUITES	4	/* Cipher/AKM suites kept per IE */
+#define IW_IE_MAX_RATES		16	/* Supported + extended rates */
+#define IW_IE_MAX_VENDORS	6	/* Vendor specific IEs */
+
+/* Which IEs were found in the chain */
+#define IW_IE_HAS_RSN		0x0001
+#define IW_IE_HAS_WPA		0x0002
+#define IW_IE_HAS_HT		0x0004
+#define IW_IE_HAS_VHT		0x0008
+#define IW_IE_HAS_COUNTRY	0x0010
+#define IW_IE_HAS_BSS_LOAD	0x0020
+#define IW_IE_HAS_RATES		0x0040
+#define IW_IE_HAS_VENDOR	0x0080
+#define IW_IE_MALFORMED		0x8000	/* The chain was truncated */
+
+/* Which fields of RSN/WPA were in the IE, the others have the
+ * default value of the standard */
+#define IW_IE_RSN_GROUP		0x01
+#define IW_IE_RSN_PAIRWISE	0x02
+#define IW_IE_RSN_AKM		0x04
+#define IW_IE_RSN_CAPA		0x08
+#define IW_IE_RSN_SUITES_CUT	0x10	/* A list had more than
+					 * IW_IE_MAX_SUITES suites */
+
+#ifndef IW_IE_CIPHER_NONE
+/* Cypher values in GENIE (pairwise and group) */
+#define IW_IE_CIPHER_NONE	0
+#define IW_IE_CIPHER_WEP40	1
+#define IW_IE_CIPHER_TKIP	2
+#define IW_IE_CIPHER_WRAP	3
+#define IW_IE_CIPHER_CCMP	4
+#define IW_IE_CIPHER_WEP104	5
+/* Key management in GENIE */
+#define IW_IE_KEY_MGMT_NONE	0
+#define IW_IE_KEY_MGMT_802_1X	1
+#define IW_IE_KEY_MGMT_PSK	2
+#endif	/* IW_IE_CIPHER_NONE */
+/* Suite with an OUI other than the one of WPA/RSN */
+#define IW_IE_SUITE_PROPRIETARY	0xFF
+
+/* Snapshot of scan results, see iw_snapshot_write() */
+#define IW_SNAPSHOT_MAGIC	0x53535749	/* "IWSS", also byte order */
+#define IW_SNAPSHOT_VERSION	1
+/* Header flags */
+#define IW_SNAPSHOT_HAS_RANGE	0x0001	/* max_qual is valid */
+/* Cell flags */
+#define IW_SNAPSHOT_ESSID	0x0001	/* ESSID is valid */
+#define IW_SNAPSHOT_ESSID_ON	0x0002	/* ESSID not hidden */
+#define IW_SNAPSHOT_FREQ	0x0004	/* Frequency is valid */
+#define IW_SNAPSHOT_CHANNEL	0x0008	/* Channel is valid */
+#define IW_SNAPSHOT_MODE	0x0010	/* Mode is valid */
+#define IW_SNAPSHOT_QUAL	0x0020	/* Quality is valid */
+#define IW_SNAPSHOT_KEY		0x0040	/* Encryption is valid */
+#define IW_SNAPSHOT_ENCRYPTED	0x0080	/* Encryption is on */
+#define IW_SNAPSHOT_BITRATE	0x0100	/* Max bitrate is valid */
+#define IW_SNAPSHOT_LEVEL	0x0200	/* Level can be decoded */
+#define IW_SNAPSHOT_DBM		0x0400	/* Level is in dBm */
+
+/* Scan tables, see iw_scan_table_sort(). Keys are sorted in ascending
+ * order, unless IW_SCAN_KEY_DESC is added */
+#define IW_SCAN_KEY_LEVEL	1
+#define IW_SCAN_KEY_QUAL	2
+#define IW_SCAN_KEY_FREQ	3
+#define IW_SCAN_KEY_CHANNEL	4
+#define IW_SCAN_KEY_DESC	0x100
+/* Criteria of iw_scan_table_filter() */
+#define IW_SCAN_FILTER_LEVEL	0x0001	/* level >= min_level */
+#define IW_SCAN_FILTER_FREQ	0x0002	/* min_freq <= freq <= max_freq */
+#define IW_SCAN_FILTER_CHANNEL	0x0004	/* channel == channel */
+#define IW_SCAN_FILTER_FLAGS	0x0008	/* (flags & mask) == value */
+#define IW_SCAN_FILTER_ESSID	0x0010	/* ESSID == essid */
+
 /****************************** TYPES ******************************/
 
 /* Shortcuts */
@@ -228,10 +301,38 @@ typedef struct wireless_info
   int		has_auth_cipher_group;
 } wireless_info;
 
+/* Slice of the raw scan results (payload of an event).
+ * Warning : the data is not aligned and not '\0' terminated. */
+typedef struct iw_scan_slice
+{
+  char *	data;		/* Start of payload, in the scan buffer */
+  int		len;		/* Length of payload */
+} iw_scan_slice;
+
+/* ESSIDs of a pool (private to iwlib.c) */
+struct iw_essid_entry;
+
+/* Pool of interned ESSIDs. Each distinct ESSID is stored once, and has
+ * an ID that stays the same until its last reference is released, so
+ * ESSIDs can be stored and compared as ints (see iw_essid_pool_get()).
+ * Must be zeroed before first use. */
+typedef struct iw_essid_pool
+{
+  int		num_essids;		/* Distinct ESSIDs */
+  /* Private */
+  struct iw_essid_entry *	essid;
+  int		size;			/* IDs allocated */
+  int		free_essid;		/* List of free IDs + 1 */
+  int *		slots;			/* ESSID -> ID + 1 */
+  __u32 *	slot_keys;		/* Hash of the ESSID of the slot */
+  unsigned int	mask;
+} iw_essid_pool;
+
 /* Structure for storing an entry of a wireless scan.
- * This is only a subset of all possible information, the flexible
- * structure of scan results make it impossible to capture all
- * information in such a static structure. */
+ * The fixed part hold the common information. Variable sized elements
+ * (bit rates, IEs, custom) are kept in arrays allocated with the entry,
+ * the IEs and custom elements point directly in the raw scan results.
+ * All of it belong to the scan context (see below). */
 typedef struct wireless_scan
 {
   /* Linked list */
@@ -247,17 +348,76 @@ typedef struct wireless_scan
   int		has_stats;
   iwparam	maxbitrate;		/* Max bit rate in bps */
   int		has_maxbitrate;
+
+  /* Full information */
+  __s32 *	bitrates;		/* All bit rates, in bps */
+  int		num_bitrates;
+  iwparam	modul;			/* Modulations (IW_MODUL_*) */
+  int		has_modul;
+  iw_scan_slice *	genie;		/* Generic IEs (IWEVGENIE) */
+  int		num_genie;
+  iw_scan_slice *	custom;		/* Driver specific (IWEVCUSTOM) */
+  int		num_custom;
+  int		essid_id;		/* In the pool of the context, or -1 */
 } wireless_scan;
 
+/* Memory holding the results of a scan (private to iwlib.c) */
+struct iw_scan_arena;
+/* State of an asynchronous scan (private to iwlib.c) */
+struct iw_scan_async;
+
 /*
  * Context used for non-blocking scan.
+ * Must be set with iw_scan_init() (or zeroed) before first use, and
+ * given back with iw_scan_release(). The context own all the memory of
+ * the results, which is reused by the next scan using the same context.
+ * If essids is set, the results hold references on the IDs of their
+ * ESSIDs, so the pool must be kept until the context is released.
  */
 typedef struct wireless_scan_head
 {
   wireless_scan *	result;		/* Result of the scan */
   int			retry;		/* Retry level */
+  struct iw_scan_arena *	arena;	/* Storage for result */
+  unsigned char *	buffer;		/* Raw results, referenced by result */
+  int			buflen;		/* Size of buffer */
+  int			datalen;	/* Length of raw results */
+  int			buf_hit;	/* Results read at the first try */
+  int			buf_miss;	/* Reads with buffer too small (E2BIG) */
+  int			buf_hint;	/* Size to start with, 0 for default */
+  struct iw_scan_async *	async;	/* Asynchronous scan (fds) */
+  iw_essid_pool *	essids;		/* If set, ESSIDs are interned in it */
 } wireless_scan_head;
 
+/* Compact record of a scan cell, with only what scans report. ESSID and
+ * protocol name are IDs in a pool, the bit rates, IEs and custom data
+ * are not kept (see iw_compact_cell_pack()). */
+typedef struct iw_compact_cell
+{
+  double	freq;			/* Frequency/channel */
+  __s32		essid;			/* ID in the pool, or -1 */
+  __s32		name;			/* Protocol name, ID in the pool */
+  __s32		maxbitrate;		/* In bps */
+  __u32		modul;			/* Modulations (IW_MODUL_*) */
+  struct iw_quality	qual;		/* Signal strength */
+  unsigned char	bssid[ETH_ALEN];	/* Access point address */
+  __u16		nwid;			/* Network ID */
+  __u16		essid_flags;		/* On/off, index */
+  __u16		key_flags;		/* IW_ENCODE_XXX */
+  unsigned int	has_bssid:1;
+  unsigned int	has_nwid:1;
+  unsigned int	nwid_disabled:1;
+  unsigned int	has_freq:1;
+  unsigned int	has_key:1;
+  unsigned int	has_essid:1;
+  unsigned int	has_mode:1;
+  unsigned int	has_qual:1;
+  unsigned int	has_maxbitrate:1;
+  unsigned int	has_modul:1;
+  unsigned int	mode:4;			/* Operation mode */
+  unsigned int	freq_flags:8;		/* IW_FREQ_XXX */
+} iw_compact_cell;
+
 /* Structure used for parsing event streams, such as Wireless Events
  * and scan results */
 typedef struct stream_descr
@@ -267,6 +427,235 @@ typedef struct stream_descr
   char *	value;		/* Current value in event */
 } stream_descr;
 
+/* Event stream decoder, specialised for a version of WE and a kernel.
+ * Same semantic as iw_extract_event_stream() - see
+ * iw_get_event_decoder() */
+typedef int (*iw_event_decoder)(struct stream_descr *	stream,
+				struct iw_event *	iwe,
+				int			we_version);
+
+/* Lightweight view of one cell of the scan results.
+ * This point directly into the buffer returned by SIOCGIWSCAN, nothing
+ * is copied apart from the cell address, so the buffer must stay valid
+ * as long as the view is used. The events of the cell can be decoded
+ * with iw_init_event_stream() and the decoder of the iterator. */
+typedef struct iw_scan_cell
+{
+  char *	data;		/* First event of the cell (SIOCGIWAP) */
+  int		len;		/* Length of all events of the cell */
+  sockaddr	ap_addr;	/* Access point address */
+} iw_scan_cell;
+
+/* Iterator walking the cells of a buffer of scan results in place */
+typedef struct iw_scan_iter
+{
+  char *	current;	/* Start of next cell */
+  char *	end;		/* End of the scan buffer */
+  int		we_version;	/* WE version of the driver */
+  iw_event_decoder	decode;	/* Event decoder for that version */
+} iw_scan_iter;
+
+/* WPA or RSN (WPA2) IE */
+typedef struct iw_ie_rsn
+{
+  __u16		version;
+  __u16		capabilities;	/* RSN capabilities */
+  __u8		fields;		/* IW_IE_RSN_XXX found in the IE */
+  __u8		group;		/* Group cipher, IW_IE_CIPHER_XXX */
+  __u8		num_pairwise;	/* As advertised (max 255), may be
+				 * > IW_IE_MAX_SUITES, see SUITES_CUT */
+  __u8		num_akm;
+  __u8		pairwise[IW_IE_MAX_SUITES];	/* IW_IE_CIPHER_XXX */
+  __u8		akm[IW_IE_MAX_SUITES];		/* IW_IE_KEY_MGMT_XXX */
+} iw_ie_rsn;
+
+/* Information elements of a cell, decoded. Only the parts flagged in
+ * 'present' are valid. Nothing points in the IEs, so this can be kept
+ * after the scan results are gone. */
+typedef struct iw_ie_info
+{
+  __u16		present;		/* IW_IE_HAS_XXX */
+  iw_ie_rsn	rsn;
+  iw_ie_rsn	wpa;
+  /* HT Capabilities */
+  __u16		ht_capa;		/* HT Capabilities Info */
+  __u8		ht_ampdu;		/* A-MPDU Parameters */
+  __u8		ht_streams;		/* Rx spatial streams */
+  /* VHT Capabilities */
+  __u32		vht_capa;		/* VHT Capabilities Info */
+  __u16		vht_rx_mcs;		/* Rx MCS map */
+  __u16		vht_tx_mcs;		/* Tx MCS map */
+  __u8		vht_streams;		/* Rx spatial streams */
+  /* Country */
+  char		country[3];		/* Code + environment (I/O/ ) */
+  __s8		max_txpower;		/* Highest of all subbands, dBm */
+  /* BSS Load */
+  __u8		chan_util;		/* Channel utilisation, /255 */
+  __u16		sta_count;		/* Associated stations */
+  __u16		avail_capacity;		/* Admission capacity, 32us/s */
+  /* Supported and extended rates, 500 kb/s units, 0x80 = basic */
+  __u8		num_rates;
+  __u8		rates[IW_IE_MAX_RATES];
+  /* Vendor specific IEs : OUI << 8 | type */
+  __u8		num_vendors;
+  __u32		vendors[IW_IE_MAX_VENDORS];
+} iw_ie_info;
+
+/* Index of a chain of IEs by element ID, built in one pass (see
+ * iw_ie_index_build()). Only the IDs flagged in 'ids' have a valid
+ * offset, so that we don't need to clear the whole table. */
+typedef struct iw_ie_index
+{
+  const unsigned char *	buffer;		/* The IEs, not copied */
+  int			buflen;		/* Length of the valid IEs */
+  int			num_ies;
+  __u32			ids[8];		/* Bitmap of IDs present */
+  __u16			first[256];	/* Offset of first IE of each ID */
+} iw_ie_index;
+
+/* Snapshot of scan results, as written in the file.
+ * Everything is in host order, aligned, and fixed size, so that readers
+ * can use the file in place (see iw_snapshot_open()). The header is
+ * followed by the cells and then the pool of ESSIDs. Identical ESSIDs
+ * are stored only once in the pool, each one is NUL terminated. */
+typedef struct iw_snapshot_header
+{
+  __u32		magic;			/* IW_SNAPSHOT_MAGIC */
+  __u16		version;		/* IW_SNAPSHOT_VERSION */
+  __u16		header_len;		/* Offset of the cells */
+  __u16		cell_len;		/* sizeof(iw_snapshot_cell) */
+  __u16		we_version;		/* WE version of the driver */
+  __u32		num_cells;
+  __u32		pool_offset;		/* Offset of the ESSID pool */
+  __u32		pool_len;
+  __u32		flags;			/* IW_SNAPSHOT_HAS_XXX */
+  struct iw_quality	max_qual;	/* From the range */
+  __u64		timestamp;		/* When it was written, in us */
+  char		ifname[IFNAMSIZ];	/* Interface scanned */
+} iw_snapshot_header;
+
+typedef struct iw_snapshot_cell
+{
+  __u8		bssid[ETH_ALEN];
+  __u8		mode;			/* IW_MODE_XXX */
+  __u8		essid_len;
+  __u32		essid_offset;		/* Offset in the pool */
+  __u32		freq;			/* In kHz */
+  __u16		flags;			/* IW_SNAPSHOT_XXX */
+  __s16		channel;
+  struct iw_quality	qual;		/* Raw, see max_qual */
+  __u32		maxbitrate;		/* In b/s */
+  __u16		ies;			/* IW_IE_HAS_XXX */
+  __u16		reserved;
+} iw_snapshot_cell;
+
+/* Snapshot mapped in memory by iw_snapshot_open() */
+typedef struct iw_snapshot
+{
+  void *			map;
+  size_t			len;
+  const iw_snapshot_header *	header;
+  const iw_snapshot_cell *	cells;
+  int				num_cells;
+  const char *			pool;
+} iw_snapshot;
+
+/* Scan results in columns, one array per field, for sorting and
+ * filtering large scans (see iw_scan_table_build()). Cell i is at
+ * index i of every array. Must be zeroed before first use, the memory
+ * is reused by the next build. */
+typedef struct iw_scan_table
+{
+  int		num_cells;
+  unsigned char *	bssid;		/* ETH_ALEN bytes per cell */
+  __u32 *	freq;			/* In kHz */
+  __s16 *	channel;
+  __s16 *	level;			/* dBm if IW_SNAPSHOT_DBM */
+  __u8 *	qual;
+  __u16 *	flags;			/* IW_SNAPSHOT_XXX */
+  __u32 *	essid;			/* Offset in pool, equal offsets
+					 * are equal ESSIDs */
+  char *	pool;			/* ESSIDs, NUL terminated */
+  /* Private */
+  int		size;			/* Cells allocated */
+  int		pool_size;
+  int		pool_len;
+  __u32 *	hash;			/* ESSID -> offset in pool */
+  unsigned int	hash_mask;
+  void *	mem;			/* All the arrays */
+} iw_scan_table;
+
+/* Criteria for iw_scan_table_filter() */
+typedef struct iw_scan_filter
+{
+  int		what;			/* IW_SCAN_FILTER_XXX */
+  int		min_level;
+  __u32		min_freq;		/* In kHz */
+  __u32		max_freq;
+  int		channel;
+  __u16		flags_mask;
+  __u16		flags_value;
+  const char *	essid;
+} iw_scan_filter;
+
+/* One BSS (cell) of a BSS table, see iw_bss_table_merge() */
+typedef struct iw_bss
+{
+  unsigned char	bssid[ETH_ALEN];
+  __u16		flags;			/* IW_SNAPSHOT_XXX, last scan */
+  __u32		freq;			/* In kHz */
+  __s16		channel;
+  __s16		level;			/* Last level */
+  __s32		level_avg;		/* Smoothed level, in 1/256 */
+  __u8		qual;
+  __u32		seen;			/* Scans that had it, 0 = free */
+  __u64		first_seen;		/* In us */
+  __u64		last_seen;
+  int		essid;			/* ID of the ESSID */
+  /* Private */
+  int		essid_next;		/* BSS with the same ESSID */
+  int		essid_prev;
+} iw_bss;
+
+/* ESSIDs of a BSS table (private to iwlib.c) */
+struct iw_bss_essids;
+
+/* BSS seen by successive scans. Each scan is merged in the table, the
+ * BSS that have not been seen for a while are removed. Lookups by
+ * BSSID and by ESSID are hashed. Must be set with iw_bss_table_init()
+ * before first use, and released with iw_bss_table_free(). */
+typedef struct iw_bss_table
+{
+  iw_bss *	bss;			/* Records, some are free */
+  int		size;			/* Records allocated */
+  int		num_bss;		/* Records used */
+  __u64		max_age;		/* Expire after, in us */
+  int		smoothing;		/* Weight of new levels, in 1/256 */
+  /* Private */
+  int		free_bss;		/* List of free records + 1 */
+  int *		slots;			/* BSSID -> record + 1 */
+  __u32 *	slot_keys;		/* Hash of the BSSID of the slot */
+  unsigned int	mask;
+  struct iw_bss_essids *	essids;
+} iw_bss_table;
+
+/* When to scan an interface, from the trend of the link quality and
+ * the changes between scans (see iw_scan_sched_next()). Must be set
+ * with iw_scan_sched_init(). */
+typedef struct iw_scan_sched
+{
+  int		min_interval;		/* Link degrading, in ms */
+  int		max_interval;		/* All stable, in ms */
+  int		weak_level;		/* Weak link below, in dBm */
+  /* Private */
+  int		interval;		/* Current interval, in ms */
+  __u64		last_scan;		/* In us, 0 = never */
+  int		link;			/* 0 unknown, 1 up, -1 lost */
+  int		dbm;			/* Level is in dBm */
+  int		level;			/* Smoothed level, in 1/256 */
+  int		trend;			/* Smoothed variation, in 1/256 */
+} iw_scan_sched;
+
 /* Prototype for handling display of each single interface on the
  * system - see iw_enum_devices() */
 typedef int (*iw_enum_handler)(int	skfd,
@@ -274,6 +663,48 @@ typedef int (*iw_enum_handler)(int	skfd,
 			       char *	args[],
 			       int	count);
 
+/* Transport used to talk to the drivers. The default is the kernel,
+ * but the requests can be diverted, for example to a simulated driver
+ * (see iw_set_transport()) */
+typedef struct iw_transport
+{
+  const char *	name;		/* For IW_TRANSPORT */
+  /* Same as ioctl() for Wireless Extension requests */
+  int		(*ioctl)(int		skfd,
+			 int		request,
+			 struct iwreq *	pwrq);
+  /* List the devices, NULL to use the system list */
+  void		(*enum_devices)(int		skfd,
+				iw_enum_handler	fn,
+				char *		args[],
+				int		count);
+} iw_transport;
+
+/* Shape of the synthetic scan results of the simulated driver
+ * (see iw_sim_scan_generate()) */
+typedef struct iw_sim_scan_config
+{
+  int		num_cells;	/* Number of cells */
+  int		essid_len;	/* 0 : natural, -1 : mixed (0 to 32) */
+  int		num_bitrates;	/* Bitrates per cell (0 to IW_MAX_BITRATES) */
+  int		num_custom;	/* IWEVCUSTOM per cell */
+  int		custom_len;	/* Length of IWEVCUSTOM, 0 : natural */
+  int		ies;		/* IEs in IWEVGENIE, IW_SIM_IE_XXX */
+  int		compat;		/* 32-on-64 layout (WE-21) */
+} iw_sim_scan_config;
+
+/* Information elements of the synthetic cells. WPA/RSN are only
+ * added to the encrypted cells. */
+#define IW_SIM_IE_RSN		0x0001
+#define IW_SIM_IE_WPA		0x0002
+#define IW_SIM_IE_HT		0x0004
+#define IW_SIM_IE_VHT		0x0008
+#define IW_SIM_IE_COUNTRY	0x0010
+#define IW_SIM_IE_BSS_LOAD	0x0020
+#define IW_SIM_IE_RATES		0x0040
+#define IW_SIM_IE_VENDOR	0x0080
+#define IW_SIM_IE_ALL		0x00FF
+
 /* Describe a modulation */
 typedef struct iw_modul_descr
 {
@@ -295,6 +726,10 @@ void
 			iw_enum_handler fn,
 			char *		args[],
 			int		count);
+void
+	iw_set_transport(const iw_transport *	transport);
+const iw_transport *
+	iw_find_transport(const char *	name);
 /* --------------------- WIRELESS SUBROUTINES ----------------------*/
 int
 	iw_get_kernel_we_version(void);
@@ -465,6 +900,8 @@ int
 	iw_extract_event_stream(struct stream_descr *	stream,
 				struct iw_event *	iwe,
 				int			we_version);
+iw_event_decoder
+	iw_get_event_decoder(int	we_version);
 /* --------------------- SCANNING SUBROUTINES --------------------- */
 int
 	iw_process_scan(int			skfd,
@@ -476,6 +913,218 @@ int
 		char *			ifname,
 		int			we_version,
 		wireless_scan_head *	context);
+int
+	iw_scan_event_open(void);
+int
+	iw_scan_event_check(int	fd,
+			    int	ifindex);
+int
+	iw_scan_wait(int	fd,
+		     int	ifindex,
+		     int	delay);
+int
+	iw_scan_start(int			skfd,
+		      char *			ifname,
+		      int			we_version,
+		      wireless_scan_head *	context);
+int
+	iw_scan_listen(char *			ifname,
+		       int			we_version,
+		       wireless_scan_head *	context);
+int
+	iw_scan_get_fd(wireless_scan_head *	context);
+int
+	iw_scan_handle_ready(int			skfd,
+			     wireless_scan_head *	context);
+int
+	iw_scan_decode(wireless_scan_head *	context,
+		       char *			data,
+		       int			len,
+		       int			we_version);
+void
+	iw_scan_init(wireless_scan_head *	context);
+void
+	iw_scan_free(wireless_scan_head *	context);
+void
+	iw_scan_release(wireless_scan_head *	context);
+void
+	iw_scan_iter_init(iw_scan_iter *	iter,
+			  char *		data,
+			  int			len,
+			  int			we_version);
+int
+	iw_scan_iter_next_cell(iw_scan_iter *	iter,
+			       iw_scan_cell *	cell);
+/* ------------------ INFORMATION ELEMENTS ------------------------ */
+int
+	iw_parse_ies(const unsigned char *	buffer,
+		     int			buflen,
+		     iw_ie_info *		info);
+int
+	iw_scan_parse_ies(const struct wireless_scan *	wscan,
+			  iw_ie_info *			info);
+int
+	iw_ie_index_build(iw_ie_index *		index,
+			  const unsigned char *	buffer,
+			  int			buflen);
+const unsigned char *
+	iw_ie_find_next(const iw_ie_index *	index,
+			const unsigned char *	ie,
+			int			id);
+const unsigned char *
+	iw_ie_find_vendor(const iw_ie_index *	index,
+			  __u32			oui,
+			  int			type);
+/* ------------------- SCAN CAPTURE SUBROUTINES ------------------- */
+int
+	iw_scan_capture_write(const char *		filename,
+			      const char *		ifname,
+			      const struct iw_range *	range,
+			      int			we_version,
+			      const unsigned char *	data,
+			      int			len);
+int
+	iw_scan_capture_read(const char *	filename,
+			     char *		ifname,
+			     struct iw_range *	range,
+			     int *		has_range,
+			     int *		we_version,
+			     unsigned char **	data,
+			     int *		len);
+/* ------------------ SCAN SNAPSHOT SUBROUTINES ------------------- */
+int
+	iw_snapshot_write(const char *			filename,
+			  const char *			ifname,
+			  const struct wireless_scan *	list,
+			  const struct iw_range *	range,
+			  int				we_version);
+int
+	iw_snapshot_open(const char *	filename,
+			 iw_snapshot *	snap);
+void
+	iw_snapshot_close(iw_snapshot *	snap);
+/* -------------------- SCAN TABLE SUBROUTINES -------------------- */
+int
+	iw_qual_level(const struct iw_quality *	qual,
+		      const struct iw_quality *	max_qual,
+		      int *			plevel);
+int
+	iw_scan_table_build(iw_scan_table *			table,
+			    const struct wireless_scan *	list,
+			    const struct iw_range *		range);
+int
+	iw_scan_table_load(iw_scan_table *	table,
+			   const iw_snapshot *	snap);
+void
+	iw_scan_table_free(iw_scan_table *	table);
+int
+	iw_scan_table_filter(const iw_scan_table *	table,
+			     const iw_scan_filter *	filter,
+			     int *			order);
+int
+	iw_scan_table_sort(const iw_scan_table *	table,
+			   int				key,
+			   int *			order,
+			   int				num);
+int
+	iw_scan_table_top(const iw_scan_table *	table,
+			  int			key,
+			  int *			order,
+			  int			num,
+			  int			n);
+int
+	iw_scan_table_match(const iw_scan_table *	old,
+			    const iw_scan_table *	cur,
+			    int *			match);
+/* -------------------- ESSID POOL SUBROUTINES -------------------- */
+int
+	iw_essid_pool_get(iw_essid_pool *	pool,
+			  const char *		essid);
+int
+	iw_essid_pool_find(const iw_essid_pool *	pool,
+			   const char *			essid);
+void
+	iw_essid_pool_put(iw_essid_pool *	pool,
+			  int			id);
+const char *
+	iw_essid_pool_name(const iw_essid_pool *	pool,
+			   int				id);
+void
+	iw_essid_pool_free(iw_essid_pool *	pool);
+/* ------------------- COMPACT CELL SUBROUTINES ------------------- */
+int
+	iw_compact_cell_pack(iw_compact_cell *		cell,
+			     const wireless_scan *	wscan,
+			     iw_essid_pool *		pool);
+void
+	iw_compact_cell_unpack(wireless_scan *		wscan,
+			       const iw_compact_cell *	cell,
+			       const iw_essid_pool *	pool);
+void
+	iw_compact_cell_release(iw_compact_cell *	cell,
+				iw_essid_pool *		pool);
+int
+	iw_compact_cells_pack(iw_compact_cell **	pcells,
+			      const wireless_scan *	list,
+			      iw_essid_pool *		pool);
+void
+	iw_compact_cells_free(iw_compact_cell *	cells,
+			      int		num_cells,
+			      iw_essid_pool *	pool);
+/* -------------------- BSS TABLE SUBROUTINES --------------------- */
+void
+	iw_bss_table_init(iw_bss_table *	table,
+			  unsigned int		max_age,
+			  int			smoothing);
+int
+	iw_bss_table_merge(iw_bss_table *		table,
+			   const iw_scan_table *	scan,
+			   __u64			now);
+int
+	iw_bss_table_expire(iw_bss_table *	table,
+			    __u64		now);
+void
+	iw_bss_table_free(iw_bss_table *	table);
+iw_bss *
+	iw_bss_find(const iw_bss_table *	table,
+		    const unsigned char *	bssid);
+iw_bss *
+	iw_bss_find_essid(const iw_bss_table *	table,
+			  const char *		essid);
+iw_bss *
+	iw_bss_next_essid(const iw_bss_table *	table,
+			  const iw_bss *	bss);
+const char *
+	iw_bss_essid(const iw_bss_table *	table,
+		     const iw_bss *		bss);
+/* ------------------ SCAN SCHEDULER SUBROUTINES ------------------ */
+void
+	iw_scan_sched_init(iw_scan_sched *	sched,
+			   int			min_interval,
+			   int			max_interval);
+void
+	iw_scan_sched_link(iw_scan_sched *		sched,
+			   const struct iw_quality *	qual,
+			   const struct iw_quality *	max_qual);
+int
+	iw_scan_sched_scanned(iw_scan_sched *		sched,
+			      const iw_scan_table *	old,
+			      const iw_scan_table *	cur,
+			      __u64			now);
+int
+	iw_scan_sched_next(const iw_scan_sched *	sched,
+			   __u64			now);
+#ifndef WE_ESSENTIAL
+/* ---------------------- SIMULATED DRIVER ------------------------ */
+void
+	iw_sim_scan_config_init(iw_sim_scan_config *	config);
+int
+	iw_sim_scan_generate(const iw_sim_scan_config *	config,
+			     char *			buffer,
+			     int			buflen);
+void
+	iw_sim_set_scan_config(const iw_sim_scan_config *	config);
+#endif	/* WE_ESSENTIAL */
 
 /**************************** VARIABLES ****************************/
 
@@ -488,6 +1137,13 @@ extern const char * const	iw_operation_mode[];
 extern const struct iw_modul_descr	iw_modul_list[];
 #define IW_SIZE_MODUL_LIST	16
 
+/* Current transport, NULL for the kernel */
+extern const iw_transport *	iw_current_transport;
+#ifndef WE_ESSENTIAL
+/* Simulated driver (iwsim.c) */
+extern const iw_transport	iw_sim_transport;
+#endif	/* WE_ESSENTIAL */
+
 /************************* INLINE FUNTIONS *************************/
 /*
  * Functions that are so simple that it's more efficient inlining them
@@ -511,6 +1167,8 @@ iw_set_ext(int			skfd,		/* Socket to the kernel */
   /* Set device name */
   strncpy(pwrq->ifr_name, ifname, IFNAMSIZ);
   /* Do the request */
+  if(iw_current_transport != NULL)
+    return(iw_current_transport->ioctl(skfd, request, pwrq));
   return(ioctl(skfd, request, pwrq));
 }
 
@@ -527,6 +1185,8 @@ iw_get_ext(int			skfd,		/* Socket to the kernel */
   /* Set device name */
   strncpy(pwrq->ifr_name, ifname, IFNAMSIZ);
   /* Do the request */
+  if(iw_current_transport != NULL)
+    return(iw_current_transport->ioctl(skfd, request, pwrq));
   return(ioctl(skfd, request, pwrq));
 }
 
@@ -593,6 +1253,32 @@ iw_ether_cmp(const struct ether_addr* eth1, const struct ether_addr* eth2)
   return memcmp(eth1, eth2, sizeof(*eth1));
 }
 
+/*------------------------------------------------------------------*/
+/*
+ * Find the first IE with this ID in an index (see iw_ie_index_build()).
+ * Return a pointer on the IE (ID, length, body), or NULL.
+ */
+static inline const unsigned char *
+iw_ie_find(const iw_ie_index *	index,
+	   int			id)
+{
+  if(!(index->ids[(id >> 5) & 0x7] & (1U << (id & 0x1F))))
+    return(NULL);
+  return(index->buffer + index->first[id & 0xFF]);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * ESSID of a cell of a snapshot (see iw_snapshot_open()).
+ * The ESSID is NUL terminated, essid_len is its strlen().
+ */
+static inline const char *
+iw_snapshot_essid(const iw_snapshot *		snap,
+		  const iw_snapshot_cell *	cell)
+{
+  return(snap->pool + cell->essid_offset);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -13,9 +13,46 @@
 
 #include "iwlib.h"		/* Header */
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <stdarg.h>
 
 /****************************** TYPES ******************************/
 
+/*
+ * Fields of a cell kept for CSV output, a row is only complete at the
+ * end of the cell
+ */
+typedef struct iwscan_row
+{
+  unsigned char		address[ETH_ALEN];
+  char			essid[IW_ESSID_MAX_SIZE];
+  int			essid_len;
+  int			mode;
+  char			protocol[IFNAMSIZ + 1];
+  double		freq;		/* In Hz */
+  int			channel;
+  struct iw_param	nwid;
+  int			encryption;
+  struct iw_quality	qual;
+  int			max_bitrate;
+  int			security;	/* IW_IE_HAS_WPA/IW_IE_HAS_RSN */
+} iwscan_row;
+
+/*
+ * Quality of a cell, in real units
+ */
+typedef struct iwscan_qual
+{
+  int			flags;		/* IWSCAN_Q_* */
+  int			qual;
+  int			qual_max;
+  double		level;
+  int			level_max;
+  double		noise;
+  int			noise_max;
+} iwscan_qual;
+
 /*
  * Scan state and meta-information, used to decode events...
  */
@@ -24,8 +61,31 @@ typedef struct iwscan_state
   /* State */
   int			ap_num;		/* Access Point number 1->N */
   int			val_index;	/* Value in table 0->(N-1) */
+  /* Machine readable output */
+  const char *		ifname;
+  unsigned int		fields;		/* IWSCAN_F_* seen in this cell */
+  unsigned int		list;		/* IWSCAN_F_* of the open JSON list */
+  iwscan_row		row;		/* CSV only */
+  /* Delta output */
+  const unsigned char *	delta;		/* IWSCAN_DELTA_* of each cell */
+  int			num_delta;
 } iwscan_state;
 
+/*
+ * Scan of one device, when scanning all devices at once
+ */
+typedef struct iwscan_job
+{
+  struct iwscan_job *	next;
+  char			ifname[IFNAMSIZ + 1];
+  struct iw_range	range;
+  int			has_range;
+  wireless_scan_head	context;	/* Async scan and its results */
+  int			status;		/* 1 running, 0 done, -1 error,
+					 * 2 not supported, 3 trigger failed */
+  int			error;		/* errno if error */
+} iwscan_job;
+
 /*
  * Bit to name mapping
  */
@@ -50,8 +110,266 @@ typedef struct iw_auth_descr
 
 #define IW_SCAN_HACK		0x8000
 
+/* Output format of the scan results */
+#define IWSCAN_FORMAT_TEXT	0
+#define IWSCAN_FORMAT_JSON	1
+#define IWSCAN_FORMAT_CSV	2
+
+/* Fields of a cell, to print each one only once in JSON and CSV */
+#define IWSCAN_F_CELL		0x0001	/* A cell is open */
+#define IWSCAN_F_ESSID		0x0002
+#define IWSCAN_F_MODE		0x0004
+#define IWSCAN_F_PROTOCOL	0x0008
+#define IWSCAN_F_FREQ		0x0010
+#define IWSCAN_F_CHANNEL	0x0020
+#define IWSCAN_F_NWID		0x0040
+#define IWSCAN_F_ENCRYPTION	0x0080
+#define IWSCAN_F_QUAL		0x0100
+#define IWSCAN_F_BITRATES	0x0200
+#define IWSCAN_F_MODUL		0x0400
+#define IWSCAN_F_IES		0x0800
+#define IWSCAN_F_EXTRA		0x1000
+
+/* Quality of a cell, decoded like iw_print_stats() does */
+#define IWSCAN_Q_QUAL		0x01
+#define IWSCAN_Q_LEVEL		0x02
+#define IWSCAN_Q_NOISE		0x04
+#define IWSCAN_Q_DBM		0x08	/* Level & noise in dBm */
+#define IWSCAN_Q_MAX		0x10	/* We know the max (range) */
+
+/* Cell compared to the previous scan (--delta) */
+#define IWSCAN_DELTA_SAME	0
+#define IWSCAN_DELTA_NEW	1
+#define IWSCAN_DELTA_CHANGED	2
+#define IWSCAN_DELTA_LOST	3
+
 #define IW_EXTKEY_SIZE	(sizeof(struct iw_encode_ext) + IW_ENCODING_TOKEN_MAX)
 
+/**************************** VARIABLES ****************************/
+
+/* Devices to scan, when scanning all devices at once */
+static struct iwscan_job *	scan_jobs = NULL;
+/* Size of the scan results of the previous interface. Devices usually
+ * see the same cells, start with that rather than growing again */
+static int			scan_buflen = IW_SCAN_MAX_DATA;
+
+/* Format of the scan results (--format=) */
+static int			scan_format = IWSCAN_FORMAT_TEXT;
+/* Save the results in this snapshot instead of printing them */
+static const char *		scan_snapshot = NULL;
+/* Previous scans, print only what changed since (--delta) */
+static const char *		scan_delta = NULL;
+static int			scan_delta_level = 5;	/* dB */
+static int			scan_delta_channel = 1;
+
+/************************* OUTPUT BUFFER *************************/
+/*
+ * The scan results of an interface are formatted in memory and written
+ * with a single write(). Going through stdio for every field costs more
+ * than decoding the results, which hurts on big scans and small CPUs.
+ * The buffer grows as needed and is reused for the next interface. If
+ * we can't grow it, we flush it, so each call may not add more than
+ * IW_OUT_MAX_CHUNK bytes.
+ */
+
+#define IW_OUT_MAX_CHUNK	2048
+
+static char	out_static[4 * IW_OUT_MAX_CHUNK];
+static char *	out_buf = out_static;
+static int	out_size = sizeof(out_static);
+static int	out_len = 0;
+
+/*------------------------------------------------------------------*/
+/*
+ * Write the content of the output buffer to stdout.
+ */
+static void
+iw_out_flush(void)
+{
+  int	done = 0;
+  int	ret;
+
+  /* Whatever was printed with stdio goes first */
+  fflush(stdout);
+
+  while(done < out_len)
+    {
+      ret = write(STDOUT_FILENO, out_buf + done, out_len - done);
+      if(ret < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  /* Nobody is listening, drop it */
+	  break;
+	}
+      done += ret;
+    }
+  out_len = 0;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Make room for len more bytes in the output buffer.
+ * Return where to write them.
+ */
+static char *
+iw_out_reserve(int	len)
+{
+  int		newsize;
+  char *	newbuf;
+
+  if((out_len + len) > out_size)
+    {
+      newsize = 2 * out_size;
+      while(newsize < (out_len + len))
+	newsize *= 2;
+      if(out_buf == out_static)
+	{
+	  newbuf = malloc(newsize);
+	  if(newbuf != NULL)
+	    memcpy(newbuf, out_buf, out_len);
+	}
+      else
+	newbuf = realloc(out_buf, newsize);
+
+      if(newbuf != NULL)
+	{
+	  out_buf = newbuf;
+	  out_size = newsize;
+	}
+      else
+	/* Out of memory, send what we have to make room */
+	iw_out_flush();
+    }
+  return(out_buf + out_len);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add bytes to the output buffer.
+ */
+static void
+iw_out_mem(const char *	data,
+	   int		len)
+{
+  memcpy(iw_out_reserve(len), data, len);
+  out_len += len;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add a string to the output buffer.
+ */
+static void
+iw_out_str(const char *	str)
+{
+  iw_out_mem(str, strlen(str));
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add a string formatted in place by one of the iw_print_xxx()
+ * of the library (they take a buffer and its size).
+ */
+#define IW_OUT_PRINT(func, args...)				\
+  do {								\
+    char *	_p = iw_out_reserve(128);			\
+    func(_p, 128, args);					\
+    out_len += strlen(_p);					\
+  } while(0)
+
+/*------------------------------------------------------------------*/
+/*
+ * Add a formatted string to the output buffer.
+ */
+static void
+iw_out_printf(const char *	format,
+	      ...)
+{
+  va_list	ap;
+  char *	p = iw_out_reserve(IW_OUT_MAX_CHUNK);
+  int		len;
+
+  va_start(ap, format);
+  len = vsnprintf(p, IW_OUT_MAX_CHUNK, format, ap);
+  va_end(ap);
+  if(len >= IW_OUT_MAX_CHUNK)
+    len = IW_OUT_MAX_CHUNK - 1;
+  if(len > 0)
+    out_len += len;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add a positive integer, with at least min_digits digits (zero padded).
+ */
+static void
+iw_out_uint(unsigned int	value,
+	    int			min_digits)
+{
+  char		digits[12];
+  int		n = 0;
+
+  do
+    {
+      digits[n++] = '0' + (value % 10);
+      value /= 10;
+    }
+  while((value != 0) || (n < min_digits));
+
+  /* Digits are in reverse order */
+  {
+    char *	p = iw_out_reserve(n);
+    int		i;
+    for(i = 0; i < n; i++)
+      p[i] = digits[n - 1 - i];
+    out_len += n;
+  }
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add bytes in hexadecimal (upper case, no separator).
+ */
+static void
+iw_out_hex(const unsigned char *	data,
+	   int				len)
+{
+  static const char	hex[] = "0123456789ABCDEF";
+  char *		p = iw_out_reserve(2 * len);
+  int			i;
+
+  for(i = 0; i < len; i++)
+    {
+      p[2 * i] = hex[data[i] >> 4];
+      p[2 * i + 1] = hex[data[i] & 0xF];
+    }
+  out_len += 2 * len;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add a bitrate, same output as iw_print_bitrate().
+ * Almost all rates are a round number of 100 kb/s below 1 Gb/s, which
+ * %g would print with at most 4 digits, do those by hand.
+ */
+static void
+iw_out_bitrate(int	bitrate)
+{
+  if((bitrate >= MEGA) && (bitrate < GIGA) && ((bitrate % 100000) == 0))
+    {
+      iw_out_uint(bitrate / 1000000, 1);
+      if((bitrate / 100000) % 10)
+	{
+	  iw_out_mem(".", 1);
+	  iw_out_uint((bitrate / 100000) % 10, 1);
+	}
+      iw_out_mem(" Mb/s", 5);
+    }
+  else
+    IW_OUT_PRINT(iw_print_bitrate, bitrate);
+}
+
 /* ------------------------ WPA CAPA NAMES ------------------------ */
 /*
  * This is the user readable name of a bunch of WPA constants in wireless.h
@@ -128,20 +446,6 @@ static const char *	iw_encode_alg_name[] = {
 };
 #define	IW_ENCODE_ALG_NUM		IW_ARRAY_LEN(iw_encode_alg_name)
 
-#ifndef IW_IE_CIPHER_NONE
-/* Cypher values in GENIE (pairwise and group) */
-#define IW_IE_CIPHER_NONE	0
-#define IW_IE_CIPHER_WEP40	1
-#define IW_IE_CIPHER_TKIP	2
-#define IW_IE_CIPHER_WRAP	3
-#define IW_IE_CIPHER_CCMP	4
-#define IW_IE_CIPHER_WEP104	5
-/* Key management in GENIE */
-#define IW_IE_KEY_MGMT_NONE	0
-#define IW_IE_KEY_MGMT_802_1X	1
-#define IW_IE_KEY_MGMT_PSK	2
-#endif	/* IW_IE_CIPHER_NONE */
-
 /* Values for the IW_IE_CIPHER_* in GENIE */
 static const char *	iw_ie_cypher_name[] = {
 	"none",
@@ -220,88 +524,109 @@ iw_print_ie_unknown(unsigned char *	iebuf,
 		    int			buflen)
 {
   int	ielen = iebuf[1] + 2;
-  int	i;
 
   if(ielen > buflen)
     ielen = buflen;
 
-  printf("Unknown: ");
-  for(i = 0; i < ielen; i++)
-    printf("%02X", iebuf[i]);
-  printf("\n");
+  iw_out_str("Unknown: ");
+  iw_out_hex(iebuf, ielen);
+  iw_out_mem("\n", 1);
 }
 
 /*------------------------------------------------------------------*/
 /*
- * Parse, and display the results of a WPA or WPA2 IE.
- *
+ * Find the body of a WPA or WPA2 IE, and the OUI of its suites.
+ * Return the offset of the version, or -1 if it's not one of them.
  */
-static inline void 
-iw_print_ie_wpa(unsigned char *	iebuf,
-		int		buflen)
+static int
+iw_ie_wpa_offset(const unsigned char *	iebuf,
+		 int			ielen,
+		 const unsigned char **	poui)
 {
-  int			ielen = iebuf[1] + 2;
-  int			offset = 2;	/* Skip the IE id, and the length. */
-  unsigned char		wpa1_oui[3] = {0x00, 0x50, 0xf2};
-  unsigned char		wpa2_oui[3] = {0x00, 0x0f, 0xac};
-  unsigned char *	wpa_oui;
-  int			i;
-  uint16_t		ver = 0;
-  uint16_t		cnt = 0;
-
-  if(ielen > buflen)
-    ielen = buflen;
-
-#ifdef DEBUG
-  /* Debugging code. In theory useless, because it's debugged ;-) */
-  printf("IE raw value %d [%02X", buflen, iebuf[0]);
-  for(i = 1; i < buflen; i++)
-    printf(":%02X", iebuf[i]);
-  printf("]\n");
-#endif
+  static const unsigned char	wpa1_oui[3] = {0x00, 0x50, 0xf2};
+  static const unsigned char	wpa2_oui[3] = {0x00, 0x0f, 0xac};
 
   switch(iebuf[0])
     {
     case 0x30:		/* WPA2 */
       /* Check if we have enough data */
       if(ielen < 4)
-	{
-	  iw_print_ie_unknown(iebuf, buflen);
- 	  return;
-	}
-
-      wpa_oui = wpa2_oui;
-      break;
+	return(-1);
+      *poui = wpa2_oui;
+      return(2);
 
     case 0xdd:		/* WPA or else */
-      wpa_oui = wpa1_oui;
- 
-      /* Not all IEs that start with 0xdd are WPA. 
-       * So check that the OUI is valid. Note : offset==2 */
+      /* Not all IEs that start with 0xdd are WPA.
+       * So check that the OUI is valid. */
       if((ielen < 8)
-	 || (memcmp(&iebuf[offset], wpa_oui, 3) != 0)
-	 || (iebuf[offset + 3] != 0x01))
- 	{
-	  iw_print_ie_unknown(iebuf, buflen);
- 	  return;
- 	}
-
+	 || (memcmp(&iebuf[2], wpa1_oui, 3) != 0)
+	 || (iebuf[5] != 0x01))
+	return(-1);
       /* Skip the OUI type */
-      offset += 4;
-      break;
+      *poui = wpa1_oui;
+      return(6);
 
     default:
+      return(-1);
+    }
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Print the name of a cipher or authentication suite of the IE.
+ */
+static void
+iw_print_ie_suite(const unsigned char *	suite,
+		  const unsigned char *	oui,
+		  const char *		names[],
+		  const unsigned int	num_names)
+{
+  if(memcmp(suite, oui, 3) != 0)
+    iw_out_str(" Proprietary");
+  else if(suite[3] >= num_names)
+    iw_out_printf(" unknown (%d)", suite[3]);
+  else
+    {
+      iw_out_mem(" ", 1);
+      iw_out_str(names[suite[3]]);
+    }
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Parse, and display the results of a WPA or WPA2 IE.
+ * The IE is walked in place, so that all the suites are displayed
+ * (iw_parse_ies() only keeps the first IW_IE_MAX_SUITES).
+ */
+static void
+iw_print_ie_wpa(unsigned char *	iebuf,
+		int		buflen)
+{
+  int			ielen = iebuf[1] + 2;
+  int			offset;
+  const unsigned char *	wpa_oui;
+  int			i;
+  __u16			ver;
+  __u16			cnt;
+
+  if(ielen > buflen)
+    ielen = buflen;
+
+  offset = iw_ie_wpa_offset(iebuf, ielen, &wpa_oui);
+  if(offset < 0)
+    {
+      iw_print_ie_unknown(iebuf, buflen);
       return;
     }
-  
+
   /* Pick version number (little endian) */
   ver = iebuf[offset] | (iebuf[offset + 1] << 8);
   offset += 2;
 
   if(iebuf[0] == 0xdd)
-    printf("WPA Version %d\n", ver);
-  if(iebuf[0] == 0x30)
-    printf("IEEE 802.11i/WPA2 Version %d\n", ver);
+    iw_out_printf("WPA Version %d\n", ver);
+  else
+    iw_out_printf("IEEE 802.11i/WPA2 Version %d\n", ver);
 
   /* From here, everything is technically optional. */
 
@@ -309,56 +634,42 @@ iw_print_ie_wpa(unsigned char *	iebuf,
   if(ielen < (offset + 4))
     {
       /* We have a short IE.  So we should assume TKIP/TKIP. */
-      printf("                        Group Cipher : TKIP\n");
-      printf("                        Pairwise Cipher : TKIP\n");
+      iw_out_str("                        Group Cipher : TKIP\n");
+      iw_out_str("                        Pairwise Cipher : TKIP\n");
       return;
     }
- 
+
   /* Next we have our group cipher. */
-  if(memcmp(&iebuf[offset], wpa_oui, 3) != 0)
-    {
-      printf("                        Group Cipher : Proprietary\n");
-    }
-  else
-    {
-      printf("                        Group Cipher :");
-      iw_print_value_name(iebuf[offset+3],
-			  iw_ie_cypher_name, IW_IE_CYPHER_NUM);
-      printf("\n");
-    }
+  iw_out_str("                        Group Cipher :");
+  iw_print_ie_suite(iebuf + offset, wpa_oui,
+		    iw_ie_cypher_name, IW_IE_CYPHER_NUM);
+  iw_out_mem("\n", 1);
   offset += 4;
 
   /* Check if we are done */
   if(ielen < (offset + 2))
     {
       /* We don't have a pairwise cipher, or auth method. Assume TKIP. */
-      printf("                        Pairwise Ciphers : TKIP\n");
+      iw_out_str("                        Pairwise Ciphers : TKIP\n");
       return;
     }
 
   /* Otherwise, we have some number of pairwise ciphers. */
   cnt = iebuf[offset] | (iebuf[offset + 1] << 8);
   offset += 2;
-  printf("                        Pairwise Ciphers (%d) :", cnt);
+  iw_out_printf("                        Pairwise Ciphers (%d) :", cnt);
 
   if(ielen < (offset + 4*cnt))
     return;
 
   for(i = 0; i < cnt; i++)
     {
-      if(memcmp(&iebuf[offset], wpa_oui, 3) != 0)
- 	{
- 	  printf(" Proprietary");
- 	}
-      else
-	{
-	  iw_print_value_name(iebuf[offset+3],
-			      iw_ie_cypher_name, IW_IE_CYPHER_NUM);
- 	}
-      offset+=4;
+      iw_print_ie_suite(iebuf + offset, wpa_oui,
+			iw_ie_cypher_name, IW_IE_CYPHER_NUM);
+      offset += 4;
     }
-  printf("\n");
- 
+  iw_out_mem("\n", 1);
+
   /* Check if we are done */
   if(ielen < (offset + 2))
     return;
@@ -366,26 +677,19 @@ iw_print_ie_wpa(unsigned char *	iebuf,
   /* Now, we have authentication suites. */
   cnt = iebuf[offset] | (iebuf[offset + 1] << 8);
   offset += 2;
-  printf("                        Authentication Suites (%d) :", cnt);
+  iw_out_printf("                        Authentication Suites (%d) :", cnt);
 
   if(ielen < (offset + 4*cnt))
     return;
 
   for(i = 0; i < cnt; i++)
     {
-      if(memcmp(&iebuf[offset], wpa_oui, 3) != 0)
- 	{
- 	  printf(" Proprietary");
- 	}
-      else
-	{
-	  iw_print_value_name(iebuf[offset+3],
-			      iw_ie_key_mgmt_name, IW_IE_KEY_MGMT_NUM);
- 	}
-       offset+=4;
-     }
-  printf("\n");
- 
+      iw_print_ie_suite(iebuf + offset, wpa_oui,
+			iw_ie_key_mgmt_name, IW_IE_KEY_MGMT_NUM);
+      offset += 4;
+    }
+  iw_out_mem("\n", 1);
+
   /* Check if we are done */
   if(ielen < (offset + 1))
     return;
@@ -396,7 +700,7 @@ iw_print_ie_wpa(unsigned char *	iebuf,
    * allowed.) 8-) */
   if(iebuf[offset] & 0x01)
     {
-      printf("                       Preauthentication Supported\n");
+      iw_out_str("                       Preauthentication Supported\n");
     }
 }
  
@@ -415,18 +719,19 @@ iw_print_gen_ie(unsigned char *	buffer,
   /* Loop on each IE, each IE is minimum 2 bytes */
   while(offset <= (buflen - 2))
     {
-      printf("                    IE: ");
+      iw_out_str("                    IE: ");
 
       /* Check IE type */
       switch(buffer[offset])
 	{
 	case 0xdd:	/* WPA1 (and other) */
 	case 0x30:	/* WPA2 */
-	  iw_print_ie_wpa(buffer + offset, buflen);
+	  iw_print_ie_wpa(buffer + offset, buflen - offset);
 	  break;
 	default:
-	  iw_print_ie_unknown(buffer + offset, buflen);
+	  iw_print_ie_unknown(buffer + offset, buflen - offset);
 	}
+
       /* Skip over this IE to the next one in the list. */
       offset += buffer[offset+1] + 2;
     }
@@ -455,21 +760,26 @@ print_scanning_token(struct stream_descr *	stream,	/* Stream of events */
 		     struct iw_range *	iw_range,	/* Range info */
 		     int		has_range)
 {
-  char		buffer[128];	/* Temporary buffer */
+  /* Everything goes in the output buffer, see iw_out_flush() */
 
   /* Now, let's decode the event */
   switch(event->cmd)
     {
     case SIOCGIWAP:
-      printf("          Cell %02d - Address: %s\n", state->ap_num,
-	     iw_saether_ntop(&event->u.ap_addr, buffer));
+      iw_out_str("          Cell ");
+      iw_out_uint(state->ap_num, 2);
+      iw_out_str(" - Address: ");
+      iw_ether_ntop((const struct ether_addr *) event->u.ap_addr.sa_data,
+		    iw_out_reserve(18));
+      out_len += 17;
+      iw_out_mem("\n", 1);
       state->ap_num++;
       break;
     case SIOCGIWNWID:
       if(event->u.nwid.disabled)
-	printf("                    NWID:off/any\n");
+	iw_out_str("                    NWID:off/any\n");
       else
-	printf("                    NWID:%X\n", event->u.nwid.value);
+	iw_out_printf("                    NWID:%X\n", event->u.nwid.value);
       break;
     case SIOCGIWFREQ:
       {
@@ -479,39 +789,39 @@ print_scanning_token(struct stream_descr *	stream,	/* Stream of events */
 	/* Convert to channel if possible */
 	if(has_range)
 	  channel = iw_freq_to_channel(freq, iw_range);
-	iw_print_freq(buffer, sizeof(buffer),
-		      freq, channel, event->u.freq.flags);
-	printf("                    %s\n", buffer);
+	iw_out_str("                    ");
+	IW_OUT_PRINT(iw_print_freq, freq, channel, event->u.freq.flags);
+	iw_out_mem("\n", 1);
       }
       break;
     case SIOCGIWMODE:
       /* Note : event->u.mode is unsigned, no need to check <= 0 */
       if(event->u.mode >= IW_NUM_OPER_MODE)
 	event->u.mode = IW_NUM_OPER_MODE;
-      printf("                    Mode:%s\n",
-	     iw_operation_mode[event->u.mode]);
+      iw_out_str("                    Mode:");
+      iw_out_str(iw_operation_mode[event->u.mode]);
+      iw_out_mem("\n", 1);
       break;
     case SIOCGIWNAME:
-      printf("                    Protocol:%-1.16s\n", event->u.name);
+      iw_out_printf("                    Protocol:%-1.16s\n", event->u.name);
       break;
     case SIOCGIWESSID:
-      {
-	char essid[IW_ESSID_MAX_SIZE+1];
-	memset(essid, '\0', sizeof(essid));
-	if((event->u.essid.pointer) && (event->u.essid.length))
-	  memcpy(essid, event->u.essid.pointer, event->u.essid.length);
-	if(event->u.essid.flags)
-	  {
-	    /* Does it have an ESSID index ? */
-	    if((event->u.essid.flags & IW_ENCODE_INDEX) > 1)
-	      printf("                    ESSID:\"%s\" [%d]\n", essid,
-		     (event->u.essid.flags & IW_ENCODE_INDEX));
-	    else
-	      printf("                    ESSID:\"%s\"\n", essid);
-	  }
-	else
-	  printf("                    ESSID:off/any/hidden\n");
-      }
+      if(event->u.essid.flags)
+	{
+	  /* The ESSID is not terminated, and may contain NULs */
+	  int	len = 0;
+	  if(event->u.essid.pointer)
+	    len = strnlen(event->u.essid.pointer, event->u.essid.length);
+	  iw_out_str("                    ESSID:\"");
+	  iw_out_mem(event->u.essid.pointer, len);
+	  /* Does it have an ESSID index ? */
+	  if((event->u.essid.flags & IW_ENCODE_INDEX) > 1)
+	    iw_out_printf("\" [%d]\n", (event->u.essid.flags & IW_ENCODE_INDEX));
+	  else
+	    iw_out_mem("\"\n", 2);
+	}
+      else
+	iw_out_str("                    ESSID:off/any/hidden\n");
       break;
     case SIOCGIWENCODE:
       {
@@ -520,90 +830,1589 @@ print_scanning_token(struct stream_descr *	stream,	/* Stream of events */
 	  memcpy(key, event->u.data.pointer, event->u.data.length);
 	else
 	  event->u.data.flags |= IW_ENCODE_NOKEY;
-	printf("                    Encryption key:");
+	iw_out_str("                    Encryption key:");
 	if(event->u.data.flags & IW_ENCODE_DISABLED)
-	  printf("off\n");
+	  iw_out_str("off\n");
 	else
 	  {
 	    /* Display the key */
-	    iw_print_key(buffer, sizeof(buffer), key, event->u.data.length,
+	    IW_OUT_PRINT(iw_print_key, key, event->u.data.length,
 			 event->u.data.flags);
-	    printf("%s", buffer);
 
-	    /* Other info... */
-	    if((event->u.data.flags & IW_ENCODE_INDEX) > 1)
-	      printf(" [%d]", event->u.data.flags & IW_ENCODE_INDEX);
-	    if(event->u.data.flags & IW_ENCODE_RESTRICTED)
-	      printf("   Security mode:restricted");
-	    if(event->u.data.flags & IW_ENCODE_OPEN)
-	      printf("   Security mode:open");
-	    printf("\n");
-	  }
-      }
-      break;
-    case SIOCGIWRATE:
-      if(state->val_index == 0)
-	printf("                    Bit Rates:");
-      else
-	if((state->val_index % 5) == 0)
-	  printf("\n                              ");
-	else
-	  printf("; ");
-      iw_print_bitrate(buffer, sizeof(buffer), event->u.bitrate.value);
-      printf("%s", buffer);
-      /* Check for termination */
-      if(stream->value == NULL)
+	    /* Other info... */
+	    if((event->u.data.flags & IW_ENCODE_INDEX) > 1)
+	      iw_out_printf(" [%d]", event->u.data.flags & IW_ENCODE_INDEX);
+	    if(event->u.data.flags & IW_ENCODE_RESTRICTED)
+	      iw_out_str("   Security mode:restricted");
+	    if(event->u.data.flags & IW_ENCODE_OPEN)
+	      iw_out_str("   Security mode:open");
+	    iw_out_mem("\n", 1);
+	  }
+      }
+      break;
+    case SIOCGIWRATE:
+      if(state->val_index == 0)
+	iw_out_str("                    Bit Rates:");
+      else
+	if((state->val_index % 5) == 0)
+	  iw_out_str("\n                              ");
+	else
+	  iw_out_mem("; ", 2);
+      iw_out_bitrate(event->u.bitrate.value);
+      /* Check for termination */
+      if(stream->value == NULL)
+	{
+	  iw_out_mem("\n", 1);
+	  state->val_index = 0;
+	}
+      else
+	state->val_index++;
+      break;
+    case SIOCGIWMODUL:
+      {
+	unsigned int	modul = event->u.param.value;
+	int		i;
+	int		n = 0;
+	iw_out_str("                    Modulations :");
+	for(i = 0; i < IW_SIZE_MODUL_LIST; i++)
+	  {
+	    if((modul & iw_modul_list[i].mask) == iw_modul_list[i].mask)
+	      {
+		if((n++ % 8) == 7)
+		  iw_out_str("\n                        ");
+		else
+		  iw_out_str(" ; ");
+		iw_out_str(iw_modul_list[i].cmd);
+	      }
+	  }
+	iw_out_mem("\n", 1);
+      }
+      break;
+    case IWEVQUAL:
+      iw_out_str("                    ");
+      IW_OUT_PRINT(iw_print_stats, &event->u.qual, iw_range, has_range);
+      iw_out_mem("\n", 1);
+      break;
+#ifndef WE_ESSENTIAL
+    case IWEVGENIE:
+      /* Informations Elements are complex, let's do only some of them */
+      iw_print_gen_ie(event->u.data.pointer, event->u.data.length);
+      break;
+#endif	/* WE_ESSENTIAL */
+    case IWEVCUSTOM:
+      {
+	/* Stop at the first NUL, like printf() */
+	int	len = 0;
+	if(event->u.data.pointer)
+	  len = strnlen(event->u.data.pointer, event->u.data.length);
+	iw_out_str("                    Extra:");
+	iw_out_mem(event->u.data.pointer, len);
+	iw_out_mem("\n", 1);
+      }
+      break;
+    default:
+      iw_out_printf("                    (Unknown Wireless Token 0x%04X)\n",
+		    event->cmd);
+   }	/* switch(event->cmd) */
+}
+
+/********************* MACHINE READABLE SCANNING *********************/
+/*
+ * With "--format=json", each cell is printed as a JSON object on its
+ * own line, directly from the events, without building the list of
+ * cells. With "--format=csv", each cell is a line of a table, the first
+ * line gives the name of the columns. Scripts depend on the names of
+ * the fields, don't change them, only add new ones.
+ */
+
+/* Columns of the CSV output */
+#define IWSCAN_CSV_HEADER	"interface,cell,address,essid,mode,protocol,frequency,channel,nwid,encryption,quality,quality_max,signal,signal_max,noise,noise_max,signal_dbm,noise_dbm,max_bitrate,security"
+
+/* Names of IWSCAN_DELTA_*, in the "delta" field */
+static const char *	iwscan_delta_name[] = {
+  "same", "new", "changed", "lost" };
+
+/*------------------------------------------------------------------*/
+/*
+ * Status of the current cell compared to the previous scan.
+ */
+static int
+scan_delta_status(const struct iwscan_state *	state)
+{
+  /* ap_num was incremented when the cell started */
+  int	cell = state->ap_num - 2;
+
+  if((cell < 0) || (cell >= state->num_delta))
+    return(IWSCAN_DELTA_NEW);
+  return(state->delta[cell]);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Length of the UTF-8 character at the start of data, 0 if it's not
+ * valid UTF-8 (cut, overlong, surrogate or beyond U+10FFFF).
+ */
+static int
+iw_utf8_len(const unsigned char *	data,
+	    int				len)
+{
+  unsigned int	c;
+  int		n;
+  int		i;
+
+  if(data[0] < 0x80)
+    return(1);
+  if(data[0] < 0xC2)
+    return(0);
+  if(data[0] < 0xE0)
+    {
+      n = 2;
+      c = data[0] & 0x1F;
+    }
+  else if(data[0] < 0xF0)
+    {
+      n = 3;
+      c = data[0] & 0x0F;
+    }
+  else if(data[0] < 0xF5)
+    {
+      n = 4;
+      c = data[0] & 0x07;
+    }
+  else
+    return(0);
+  if(n > len)
+    return(0);
+
+  for(i = 1; i < n; i++)
+    {
+      if((data[i] & 0xC0) != 0x80)
+	return(0);
+      c = (c << 6) | (data[i] & 0x3F);
+    }
+  if(((n == 3) && (c < 0x800))
+     || ((n == 4) && ((c < 0x10000) || (c > 0x10FFFF)))
+     || ((c >= 0xD800) && (c <= 0xDFFF)))
+    return(0);
+  return(n);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Check that a string is valid UTF-8.
+ */
+static int
+iw_utf8_valid(const char *	str,
+	      int		len)
+{
+  const unsigned char *	data = (const unsigned char *) str;
+  int			n;
+  int			i;
+
+  for(i = 0; i < len; i += n)
+    {
+      n = iw_utf8_len(data + i, len - i);
+      if(n == 0)
+	return(0);
+    }
+  return(1);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add a JSON string. Control characters are escaped, UTF-8 is copied
+ * as is, the bytes that are not UTF-8 become U+FFFD, so that the line
+ * is always valid JSON. See print_json_essid() to keep them.
+ */
+static void
+iw_out_json_str(const char *	str,
+		int		len)
+{
+  static const char	hex[] = "0123456789abcdef";
+  const unsigned char *	data = (const unsigned char *) str;
+  char *		p = iw_out_reserve(6 * len + 2);
+  int			n;
+  int			i;
+
+  *p++ = '"';
+  for(i = 0; i < len; i++)
+    {
+      if((data[i] == '"') || (data[i] == '\\'))
+	{
+	  *p++ = '\\';
+	  *p++ = data[i];
+	}
+      else if((data[i] < 0x20) || (data[i] == 0x7F))
+	{
+	  memcpy(p, "\\u00", 4);
+	  p[4] = hex[data[i] >> 4];
+	  p[5] = hex[data[i] & 0xF];
+	  p += 6;
+	}
+      else if(data[i] < 0x80)
+	*p++ = data[i];
+      else
+	{
+	  n = iw_utf8_len(data + i, len - i);
+	  if(n == 0)
+	    {
+	      memcpy(p, "\\ufffd", 6);
+	      p += 6;
+	    }
+	  else
+	    {
+	      memcpy(p, data + i, n);
+	      p += n;
+	      i += n - 1;
+	    }
+	}
+    }
+  *p++ = '"';
+  out_len = p - out_buf;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add the value of the JSON essid field. ESSIDs are any bytes, when
+ * they are not UTF-8 the exact ESSID also goes in essid_hex.
+ */
+static void
+print_json_essid(const char *	essid,
+		 int		len)
+{
+  iw_out_json_str(essid, len);
+  if(!iw_utf8_valid(essid, len))
+    {
+      iw_out_str(",\"essid_hex\":\"");
+      iw_out_hex((const unsigned char *) essid, len);
+      iw_out_mem("\"", 1);
+    }
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add a CSV string, always quoted.
+ */
+static void
+iw_out_csv_str(const char *	str,
+	       int		len)
+{
+  char *	p = iw_out_reserve(2 * len + 2);
+  int		i;
+
+  *p++ = '"';
+  for(i = 0; i < len; i++)
+    {
+      if(str[i] == '"')
+	*p++ = '"';
+      *p++ = str[i];
+    }
+  *p++ = '"';
+  out_len = p - out_buf;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Decode the quality of a cell, same rules as iw_print_stats().
+ */
+static void
+scan_qual_decode(const struct iw_quality *	qual,
+		 const struct iw_range *	range,
+		 int				has_range,
+		 iwscan_qual *			out)
+{
+  memset(out, 0, sizeof(iwscan_qual));
+
+  /* Without the range, we don't know what those values are */
+  if((!has_range) || ((qual->level == 0)
+		      && !(qual->updated & (IW_QUAL_DBM | IW_QUAL_RCPI))))
+    {
+      out->flags = IWSCAN_Q_QUAL | IWSCAN_Q_LEVEL | IWSCAN_Q_NOISE;
+      out->qual = qual->qual;
+      out->level = qual->level;
+      out->noise = qual->noise;
+      return;
+    }
+
+  /* Quality is always a relative value */
+  out->flags = IWSCAN_Q_MAX;
+  if(!(qual->updated & IW_QUAL_QUAL_INVALID))
+    {
+      out->flags |= IWSCAN_Q_QUAL;
+      out->qual = qual->qual;
+      out->qual_max = range->max_qual.qual;
+    }
+  if(!(qual->updated & IW_QUAL_LEVEL_INVALID))
+    out->flags |= IWSCAN_Q_LEVEL;
+  if(!(qual->updated & IW_QUAL_NOISE_INVALID))
+    out->flags |= IWSCAN_Q_NOISE;
+
+  if(qual->updated & IW_QUAL_RCPI)
+    {
+      /* RCPI = int{(Power in dBm +110)*2} */
+      out->flags |= IWSCAN_Q_DBM;
+      out->level = (qual->level / 2.0) - 110.0;
+      out->noise = (qual->noise / 2.0) - 110.0;
+    }
+  else
+    if((qual->updated & IW_QUAL_DBM)
+       || (qual->level > range->max_qual.level))
+      {
+	/* dBm are in the range [-192; 63] */
+	out->flags |= IWSCAN_Q_DBM;
+	out->level = qual->level - ((qual->level >= 64) ? 0x100 : 0);
+	out->noise = qual->noise - ((qual->noise >= 64) ? 0x100 : 0);
+      }
+    else
+      {
+	out->level = qual->level;
+	out->level_max = range->max_qual.level;
+	out->noise = qual->noise;
+	out->noise_max = range->max_qual.noise;
+      }
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Convert the frequency event of a cell to frequency and channel.
+ * Either may be unknown (-1).
+ */
+static void
+scan_freq_decode(const struct iw_freq *		event,
+		 const struct iw_range *	range,
+		 int				has_range,
+		 double *			pfreq,
+		 int *				pchannel)
+{
+  double	freq = iw_freq2float(event);
+
+  *pfreq = -1;
+  *pchannel = -1;
+  if(freq < KILO)
+    {
+      /* This is a channel, the driver didn't convert it */
+      *pchannel = (int) freq;
+      if((!has_range) || (iw_channel_to_freq(*pchannel, pfreq, range) < 0))
+	*pfreq = -1;
+    }
+  else
+    {
+      *pfreq = freq;
+      if(has_range)
+	*pchannel = iw_freq_to_channel(freq, range);
+    }
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Start a field of the current JSON object. Drivers may repeat some
+ * events, only the first one is printed, so that the keys of the object
+ * are unique.
+ * Return 0 if the field was already printed.
+ */
+static int
+print_json_field(struct iwscan_state *	state,
+		 unsigned int		field,
+		 const char *		key)
+{
+  /* Close the list we were in */
+  if(state->list)
+    {
+      iw_out_mem("]", 1);
+      state->list = 0;
+    }
+
+  if(state->fields & field)
+    return(0);
+  state->fields |= field;
+
+  if(key != NULL)
+    {
+      iw_out_mem(",\"", 2);
+      iw_out_str(key);
+      iw_out_mem("\":", 2);
+    }
+  return(1);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add an item to a list of the current JSON object. The items of a list
+ * come from consecutive events.
+ * Return 0 if the list was already printed.
+ */
+static int
+print_json_item(struct iwscan_state *	state,
+		unsigned int		field,
+		const char *		key)
+{
+  if(state->list == field)
+    {
+      iw_out_mem(",", 1);
+      return(1);
+    }
+  if(!print_json_field(state, field, key))
+    return(0);
+  iw_out_mem("[", 1);
+  state->list = field;
+  return(1);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Terminate the JSON object of the current cell.
+ */
+static void
+print_json_cell_end(struct iwscan_state *	state)
+{
+  if(!(state->fields & IWSCAN_F_CELL))
+    return;
+  if(state->list)
+    iw_out_mem("]", 1);
+  iw_out_mem("}\n", 2);
+  state->fields = 0;
+  state->list = 0;
+}
+
+#ifndef WE_ESSENTIAL
+/*------------------------------------------------------------------*/
+/*
+ * Add the name of a cipher or authentication suite as a JSON string.
+ */
+static void
+print_json_suite(unsigned int		value,
+		 const char *		names[],
+		 const unsigned int	num_names)
+{
+  if(value == IW_IE_SUITE_PROPRIETARY)
+    iw_out_str("\"proprietary\"");
+  else if(value >= num_names)
+    iw_out_str("\"unknown\"");
+  else
+    iw_out_json_str(names[value], strlen(names[value]));
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add a list of cipher or authentication suites of the IE (count and
+ * suites) as a JSON list. The list must fit in the IE.
+ * Return the offset after the list.
+ */
+static int
+print_json_suites(const unsigned char *	iebuf,
+		  int			offset,
+		  const unsigned char *	oui,
+		  const char *		names[],
+		  const unsigned int	num_names)
+{
+  int	cnt = iebuf[offset] | (iebuf[offset + 1] << 8);
+  int	i;
+
+  offset += 2;
+  iw_out_mem("[", 1);
+  for(i = 0; i < cnt; i++, offset += 4)
+    {
+      if(i)
+	iw_out_mem(",", 1);
+      if(memcmp(iebuf + offset, oui, 3) != 0)
+	iw_out_str("\"proprietary\"");
+      else
+	print_json_suite(iebuf[offset + 3], names, num_names);
+    }
+  iw_out_mem("]", 1);
+  return(offset);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add a single suite as a JSON list, for the defaults.
+ */
+static void
+print_json_suite_default(unsigned int		value,
+			 const char *		names[],
+			 const unsigned int	num_names)
+{
+  iw_out_mem("[", 1);
+  print_json_suite(value, names, num_names);
+  iw_out_mem("]", 1);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Print one IE as a JSON object, with the payload in hex and the
+ * decoded WPA/WPA2 parameters.
+ */
+static void
+print_json_ie(const unsigned char *	iebuf,
+	      int			ielen)
+{
+  iw_ie_info		info;
+  const iw_ie_rsn *	rsn = NULL;
+  const unsigned char *	oui;
+  int			offset;
+
+  iw_out_str("{\"id\":");
+  iw_out_uint(iebuf[0], 1);
+  iw_out_str(",\"data\":\"");
+  iw_out_hex(iebuf + 2, ielen - 2);
+  iw_out_mem("\"", 1);
+
+  iw_parse_ies(iebuf, ielen, &info);
+  if(info.present & IW_IE_HAS_RSN)
+    {
+      rsn = &info.rsn;
+      iw_out_str(",\"type\":\"wpa2\"");
+    }
+  else if(info.present & IW_IE_HAS_WPA)
+    {
+      rsn = &info.wpa;
+      iw_out_str(",\"type\":\"wpa\"");
+    }
+  if(rsn != NULL)
+    {
+      /* Missing fields have the default values of the standard.
+       * The library keeps only a few suites, the lists that are in
+       * the IE are taken from it, pairwise count after the group. */
+      offset = iw_ie_wpa_offset(iebuf, ielen, &oui) + 6;
+      iw_out_str(",\"version\":");
+      iw_out_uint(rsn->version, 1);
+      iw_out_str(",\"group\":");
+      print_json_suite(rsn->group, iw_ie_cypher_name, IW_IE_CYPHER_NUM);
+      iw_out_str(",\"pairwise\":");
+      if(rsn->fields & IW_IE_RSN_PAIRWISE)
+	offset = print_json_suites(iebuf, offset, oui,
+				   iw_ie_cypher_name, IW_IE_CYPHER_NUM);
+      else
+	print_json_suite_default(rsn->pairwise[0],
+				 iw_ie_cypher_name, IW_IE_CYPHER_NUM);
+      iw_out_str(",\"akm\":");
+      if(rsn->fields & IW_IE_RSN_AKM)
+	print_json_suites(iebuf, offset, oui,
+			  iw_ie_key_mgmt_name, IW_IE_KEY_MGMT_NUM);
+      else
+	print_json_suite_default(rsn->akm[0],
+				 iw_ie_key_mgmt_name, IW_IE_KEY_MGMT_NUM);
+      iw_out_str((rsn->capabilities & 0x01) ?
+		 ",\"preauth\":true" : ",\"preauth\":false");
+    }
+  iw_out_mem("}", 1);
+}
+#endif	/* WE_ESSENTIAL */
+
+/*------------------------------------------------------------------*/
+/*
+ * Print one element from the scanning results as JSON
+ */
+static void
+print_scanning_json_token(struct stream_descr *	stream,
+			  struct iw_event *	event,
+			  struct iwscan_state *	state,
+			  struct iw_range *	iw_range,
+			  int			has_range)
+{
+  /* Avoid "Unused parameter" warning */
+  stream = stream;
+
+  /* Events before the first cell don't belong to anything */
+  if((event->cmd != SIOCGIWAP) && !(state->fields & IWSCAN_F_CELL))
+    return;
+
+  switch(event->cmd)
+    {
+    case SIOCGIWAP:
+      print_json_cell_end(state);
+      iw_out_str("{\"interface\":");
+      iw_out_json_str(state->ifname, strlen(state->ifname));
+      iw_out_str(",\"cell\":");
+      iw_out_uint(state->ap_num, 1);
+      iw_out_str(",\"address\":\"");
+      iw_ether_ntop((const struct ether_addr *) event->u.ap_addr.sa_data,
+		    iw_out_reserve(18));
+      out_len += 17;
+      iw_out_mem("\"", 1);
+      state->fields = IWSCAN_F_CELL;
+      state->ap_num++;
+      break;
+    case SIOCGIWNWID:
+      if(print_json_field(state, IWSCAN_F_NWID, "nwid"))
+	{
+	  if(event->u.nwid.disabled)
+	    iw_out_str("null");
+	  else
+	    iw_out_uint(event->u.nwid.value, 1);
+	}
+      break;
+    case SIOCGIWFREQ:
+      {
+	double		freq;
+	int		channel;
+	scan_freq_decode(&event->u.freq, iw_range, has_range,
+			 &freq, &channel);
+	if((freq >= 0) && print_json_field(state, IWSCAN_F_FREQ, "frequency"))
+	  iw_out_printf("%.0f", freq);
+	if((channel >= 0)
+	   && print_json_field(state, IWSCAN_F_CHANNEL, "channel"))
+	  iw_out_uint(channel, 1);
+      }
+      break;
+    case SIOCGIWMODE:
+      if(event->u.mode >= IW_NUM_OPER_MODE)
+	event->u.mode = IW_NUM_OPER_MODE;
+      if(print_json_field(state, IWSCAN_F_MODE, "mode"))
+	iw_out_json_str(iw_operation_mode[event->u.mode],
+			strlen(iw_operation_mode[event->u.mode]));
+      break;
+    case SIOCGIWNAME:
+      if(print_json_field(state, IWSCAN_F_PROTOCOL, "protocol"))
+	iw_out_json_str(event->u.name, strnlen(event->u.name, IFNAMSIZ));
+      break;
+    case SIOCGIWESSID:
+      if(print_json_field(state, IWSCAN_F_ESSID, "essid"))
+	{
+	  /* Hidden ESSID */
+	  if(!event->u.essid.flags)
+	    iw_out_str("null");
+	  else
+	    print_json_essid(event->u.essid.pointer,
+			     event->u.essid.pointer ?
+			     event->u.essid.length : 0);
+	}
+      break;
+    case SIOCGIWENCODE:
+      if(print_json_field(state, IWSCAN_F_ENCRYPTION, "encryption"))
+	iw_out_str((event->u.data.flags & IW_ENCODE_DISABLED) ?
+		   "false" : "true");
+      break;
+    case SIOCGIWRATE:
+      /* Each value of the event is one item, in b/s */
+      if(print_json_item(state, IWSCAN_F_BITRATES, "bitrates"))
+	iw_out_printf("%d", event->u.bitrate.value);
+      break;
+    case SIOCGIWMODUL:
+      if(print_json_field(state, IWSCAN_F_MODUL, "modulations"))
+	{
+	  unsigned int	modul = event->u.param.value;
+	  int		i;
+	  int		n = 0;
+	  iw_out_mem("[", 1);
+	  for(i = 0; i < IW_SIZE_MODUL_LIST; i++)
+	    if((modul & iw_modul_list[i].mask) == iw_modul_list[i].mask)
+	      {
+		if(n++)
+		  iw_out_mem(",", 1);
+		iw_out_json_str(iw_modul_list[i].cmd,
+				strlen(iw_modul_list[i].cmd));
+	      }
+	  iw_out_mem("]", 1);
+	}
+      break;
+    case IWEVQUAL:
+      if(print_json_field(state, IWSCAN_F_QUAL, NULL))
+	{
+	  iwscan_qual	qual;
+	  int		dbm;
+	  scan_qual_decode(&event->u.qual, iw_range, has_range, &qual);
+	  dbm = qual.flags & IWSCAN_Q_DBM;
+	  if(qual.flags & IWSCAN_Q_QUAL)
+	    {
+	      iw_out_printf(",\"quality\":%d", qual.qual);
+	      if(qual.flags & IWSCAN_Q_MAX)
+		iw_out_printf(",\"quality_max\":%d", qual.qual_max);
+	    }
+	  if(qual.flags & IWSCAN_Q_LEVEL)
+	    {
+	      iw_out_printf(dbm ? ",\"signal_dbm\":%g" : ",\"signal\":%g",
+			    qual.level);
+	      if((qual.flags & IWSCAN_Q_MAX) && !dbm)
+		iw_out_printf(",\"signal_max\":%d", qual.level_max);
+	    }
+	  if(qual.flags & IWSCAN_Q_NOISE)
+	    {
+	      iw_out_printf(dbm ? ",\"noise_dbm\":%g" : ",\"noise\":%g",
+			    qual.noise);
+	      if((qual.flags & IWSCAN_Q_MAX) && !dbm)
+		iw_out_printf(",\"noise_max\":%d", qual.noise_max);
+	    }
+	}
+      break;
+#ifndef WE_ESSENTIAL
+    case IWEVGENIE:
+      {
+	const unsigned char *	buffer = event->u.data.pointer;
+	int			buflen = event->u.data.length;
+	int			offset = 0;
+	int			ielen;
+
+	/* Each IE of the event is one item */
+	while(offset <= (buflen - 2))
+	  {
+	    ielen = buffer[offset+1] + 2;
+	    if(ielen > (buflen - offset))
+	      ielen = buflen - offset;
+	    if(!print_json_item(state, IWSCAN_F_IES, "ies"))
+	      break;
+	    print_json_ie(buffer + offset, ielen);
+	    offset += ielen;
+	  }
+      }
+      break;
+#endif	/* WE_ESSENTIAL */
+    case IWEVCUSTOM:
+      if(print_json_item(state, IWSCAN_F_EXTRA, "extra"))
+	iw_out_json_str(event->u.data.pointer,
+			event->u.data.pointer ?
+			strnlen(event->u.data.pointer,
+				event->u.data.length) : 0);
+      break;
+    default:
+      /* Unknown events are not part of the format */
+      break;
+   }	/* switch(event->cmd) */
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Print the line of the current cell in CSV.
+ */
+static void
+print_csv_cell_end(struct iwscan_state *	state,
+		   struct iw_range *		iw_range,
+		   int				has_range)
+{
+  iwscan_row *	row = &state->row;
+  iwscan_qual	qual;
+  int		dbm;
+
+  if(!(state->fields & IWSCAN_F_CELL))
+    return;
+
+  iw_out_csv_str(state->ifname, strlen(state->ifname));
+  iw_out_mem(",", 1);
+  iw_out_uint(state->ap_num - 1, 1);
+  iw_out_mem(",", 1);
+  iw_ether_ntop((const struct ether_addr *) row->address, iw_out_reserve(18));
+  out_len += 17;
+  iw_out_mem(",", 1);
+  if(state->fields & IWSCAN_F_ESSID)
+    iw_out_csv_str(row->essid, row->essid_len);
+  iw_out_mem(",", 1);
+  if(state->fields & IWSCAN_F_MODE)
+    iw_out_csv_str(iw_operation_mode[row->mode],
+		   strlen(iw_operation_mode[row->mode]));
+  iw_out_mem(",", 1);
+  if(state->fields & IWSCAN_F_PROTOCOL)
+    iw_out_csv_str(row->protocol, strlen(row->protocol));
+  iw_out_mem(",", 1);
+  if(state->fields & IWSCAN_F_FREQ)
+    iw_out_printf("%.0f", row->freq);
+  iw_out_mem(",", 1);
+  if(state->fields & IWSCAN_F_CHANNEL)
+    iw_out_uint(row->channel, 1);
+  iw_out_mem(",", 1);
+  if((state->fields & IWSCAN_F_NWID) && !row->nwid.disabled)
+    iw_out_uint(row->nwid.value, 1);
+  iw_out_mem(",", 1);
+  if(state->fields & IWSCAN_F_ENCRYPTION)
+    iw_out_uint(row->encryption, 1);
+
+  /* quality,quality_max,signal,signal_max,noise,noise_max,
+   * signal_dbm,noise_dbm */
+  if(state->fields & IWSCAN_F_QUAL)
+    {
+      scan_qual_decode(&row->qual, iw_range, has_range, &qual);
+      dbm = qual.flags & IWSCAN_Q_DBM;
+      iw_out_mem(",", 1);
+      if(qual.flags & IWSCAN_Q_QUAL)
+	iw_out_printf("%d", qual.qual);
+      iw_out_mem(",", 1);
+      if((qual.flags & IWSCAN_Q_QUAL) && (qual.flags & IWSCAN_Q_MAX))
+	iw_out_printf("%d", qual.qual_max);
+      iw_out_mem(",", 1);
+      if((qual.flags & IWSCAN_Q_LEVEL) && !dbm)
+	iw_out_printf("%g", qual.level);
+      iw_out_mem(",", 1);
+      if((qual.flags & IWSCAN_Q_LEVEL) && (qual.flags & IWSCAN_Q_MAX) && !dbm)
+	iw_out_printf("%d", qual.level_max);
+      iw_out_mem(",", 1);
+      if((qual.flags & IWSCAN_Q_NOISE) && !dbm)
+	iw_out_printf("%g", qual.noise);
+      iw_out_mem(",", 1);
+      if((qual.flags & IWSCAN_Q_NOISE) && (qual.flags & IWSCAN_Q_MAX) && !dbm)
+	iw_out_printf("%d", qual.noise_max);
+      iw_out_mem(",", 1);
+      if((qual.flags & IWSCAN_Q_LEVEL) && dbm)
+	iw_out_printf("%g", qual.level);
+      iw_out_mem(",", 1);
+      if((qual.flags & IWSCAN_Q_NOISE) && dbm)
+	iw_out_printf("%g", qual.noise);
+    }
+  else
+    iw_out_str(",,,,,,,,");
+  iw_out_mem(",", 1);
+  if(state->fields & IWSCAN_F_BITRATES)
+    iw_out_printf("%d", row->max_bitrate);
+
+  /* Summary of the security of the cell */
+  iw_out_mem(",", 1);
+  if((row->security & IW_IE_HAS_RSN) && (row->security & IW_IE_HAS_WPA))
+    iw_out_str("wpa/wpa2");
+  else if(row->security & IW_IE_HAS_RSN)
+    iw_out_str("wpa2");
+  else if(row->security & IW_IE_HAS_WPA)
+    iw_out_str("wpa");
+  else if(state->fields & IWSCAN_F_ENCRYPTION)
+    iw_out_str(row->encryption ? "wep" : "open");
+  if(state->delta != NULL)
+    {
+      iw_out_mem(",", 1);
+      iw_out_str(iwscan_delta_name[scan_delta_status(state)]);
+    }
+  iw_out_mem("\n", 1);
+
+  state->fields = 0;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Collect one element from the scanning results for the CSV line of
+ * the cell.
+ */
+static void
+print_scanning_csv_token(struct stream_descr *	stream,
+			 struct iw_event *	event,
+			 struct iwscan_state *	state,
+			 struct iw_range *	iw_range,
+			 int			has_range)
+{
+  iwscan_row *	row = &state->row;
+
+  /* Avoid "Unused parameter" warning */
+  stream = stream;
+
+  /* Events before the first cell don't belong to anything */
+  if((event->cmd != SIOCGIWAP) && !(state->fields & IWSCAN_F_CELL))
+    return;
+
+  switch(event->cmd)
+    {
+    case SIOCGIWAP:
+      print_csv_cell_end(state, iw_range, has_range);
+      memcpy(row->address, event->u.ap_addr.sa_data, ETH_ALEN);
+      row->max_bitrate = 0;
+      row->security = 0;
+      state->fields = IWSCAN_F_CELL;
+      state->ap_num++;
+      return;
+    case SIOCGIWNWID:
+      if(state->fields & IWSCAN_F_NWID)
+	return;
+      row->nwid = event->u.nwid;
+      state->fields |= IWSCAN_F_NWID;
+      break;
+    case SIOCGIWFREQ:
+      {
+	double		freq;
+	int		channel;
+	scan_freq_decode(&event->u.freq, iw_range, has_range,
+			 &freq, &channel);
+	if((freq >= 0) && !(state->fields & IWSCAN_F_FREQ))
+	  {
+	    row->freq = freq;
+	    state->fields |= IWSCAN_F_FREQ;
+	  }
+	if((channel >= 0) && !(state->fields & IWSCAN_F_CHANNEL))
+	  {
+	    row->channel = channel;
+	    state->fields |= IWSCAN_F_CHANNEL;
+	  }
+      }
+      break;
+    case SIOCGIWMODE:
+      if(state->fields & IWSCAN_F_MODE)
+	return;
+      row->mode = (event->u.mode >= IW_NUM_OPER_MODE) ?
+		  IW_NUM_OPER_MODE : event->u.mode;
+      state->fields |= IWSCAN_F_MODE;
+      break;
+    case SIOCGIWNAME:
+      if(state->fields & IWSCAN_F_PROTOCOL)
+	return;
+      strncpy(row->protocol, event->u.name, IFNAMSIZ);
+      row->protocol[IFNAMSIZ] = '\0';
+      state->fields |= IWSCAN_F_PROTOCOL;
+      break;
+    case SIOCGIWESSID:
+      /* Hidden ESSIDs are left empty */
+      if((state->fields & IWSCAN_F_ESSID) || !event->u.essid.flags)
+	return;
+      row->essid_len = 0;
+      if(event->u.essid.pointer)
+	{
+	  row->essid_len = event->u.essid.length;
+	  if(row->essid_len > IW_ESSID_MAX_SIZE)
+	    row->essid_len = IW_ESSID_MAX_SIZE;
+	  memcpy(row->essid, event->u.essid.pointer, row->essid_len);
+	}
+      state->fields |= IWSCAN_F_ESSID;
+      break;
+    case SIOCGIWENCODE:
+      if(state->fields & IWSCAN_F_ENCRYPTION)
+	return;
+      row->encryption = !(event->u.data.flags & IW_ENCODE_DISABLED);
+      state->fields |= IWSCAN_F_ENCRYPTION;
+      break;
+    case SIOCGIWRATE:
+      if(event->u.bitrate.value > row->max_bitrate)
+	row->max_bitrate = event->u.bitrate.value;
+      state->fields |= IWSCAN_F_BITRATES;
+      break;
+    case IWEVQUAL:
+      if(state->fields & IWSCAN_F_QUAL)
+	return;
+      row->qual = event->u.qual;
+      state->fields |= IWSCAN_F_QUAL;
+      break;
+#ifndef WE_ESSENTIAL
+    case IWEVGENIE:
+      {
+	iw_ie_info	info;
+	iw_parse_ies(event->u.data.pointer, event->u.data.length, &info);
+	row->security |= info.present & (IW_IE_HAS_WPA | IW_IE_HAS_RSN);
+      }
+      break;
+#endif	/* WE_ESSENTIAL */
+    default:
+      /* Not in the table */
+      break;
+   }	/* switch(event->cmd) */
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Save the results of a scan on one device in a snapshot, for other
+ * processes to read (see iw_snapshot_open()).
+ */
+static void
+save_scanning_snapshot(char *			ifname,
+		       unsigned char *		buffer,
+		       int			buflen,
+		       struct iw_range *	range,
+		       int			has_range)
+{
+  wireless_scan_head	context;
+
+  iw_scan_init(&context);
+  if((iw_scan_decode(&context, (char *) buffer, buflen,
+		     range->we_version_compiled) < 0)
+     || (iw_snapshot_write(scan_snapshot, ifname, context.result,
+			   has_range ? range : NULL,
+			   range->we_version_compiled) < 0))
+    fprintf(stderr, "%-8.16s  Failed to write snapshot %s : %s\n\n",
+	    ifname, scan_snapshot, strerror(errno));
+  iw_scan_release(&context);
+}
+
+/*************************** SCAN DELTA ***************************/
+/*
+ * With "--delta FILE", the results of each scan are saved in a snapshot
+ * and compared with the previous one, and only the cells that appeared,
+ * disappeared or changed are printed. The cells are formatted as usual
+ * and dropped from the output buffer if they did not change, so that
+ * the delta looks the same in all formats.
+ * For the cells that did not change, the snapshot keeps the values of
+ * the last time they were printed, so that a slow drift of the signal
+ * is reported once it adds up to the threshold.
+ */
+
+/*------------------------------------------------------------------*/
+/*
+ * Check if cell i of the scan changed enough since cell j of the
+ * previous scan (same BSSID).
+ */
+static int
+scan_delta_changed(const iw_scan_table *	cur,
+		   int				i,
+		   const iw_scan_table *	old,
+		   int				j)
+{
+  /* Some field appeared or disappeared */
+  if((cur->flags[i] ^ old->flags[j])
+     & (IW_SNAPSHOT_ESSID | IW_SNAPSHOT_ESSID_ON | IW_SNAPSHOT_FREQ
+	| IW_SNAPSHOT_CHANNEL | IW_SNAPSHOT_MODE | IW_SNAPSHOT_KEY
+	| IW_SNAPSHOT_ENCRYPTED | IW_SNAPSHOT_LEVEL | IW_SNAPSHOT_DBM))
+    return(1);
+
+  if(strcmp(cur->pool + cur->essid[i], old->pool + old->essid[j]))
+    return(1);
+  if(cur->flags[i] & IW_SNAPSHOT_CHANNEL)
+    {
+      if(abs(cur->channel[i] - old->channel[j]) >= scan_delta_channel)
+	return(1);
+    }
+  else
+    if((cur->flags[i] & IW_SNAPSHOT_FREQ) && (cur->freq[i] != old->freq[j]))
+      return(1);
+  if((cur->flags[i] & IW_SNAPSHOT_LEVEL)
+     && (abs(cur->level[i] - old->level[j]) >= scan_delta_level))
+    return(1);
+  return(0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Name of the file with the previous scan of a device. If the delta
+ * file is a directory, each device has its own file in it.
+ */
+static char *
+scan_delta_path(const char *	ifname)
+{
+  struct stat	st;
+  char *	path;
+
+  if((stat(scan_delta, &st) < 0) || !S_ISDIR(st.st_mode))
+    path = strdup(scan_delta);
+  else
+    {
+      path = malloc(strlen(scan_delta) + strlen(ifname) + 2);
+      if(path != NULL)
+	sprintf(path, "%s/%s", scan_delta, ifname);
+    }
+  if(path == NULL)
+    errno = ENOMEM;
+  return(path);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Compare the results of a scan with the previous scan of the device,
+ * and save them for the next time. The cells of the scan go in cur,
+ * the cells of the previous scan in old.
+ * Return the IWSCAN_DELTA_* of the cells of cur followed by those of
+ * old (SAME or LOST), NULL for error (in errno).
+ */
+static unsigned char *
+scan_delta_update(char *		ifname,
+		  unsigned char *	buffer,
+		  int			buflen,
+		  struct iw_range *	range,
+		  int			has_range,
+		  iw_scan_table *	cur,
+		  iw_scan_table *	old)
+{
+  wireless_scan_head	context;
+  struct wireless_scan *	wscan;
+  const iw_snapshot_cell *	cell;
+  iw_snapshot		snap;
+  char *		path;
+  unsigned char *	status = NULL;
+  int *			match = NULL;
+  int			i;
+  int			j;
+  int			err;
+
+  iw_scan_init(&context);
+  memset(&snap, 0, sizeof(snap));
+  path = scan_delta_path(ifname);
+  if((path == NULL)
+     || (iw_scan_decode(&context, (char *) buffer, buflen,
+			range->we_version_compiled) < 0)
+     || (iw_scan_table_build(cur, context.result,
+			     has_range ? range : NULL) < 0))
+    goto out;
+
+  /* Without a previous scan of this device, all cells are new */
+  old->num_cells = 0;
+  if((iw_snapshot_open(path, &snap) >= 0)
+     && !strncmp(snap.header->ifname, ifname, IFNAMSIZ)
+     && (iw_scan_table_load(old, &snap) < 0))
+    goto out;
+
+  /* Find the cells of the previous scan by BSSID */
+  status = malloc(cur->num_cells + old->num_cells + 1);
+  match = malloc((cur->num_cells + 1) * sizeof(int));
+  if((status == NULL) || (match == NULL)
+     || (iw_scan_table_match(old, cur, match) < 0))
+    {
+      free(status);
+      status = NULL;
+      errno = ENOMEM;
+      goto out;
+    }
+  memset(status + cur->num_cells, IWSCAN_DELTA_LOST, old->num_cells);
+
+  for(i = 0, wscan = context.result; i < cur->num_cells;
+      i++, wscan = wscan->next)
+    {
+      j = match[i];
+      if(j < 0)
+	{
+	  status[i] = IWSCAN_DELTA_NEW;
+	  continue;
+	}
+      cell = &snap.cells[j];
+      status[cur->num_cells + j] = IWSCAN_DELTA_SAME;
+      if(scan_delta_changed(cur, i, old, j)
+	 || (wscan->b.has_mode && (wscan->b.mode != cell->mode)))
+	{
+	  status[i] = IWSCAN_DELTA_CHANGED;
+	  continue;
+	}
+      status[i] = IWSCAN_DELTA_SAME;
+
+      /* Save what was printed last, not what we just got */
+      if(wscan->has_stats && (cell->flags & IW_SNAPSHOT_QUAL))
+	wscan->stats.qual = cell->qual;
+      if(wscan->b.has_freq)
+	{
+	  if((wscan->b.freq < KILO) && (cell->flags & IW_SNAPSHOT_CHANNEL))
+	    wscan->b.freq = cell->channel;
+	  else if((wscan->b.freq >= KILO) && (cell->flags & IW_SNAPSHOT_FREQ))
+	    wscan->b.freq = cell->freq * KILO;
+	}
+    }
+
+  /* The snapshot we have mapped stays valid after the rename */
+  if(iw_snapshot_write(path, ifname, context.result, has_range ? range : NULL,
+		       range->we_version_compiled) < 0)
+    {
+      free(status);
+      status = NULL;
+    }
+
+ out:
+  err = errno;
+  iw_snapshot_close(&snap);
+  iw_scan_release(&context);
+  free(match);
+  free(path);
+  errno = err;
+  return(status);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Terminate the current cell, and drop it from the output if it did
+ * not change. Return where the next cell starts in the output.
+ */
+static int
+print_delta_cell_end(struct iwscan_state *	state,
+		     struct iw_range *		range,
+		     int			has_range,
+		     int			cell_start)
+{
+  if(scan_format == IWSCAN_FORMAT_JSON)
+    print_json_cell_end(state);
+  else if(scan_format == IWSCAN_FORMAT_CSV)
+    print_csv_cell_end(state, range, has_range);
+
+  /* If the buffer was flushed (out of memory), part of it is gone */
+  if((state->ap_num > 1) && (scan_delta_status(state) == IWSCAN_DELTA_SAME)
+     && (out_len >= cell_start))
+    out_len = cell_start;
+  return(out_len);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Say why the cell that just started is printed.
+ */
+static void
+print_delta_mark(struct iwscan_state *	state)
+{
+  const char *	name = iwscan_delta_name[scan_delta_status(state)];
+
+  switch(scan_format)
+    {
+    case IWSCAN_FORMAT_JSON:
+      iw_out_str(",\"delta\":\"");
+      iw_out_str(name);
+      iw_out_mem("\"", 1);
+      break;
+    case IWSCAN_FORMAT_CSV:
+      /* At the end of the line */
+      break;
+    default:
+      iw_out_str("                    Delta:");
+      iw_out_str(name);
+      iw_out_mem("\n", 1);
+    }
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Print the cells of the previous scan that are gone.
+ */
+static void
+print_delta_lost(struct iwscan_state *	state,
+		 const iw_scan_table *	old,
+		 const unsigned char *	status)
+{
+  const char *	essid;
+  int		flags;
+  int		j;
+
+  for(j = 0; j < old->num_cells; j++)
+    {
+      if(status[j] != IWSCAN_DELTA_LOST)
+	continue;
+      essid = old->pool + old->essid[j];
+      flags = old->flags[j];
+      switch(scan_format)
+	{
+	case IWSCAN_FORMAT_JSON:
+	  iw_out_str("{\"interface\":");
+	  iw_out_json_str(state->ifname, strlen(state->ifname));
+	  iw_out_str(",\"address\":\"");
+	  iw_ether_ntop((const struct ether_addr *) (old->bssid + ETH_ALEN * j),
+			iw_out_reserve(18));
+	  out_len += 17;
+	  iw_out_mem("\"", 1);
+	  if(flags & IW_SNAPSHOT_ESSID)
+	    {
+	      iw_out_str(",\"essid\":");
+	      if(flags & IW_SNAPSHOT_ESSID_ON)
+		print_json_essid(essid, strlen(essid));
+	      else
+		iw_out_str("null");
+	    }
+	  if(flags & IW_SNAPSHOT_FREQ)
+	    iw_out_printf(",\"frequency\":%.0f", old->freq[j] * KILO);
+	  if(flags & IW_SNAPSHOT_CHANNEL)
+	    iw_out_printf(",\"channel\":%d", old->channel[j]);
+	  iw_out_str(",\"delta\":\"lost\"}\n");
+	  break;
+	case IWSCAN_FORMAT_CSV:
+	  /* Same columns as print_csv_cell_end(), most are empty */
+	  iw_out_csv_str(state->ifname, strlen(state->ifname));
+	  iw_out_mem(",,", 2);
+	  iw_ether_ntop((const struct ether_addr *) (old->bssid + ETH_ALEN * j),
+			iw_out_reserve(18));
+	  out_len += 17;
+	  iw_out_mem(",", 1);
+	  if(flags & IW_SNAPSHOT_ESSID_ON)
+	    iw_out_csv_str(essid, strlen(essid));
+	  iw_out_mem(",,,", 3);
+	  if(flags & IW_SNAPSHOT_FREQ)
+	    iw_out_printf("%.0f", old->freq[j] * KILO);
+	  iw_out_mem(",", 1);
+	  if(flags & IW_SNAPSHOT_CHANNEL)
+	    iw_out_uint(old->channel[j], 1);
+	  iw_out_str(",,,,,,,,,,,,,lost\n");
+	  break;
+	default:
+	  iw_out_str("          Lost    - Address: ");
+	  iw_ether_ntop((const struct ether_addr *) (old->bssid + ETH_ALEN * j),
+			iw_out_reserve(18));
+	  out_len += 17;
+	  iw_out_mem("\n", 1);
+	  if(flags & IW_SNAPSHOT_ESSID_ON)
+	    iw_out_printf("                    ESSID:\"%s\"\n", essid);
+	  else if(flags & IW_SNAPSHOT_ESSID)
+	    iw_out_str("                    ESSID:off/any/hidden\n");
+	  if(flags & IW_SNAPSHOT_CHANNEL)
+	    iw_out_printf("                    Channel:%d\n", old->channel[j]);
+	}
+    }
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Print the raw results of a scan on one device
+ */
+static void
+print_scanning_results(char *			ifname,
+		       unsigned char *		buffer,
+		       int			buflen,
+		       struct iw_range *	range,
+		       int			has_range)
+{
+  static int	csv_header = 0;		/* Once for all interfaces */
+  struct iwscan_state	state = { .ap_num = 1, .val_index = 0,
+				  .ifname = ifname };
+  iw_scan_table		cur;		/* Delta, this scan */
+  iw_scan_table		old;		/* Delta, previous scan */
+  unsigned char *	delta = NULL;
+  int			cell_start = 0;
+
+  if(scan_snapshot != NULL)
+    {
+      save_scanning_snapshot(ifname, buffer, buflen, range, has_range);
+      return;
+    }
+
+  if(scan_delta != NULL)
+    {
+      memset(&cur, 0, sizeof(cur));
+      memset(&old, 0, sizeof(old));
+      delta = scan_delta_update(ifname, buffer, buflen, range, has_range,
+				&cur, &old);
+      if(delta == NULL)
+	fprintf(stderr, "%-8.16s  Failed to update delta file %s : %s\n\n",
+		ifname, scan_delta, strerror(errno));
+      /* If we can't compare, all cells are new */
+      state.delta = delta ? delta : (const unsigned char *) "";
+      state.num_delta = delta ? cur.num_cells : 0;
+    }
+
+  if((scan_format == IWSCAN_FORMAT_CSV) && (!csv_header))
+    {
+      iw_out_str(IWSCAN_CSV_HEADER);
+      if(scan_delta != NULL)
+	iw_out_str(",delta");
+      iw_out_mem("\n", 1);
+      csv_header = 1;
+    }
+
+  if(buflen)
+    {
+      struct iw_event		iwe;
+      struct stream_descr	stream;
+      iw_event_decoder		decode;
+      int			ret;
+      
+#ifdef DEBUG
+      /* Debugging code. In theory useless, because it's debugged ;-) */
+      int	i;
+      printf("Scan result %d [%02X", buflen, buffer[0]);
+      for(i = 1; i < buflen; i++)
+	printf(":%02X", buffer[i]);
+      printf("]\n");
+#endif
+      if(scan_format == IWSCAN_FORMAT_TEXT)
+	iw_out_printf("%-8.16s  Scan completed :\n", ifname);
+      iw_init_event_stream(&stream, (char *) buffer, buflen);
+      /* Pick the decoder for this driver once, not for every token */
+      decode = iw_get_event_decoder(range->we_version_compiled);
+      do
+	{
+	  /* Extract an event and print it */
+	  ret = decode(&stream, &iwe, range->we_version_compiled);
+	  if(ret <= 0)
+	    break;
+	  /* Keep the previous cell only if it changed */
+	  if((state.delta != NULL) && (iwe.cmd == SIOCGIWAP))
+	    cell_start = print_delta_cell_end(&state, range, has_range,
+					      cell_start);
+	  switch(scan_format)
+	    {
+	    case IWSCAN_FORMAT_JSON:
+	      print_scanning_json_token(&stream, &iwe, &state,
+					range, has_range);
+	      break;
+	    case IWSCAN_FORMAT_CSV:
+	      print_scanning_csv_token(&stream, &iwe, &state,
+				       range, has_range);
+	      break;
+	    default:
+	      print_scanning_token(&stream, &iwe, &state,
+				   range, has_range);
+	    }
+	  if((state.delta != NULL) && (iwe.cmd == SIOCGIWAP))
+	    print_delta_mark(&state);
+	}
+      while(ret > 0);
+
+      /* Terminate the last cell */
+      if(state.delta != NULL)
+	print_delta_cell_end(&state, range, has_range, cell_start);
+      if(scan_format == IWSCAN_FORMAT_JSON)
+	print_json_cell_end(&state);
+      else if(scan_format == IWSCAN_FORMAT_CSV)
+	print_csv_cell_end(&state, range, has_range);
+    }
+  else
+    /* JSON and CSV just have no cell */
+    if(scan_format == IWSCAN_FORMAT_TEXT)
+      iw_out_printf("%-8.16s  No scan results\n", ifname);
+
+  /* The cells that are gone, and their memory */
+  if(scan_delta != NULL)
+    {
+      if(delta != NULL)
+	print_delta_lost(&state, &old, delta + cur.num_cells);
+      free(delta);
+      iw_scan_table_free(&cur);
+      iw_scan_table_free(&old);
+    }
+  if(scan_format == IWSCAN_FORMAT_TEXT)
+    iw_out_mem("\n", 1);
+
+  /* One write for the whole interface */
+  iw_out_flush();
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Print results of a scan saved with the 'capture' option.
+ * Those go through the same decoding as live results.
+ */
+static int
+print_scanning_replay(char *	filename)
+{
+  char			ifname[IFNAMSIZ + 1];
+  struct iw_range	range;
+  int			has_range;
+  int			we_version;
+  unsigned char *	buffer;
+  int			buflen;
+
+  if(iw_scan_capture_read(filename, ifname, &range, &has_range,
+			  &we_version, &buffer, &buflen) < 0)
+    {
+      fprintf(stderr, "Failed to read capture %s : %s\n\n",
+	      filename, strerror(errno));
+      return(-1);
+    }
+  /* The range of the capture is the reference, but without it we
+   * still need the WE version to decode */
+  if(!has_range)
+    range.we_version_compiled = we_version;
+
+  print_scanning_results(ifname, buffer, buflen, &range, has_range);
+
+  free(buffer);
+  return(0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Print the results of the scans done by others on one device, as they
+ * complete, without ever triggering a scan. Never returns, unless we
+ * can't listen.
+ */
+static int
+print_scanning_listen(int		skfd,
+		      char *		ifname,
+		      struct iw_range *	range,
+		      int		has_range)
+{
+  wireless_scan_head	context;
+  struct pollfd		pfd;
+  int			ret;
+
+  iw_scan_init(&context);
+  if(iw_scan_listen(ifname, range->we_version_compiled, &context) < 0)
+    {
+      fprintf(stderr, "%-8.16s  Can't listen to scans : %s\n\n",
+	      ifname, strerror(errno));
+      iw_scan_release(&context);
+      return(-1);
+    }
+
+  pfd.fd = iw_scan_get_fd(&context);
+  pfd.events = POLLIN;
+  while(1)
+    {
+      if(poll(&pfd, 1, -1) < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  break;
+	}
+      ret = iw_scan_handle_ready(skfd, &context);
+      if(ret == 0)
+	print_scanning_results(ifname, context.buffer, context.datalen,
+			       range, has_range);
+      else if(ret < 0)
+	/* Maybe better luck with the next scan */
+	fprintf(stderr, "%-8.16s  Failed to read scan data : %s\n\n",
+		ifname, strerror(errno));
+    }
+
+  fprintf(stderr, "%-8.16s  Can't listen to scans : %s\n\n",
+	  ifname, strerror(errno));
+  iw_scan_release(&context);
+  return(-1);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add a list of channels or frequencies (separated by commas) to the
+ * channels to scan. Frequencies may have a unit (G, M or k).
+ * Channels are below 1000 (like iw_freq_to_channel()), frequencies
+ * below 1 THz, which also rejects "inf" and "nan".
+ * Return -1 for error, 0 for success.
+ */
+static int
+scan_add_channels(struct iw_scan_req *	scanopt,
+		  char *		list,
+		  int			is_freq)
+{
+  char *	unit;
+  double	value;
+
+  do
+    {
+      value = strtod(list, &unit);
+      /* Written so that NaN fails */
+      if((unit == list) || !(value > 0))
 	{
-	  printf("\n");
-	  state->val_index = 0;
+	  fprintf(stderr, "Invalid %s [%s]\n",
+		  is_freq ? "frequency" : "channel", list);
+	  return(-1);
+	}
+      if(is_freq)
+	{
+	  if(unit[0] == 'G') { value *= GIGA; unit++; }
+	  else if(unit[0] == 'M') { value *= MEGA; unit++; }
+	  else if(unit[0] == 'k') { value *= KILO; unit++; }
+	  if(value >= KILO * GIGA)
+	    {
+	      fprintf(stderr, "Invalid frequency [%s]\n", list);
+	      return(-1);
+	    }
 	}
       else
-	state->val_index++;
-      break;
-    case SIOCGIWMODUL:
-      {
-	unsigned int	modul = event->u.param.value;
-	int		i;
-	int		n = 0;
-	printf("                    Modulations :");
-	for(i = 0; i < IW_SIZE_MODUL_LIST; i++)
+	/* Check the range before the cast, it's undefined otherwise */
+	if((value >= KILO) || (value != (int) value))
 	  {
-	    if((modul & iw_modul_list[i].mask) == iw_modul_list[i].mask)
-	      {
-		if((n++ % 8) == 7)
-		  printf("\n                        ");
-		else
-		  printf(" ; ");
-		printf("%s", iw_modul_list[i].cmd);
-	      }
+	    fprintf(stderr, "Invalid channel [%s]\n", list);
+	    return(-1);
 	  }
-	printf("\n");
-      }
-      break;
-    case IWEVQUAL:
-      iw_print_stats(buffer, sizeof(buffer),
-		     &event->u.qual, iw_range, has_range);
-      printf("                    %s\n", buffer);
-      break;
-#ifndef WE_ESSENTIAL
-    case IWEVGENIE:
-      /* Informations Elements are complex, let's do only some of them */
-      iw_print_gen_ie(event->u.data.pointer, event->u.data.length);
-      break;
-#endif	/* WE_ESSENTIAL */
-    case IWEVCUSTOM:
-      {
-	char custom[IW_CUSTOM_MAX+1];
-	if((event->u.data.pointer) && (event->u.data.length))
-	  memcpy(custom, event->u.data.pointer, event->u.data.length);
-	custom[event->u.data.length] = '\0';
-	printf("                    Extra:%s\n", custom);
-      }
-      break;
-    default:
-      printf("                    (Unknown Wireless Token 0x%04X)\n",
-	     event->cmd);
-   }	/* switch(event->cmd) */
+      if((unit[0] != ',') && (unit[0] != '\0'))
+	{
+	  fprintf(stderr, "Invalid %s [%s]\n",
+		  is_freq ? "frequency" : "channel", list);
+	  return(-1);
+	}
+      if(scanopt->num_channels >= IW_MAX_FREQUENCIES)
+	{
+	  fprintf(stderr, "Too many channels to scan (max %d)\n",
+		  IW_MAX_FREQUENCIES);
+	  return(-1);
+	}
+      /* Channels have no exponent, the driver knows the difference */
+      iw_float2freq(value, &scanopt->channel_list[scanopt->num_channels++]);
+      list = unit + 1;
+    }
+  while(unit[0] == ',');
+  return(0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Parse one dwell time, in ms, and convert it to TU (1.024 ms) for the
+ * driver, rounded up. Times beyond what 32 bits of TU can hold (about
+ * 50 days) are clamped.
+ * Return -1 for error (negative, not a number, overflow), 0 for success.
+ */
+static int
+scan_parse_dwell(char *		str,
+		 char **	end,
+		 __u32 *	tu)
+{
+  long		ms;
+
+  errno = 0;
+  ms = strtol(str, end, 10);
+  if((*end == str) || (ms < 0) || (errno == ERANGE))
+    return(-1);
+  /* 0xFFFFFFFF TU is 4398046510 ms */
+  if((long long) ms > 4398046510LL)
+    *tu = 0xFFFFFFFF;
+  else
+    *tu = ((__u64) ms * 1000 + 1023) / 1024;
+  return(0);
 }
 
 /*------------------------------------------------------------------*/
@@ -620,11 +2429,17 @@ print_scanning_info(int		skfd,
   struct iw_scan_req    scanopt;		/* Options for 'set' */
   int			scanflags = 0;		/* Flags for scan */
   unsigned char *	buffer = NULL;		/* Results */
-  int			buflen = IW_SCAN_MAX_DATA; /* Min for compat WE<17 */
+  int			buflen = scan_buflen;	/* Min for compat WE<17 */
   struct iw_range	range;
   int			has_range;
   struct timeval	tv;				/* Select timeout */
   int			timeout = 15000000;		/* 15s */
+  int			nlfd = -1;		/* Scan completion events */
+  int			ifindex = 0;
+  char *		capture = NULL;		/* File to save results */
+  char *		replay = NULL;		/* File to read results */
+  int			has_scanopt = 0;	/* Options without flag */
+  int			listen = 0;		/* Wait for scans of others */
 
   /* Avoid "Unused parameter" warning */
   args = args; count = count;
@@ -638,17 +2453,6 @@ print_scanning_info(int		skfd,
 	      IW_EV_LCP_PK2_LEN, IW_EV_POINT_PK2_LEN);
     }
 
-  /* Get range stuff */
-  has_range = (iw_get_range_info(skfd, ifname, &range) >= 0);
-
-  /* Check if the interface could support scanning. */
-  if((!has_range) || (range.we_version_compiled < 14))
-    {
-      fprintf(stderr, "%-8.16s  Interface doesn't support scanning.\n\n",
-	      ifname);
-      return(-1);
-    }
-
   /* Init timeout value -> 250ms between set and first get */
   tv.tv_sec = 0;
   tv.tv_usec = 250000;
@@ -681,15 +2485,66 @@ print_scanning_info(int		skfd,
 	  /* Store the ESSID in the scan options */
 	  scanopt.essid_len = strlen(args[0]);
 	  memcpy(scanopt.essid, args[0], scanopt.essid_len);
-	  /* Initialise BSSID as needed */
-	  if(scanopt.bssid.sa_family == 0)
-	    {
-	      scanopt.bssid.sa_family = ARPHRD_ETHER;
-	      memset(scanopt.bssid.sa_data, 0xff, ETH_ALEN);
-	    }
 	  /* Scan only this ESSID */
 	  scanflags |= IW_SCAN_THIS_ESSID;
 	}
+      else
+	/* Scan only those channels or frequencies */
+	if((!strncmp(args[0], "channel", 7)) || (!strncmp(args[0], "freq", 4)))
+	  {
+	    if(count < 1)
+	      {
+		fprintf(stderr, "Too few arguments for scanning option [%s]\n",
+			args[0]);
+		return(-1);
+	      }
+	    if(scan_add_channels(&scanopt, args[1], args[0][0] == 'f') < 0)
+	      return(-1);
+	    scanflags |= IW_SCAN_THIS_FREQ;
+	    args++;
+	    count--;
+	  }
+      else
+	/* Only listen to beacons, or send probe requests */
+	if((!strcmp(args[0], "passive")) || (!strcmp(args[0], "active")))
+	  {
+	    scanopt.scan_type = (args[0][0] == 'p') ?
+				IW_SCAN_TYPE_PASSIVE : IW_SCAN_TYPE_ACTIVE;
+	    has_scanopt = 1;
+	  }
+      else
+	/* Time on each channel, in ms */
+	if(!strncmp(args[0], "dwell", 5))
+	  {
+	    char *		end;
+	    if(count < 1)
+	      {
+		fprintf(stderr, "Too few arguments for scanning option [%s]\n",
+			args[0]);
+		return(-1);
+	      }
+	    /* MIN or MIN:MAX, the driver wants TU (1.024 ms) */
+	    if(scan_parse_dwell(args[1], &end,
+				&scanopt.min_channel_time) < 0)
+	      end = NULL;
+	    else if(end[0] == ':')
+	      {
+		if(scan_parse_dwell(end + 1, &end,
+				    &scanopt.max_channel_time) < 0)
+		  end = NULL;
+	      }
+	    else
+	      scanopt.max_channel_time = scanopt.min_channel_time;
+	    if((end == NULL) || (end[0] != '\0')
+	       || (scanopt.max_channel_time < scanopt.min_channel_time))
+	      {
+		fprintf(stderr, "Invalid dwell time [%s]\n", args[1]);
+		return(-1);
+	      }
+	    has_scanopt = 1;
+	    args++;
+	    count--;
+	  }
       else
 	/* Check for last scan result (do not trigger scan) */
 	if(!strncmp(args[0], "last", 4))
@@ -697,6 +2552,86 @@ print_scanning_info(int		skfd,
 	    /* Hack */
 	    scanflags |= IW_SCAN_HACK;
 	  }
+      else
+	/* Read the results of the scans triggered by others */
+	if(!strcmp(args[0], "listen"))
+	  listen = 1;
+      else
+	/* Save the raw results to a file, or read them from a file */
+	if((!strncmp(args[0], "capture", 7)) || (!strncmp(args[0], "replay", 6)))
+	  {
+	    if(count < 1)
+	      {
+		fprintf(stderr, "Too few arguments for scanning option [%s]\n",
+			args[0]);
+		return(-1);
+	      }
+	    if(args[0][0] == 'c')
+	      capture = args[1];
+	    else
+	      replay = args[1];
+	    args++;
+	    count--;
+	  }
+      else
+	/* Save the results for other processes */
+	if(!strcmp(args[0], "--snapshot"))
+	  {
+	    if(count < 1)
+	      {
+		fprintf(stderr, "Too few arguments for scanning option [%s]\n",
+			args[0]);
+		return(-1);
+	      }
+	    scan_snapshot = args[1];
+	    args++;
+	    count--;
+	  }
+      else
+	/* Print only the differences with the previous scan */
+	if((!strcmp(args[0], "--delta")) || (!strcmp(args[0], "--delta-level"))
+	   || (!strcmp(args[0], "--delta-channel")))
+	  {
+	    if(count < 1)
+	      {
+		fprintf(stderr, "Too few arguments for scanning option [%s]\n",
+			args[0]);
+		return(-1);
+	      }
+	    if(args[0][7] == '\0')
+	      scan_delta = args[1];
+	    else
+	      {
+		int	threshold;
+		if((sscanf(args[1], "%i", &threshold) != 1) || (threshold < 1))
+		  {
+		    fprintf(stderr, "Invalid threshold [%s]\n", args[1]);
+		    return(-1);
+		  }
+		if(args[0][8] == 'l')
+		  scan_delta_level = threshold;
+		else
+		  scan_delta_channel = threshold;
+	      }
+	    args++;
+	    count--;
+	  }
+      else
+	/* Machine readable output */
+	if(!strncmp(args[0], "--format=", 9))
+	  {
+	    if(!strcmp(args[0] + 9, "json"))
+	      scan_format = IWSCAN_FORMAT_JSON;
+	    else if(!strcmp(args[0] + 9, "csv"))
+	      scan_format = IWSCAN_FORMAT_CSV;
+	    else if(!strcmp(args[0] + 9, "text"))
+	      scan_format = IWSCAN_FORMAT_TEXT;
+	    else
+	      {
+		fprintf(stderr, "Invalid output format [%s]\n", args[0] + 9);
+		return(-1);
+	      }
+	  }
 	else
 	  {
 	    fprintf(stderr, "Invalid scanning option [%s]\n", args[0]);
@@ -707,9 +2642,42 @@ print_scanning_info(int		skfd,
       args++;
     }
 
+  /* A snapshot replaces the display, there would be no delta */
+  if((scan_snapshot != NULL) && (scan_delta != NULL))
+    {
+      fprintf(stderr, "Can't use scanning options --snapshot and --delta "
+	      "together\n");
+      return(-1);
+    }
+
+  /* Replay does not need the hardware */
+  if(replay != NULL)
+    return(print_scanning_replay(replay));
+
+  /* Get range stuff */
+  has_range = (iw_get_range_info(skfd, ifname, &range) >= 0);
+
+  /* Check if the interface could support scanning. */
+  if((!has_range) || (range.we_version_compiled < 14))
+    {
+      fprintf(stderr, "%-8.16s  Interface doesn't support scanning.\n\n",
+	      ifname);
+      return(-1);
+    }
+
+  /* Don't scan, wait for others to do it */
+  if(listen)
+    return(print_scanning_listen(skfd, ifname, &range, has_range));
+
   /* Check if we have scan options */
-  if(scanflags)
+  if(scanflags || has_scanopt)
     {
+      /* Initialise BSSID as needed */
+      if(scanopt.bssid.sa_family == 0)
+	{
+	  scanopt.bssid.sa_family = ARPHRD_ETHER;
+	  memset(scanopt.bssid.sa_data, 0xff, ETH_ALEN);
+	}
       wrq.u.data.pointer = (caddr_t) &scanopt;
       wrq.u.data.length = sizeof(scanopt);
       wrq.u.data.flags = scanflags;
@@ -729,9 +2697,17 @@ print_scanning_info(int		skfd,
     }
   else
     {
+      /* Listen to the scan completion event before triggering the scan.
+       * If we can't, the timer will do. */
+      nlfd = iw_scan_event_open();
+      ifindex = if_nametoindex(ifname);
+
       /* Initiate Scanning */
       if(iw_set_ext(skfd, ifname, SIOCSIWSCAN, &wrq) < 0)
 	{
+	  if(nlfd >= 0)
+	    close(nlfd);
+	  nlfd = -1;
 	  if((errno != EPERM) || (scanflags != 0))
 	    {
 	      fprintf(stderr, "%-8.16s  Interface doesn't support scanning : %s\n\n",
@@ -761,7 +2737,12 @@ print_scanning_info(int		skfd,
       FD_ZERO(&rfds);
       last_fd = -1;
 
-      /* In here, add the rtnetlink fd in the list */
+      /* Add the rtnetlink fd in the list */
+      if(nlfd >= 0)
+	{
+	  FD_SET(nlfd, &rfds);
+	  last_fd = nlfd;
+	}
 
       /* Wait until something happens */
       ret = select(last_fd + 1, &rfds, NULL, NULL, &tv);
@@ -772,9 +2753,22 @@ print_scanning_info(int		skfd,
 	  if(errno == EAGAIN || errno == EINTR)
 	    continue;
 	  fprintf(stderr, "Unhandled signal - exiting...\n");
+	  if(nlfd >= 0)
+	    close(nlfd);
 	  return(-1);
 	}
 
+      /* Check if the driver has signaled the end of the scan.
+       * Events for other interfaces don't count, in this case we go
+       * back to sleep, Linux has updated tv with the time left. */
+      if(ret > 0)
+	{
+	  if(iw_scan_event_check(nlfd, ifindex) == 0)
+	    continue;
+	  /* Results are ready (or we lost events), read them now */
+	  ret = 0;
+	}
+
       /* Check if there was a timeout */
       if(ret == 0)
 	{
@@ -787,6 +2781,8 @@ print_scanning_info(int		skfd,
 	    {
 	      if(buffer)
 		free(buffer);
+	      if(nlfd >= 0)
+		close(nlfd);
 	      fprintf(stderr, "%s: Allocation failed\n", __FUNCTION__);
 	      return(-1);
 	    }
@@ -798,8 +2794,10 @@ print_scanning_info(int		skfd,
 	  wrq.u.data.length = buflen;
 	  if(iw_get_ext(skfd, ifname, SIOCGIWSCAN, &wrq) < 0)
 	    {
-	      /* Check if buffer was too small (WE-17 only) */
-	      if((errno == E2BIG) && (range.we_version_compiled > 16))
+	      /* Check if buffer was too small (WE-17 only). The length of
+	       * iw_point is 16 bits, we can't go beyond 0xFFFF. */
+	      if((errno == E2BIG) && (range.we_version_compiled > 16)
+		   && (buflen < 0xFFFF))
 		{
 		  /* Some driver may return very large scan results, either
 		   * because there are many cells, or because they have many
@@ -815,6 +2813,10 @@ print_scanning_info(int		skfd,
 		  else
 		    buflen *= 2;
 
+		  /* Don't overflow the 16 bit length */
+		  if(buflen > 0xFFFF)
+		    buflen = 0xFFFF;
+
 		  /* Try again */
 		  goto realloc;
 		}
@@ -832,53 +2834,215 @@ print_scanning_info(int		skfd,
 
 	      /* Bad error */
 	      free(buffer);
+	      if(nlfd >= 0)
+		close(nlfd);
 	      fprintf(stderr, "%-8.16s  Failed to read scan data : %s\n\n",
 		      ifname, strerror(errno));
 	      return(-2);
 	    }
 	  else
-	    /* We have the results, go to process them */
-	    break;
+	    {
+	      /* We have the results, go to process them */
+	      scan_buflen = buflen;
+	      break;
+	    }
+	}
+    }
+
+  /* No need for events anymore */
+  if(nlfd >= 0)
+    close(nlfd);
+
+  /* Save the raw results, before we try to make sense of them */
+  if((capture != NULL)
+     && (iw_scan_capture_write(capture, ifname, &range,
+			       range.we_version_compiled,
+			       buffer, wrq.u.data.length) < 0))
+    fprintf(stderr, "%-8.16s  Failed to write capture to %s : %s\n",
+	    ifname, capture, strerror(errno));
+
+  print_scanning_results(ifname, buffer, wrq.u.data.length,
+			 &range, has_range);
+
+  free(buffer);
+  return(0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add one device to the list of scans to do.
+ * Called through iw_enum_devices().
+ */
+static int
+add_scanning_job(int		skfd,
+		 char *		ifname,
+		 char *		args[],		/* Command line args */
+		 int		count)		/* Args count */
+{
+  struct iwscan_job *	job;
+  struct iwscan_job **	tail;
+
+  /* Avoid "Unused parameter" warning */
+  args = args; count = count;
+
+  job = calloc(1, sizeof(struct iwscan_job));
+  if(job == NULL)
+    {
+      fprintf(stderr, "%s: Allocation failed\n", __FUNCTION__);
+      return(-1);
+    }
+  strncpy(job->ifname, ifname, IFNAMSIZ);
+  job->has_range = (iw_get_range_info(skfd, ifname, &job->range) >= 0);
+  job->status = 1;
+
+  /* Keep the order of the devices */
+  for(tail = &scan_jobs; *tail != NULL; tail = &((*tail)->next))
+    ;
+  *tail = job;
+  return(0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Print the result of a scan on one device
+ */
+static void
+print_scanning_job(struct iwscan_job *	job)
+{
+  if(job->status == 2)
+    fprintf(stderr, "%-8.16s  Interface doesn't support scanning.\n\n",
+	    job->ifname);
+  else if(job->status == 3)
+    fprintf(stderr, "%-8.16s  Interface doesn't support scanning : %s\n\n",
+	    job->ifname, strerror(job->error));
+  else if(job->status < 0)
+    fprintf(stderr, "%-8.16s  Failed to read scan data : %s\n\n",
+	    job->ifname, strerror(job->error));
+  else
+    print_scanning_results(job->ifname, job->context.buffer,
+			   job->context.datalen,
+			   &job->range, job->has_range);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Perform a scanning on all devices.
+ * Rather than waiting for each device in turn, we trigger all the
+ * scans first, and collect the results as they come. The results are
+ * still printed in the order of the devices.
+ */
+static void
+print_scanning_all(int		skfd)
+{
+  struct iwscan_job *	job;
+  struct iwscan_job *	next;
+  struct iwscan_job *	printed;	/* Next job to print */
+  struct iwscan_job **	jobs;		/* Jobs being polled */
+  struct pollfd *	pfds;
+  struct iwscan_job *	one_job;	/* If we can't poll them all */
+  struct pollfd		one_pfd;
+  int			max_poll;
+  int			pending = 0;
+  int			n;
+  int			i;
+
+  /* Get the list of devices */
+  iw_enum_devices(skfd, add_scanning_job, NULL, 0);
+
+  /* Trigger all the scans */
+  for(job = scan_jobs; job != NULL; job = job->next)
+    {
+      /* Check if the interface could support scanning. */
+      if((!job->has_range) || (job->range.we_version_compiled < 14))
+	{
+	  job->status = 2;
+	  continue;
+	}
+      job->context.buf_hint = scan_buflen;
+      if(iw_scan_start(skfd, job->ifname, job->range.we_version_compiled,
+		       &job->context) < 0)
+	{
+	  job->status = 3;
+	  job->error = errno;
 	}
+      else
+	pending++;
+    }
 
-      /* In here, check if event and event type
-       * if scan event, read results. All errors bad & no reset timeout */
+  jobs = malloc((pending + 1) * sizeof(struct iwscan_job *));
+  pfds = malloc((pending + 1) * sizeof(struct pollfd));
+  max_poll = pending;
+  if((jobs == NULL) || (pfds == NULL))
+    {
+      /* Don't lose the scans, wait for them one at a time, in the
+       * order we print them */
+      free(jobs);
+      free(pfds);
+      jobs = &one_job;
+      pfds = &one_pfd;
+      max_poll = 1;
     }
 
-  if(wrq.u.data.length)
+  /* Collect results, print them in order as soon as we can */
+  printed = scan_jobs;
+  while(1)
     {
-      struct iw_event		iwe;
-      struct stream_descr	stream;
-      struct iwscan_state	state = { .ap_num = 1, .val_index = 0 };
-      int			ret;
-      
-#ifdef DEBUG
-      /* Debugging code. In theory useless, because it's debugged ;-) */
-      int	i;
-      printf("Scan result %d [%02X", wrq.u.data.length, buffer[0]);
-      for(i = 1; i < wrq.u.data.length; i++)
-	printf(":%02X", buffer[i]);
-      printf("]\n");
-#endif
-      printf("%-8.16s  Scan completed :\n", ifname);
-      iw_init_event_stream(&stream, (char *) buffer, wrq.u.data.length);
-      do
+      while((printed != NULL) && (printed->status != 1))
 	{
-	  /* Extract an event and print it */
-	  ret = iw_extract_event_stream(&stream, &iwe,
-					range.we_version_compiled);
-	  if(ret > 0)
-	    print_scanning_token(&stream, &iwe, &state,
-				 &range, has_range);
+	  print_scanning_job(printed);
+	  printed = printed->next;
 	}
-      while(ret > 0);
-      printf("\n");
+      if(pending == 0)
+	break;
+
+      /* Wait on all the scans still running (or on the first) */
+      n = 0;
+      for(job = scan_jobs; (job != NULL) && (n < max_poll); job = job->next)
+	if(job->status == 1)
+	  {
+	    pfds[n].fd = iw_scan_get_fd(&job->context);
+	    pfds[n].events = POLLIN;
+	    jobs[n++] = job;
+	  }
+      if(poll(pfds, n, -1) < 0)
+	{
+	  if(errno == EAGAIN || errno == EINTR)
+	    continue;
+	  fprintf(stderr, "Unhandled signal - exiting...\n");
+	  break;
+	}
+
+      for(i = 0; i < n; i++)
+	if(pfds[i].revents)
+	  {
+	    job = jobs[i];
+	    /* The results of the devices done so far give the size */
+	    job->context.buf_hint = scan_buflen;
+	    job->status = iw_scan_handle_ready(skfd, &job->context);
+	    if(job->status <= 0)
+	      {
+		job->error = errno;
+		pending--;
+	      }
+	    else
+	      job->status = 1;
+	    if((job->status == 0) && (job->context.buflen > scan_buflen))
+	      scan_buflen = job->context.buflen;
+	  }
     }
-  else
-    printf("%-8.16s  No scan results\n\n", ifname);
 
-  free(buffer);
-  return(0);
+  if(jobs != &one_job)
+    {
+      free(jobs);
+      free(pfds);
+    }
+  for(job = scan_jobs; job != NULL; job = next)
+    {
+      next = job->next;
+      iw_scan_release(&job->context);
+      free(job);
+    }
+  scan_jobs = NULL;
 }
 
 /*********************** FREQUENCIES/CHANNELS ***********************/
@@ -1955,7 +4119,10 @@ print_gen_ie_info(int		skfd,
       if(wrq.u.data.length == 0)
 	printf("          empty generic IE\n");
       else
-	iw_print_gen_ie(buf, wrq.u.data.length);
+	{
+	  iw_print_gen_ie(buf, wrq.u.data.length);
+	  iw_out_flush();
+	}
       printf("\n");
     }
   return(0);
@@ -2052,7 +4219,7 @@ typedef struct iwlist_entry {
 } iwlist_cmd;
 
 static const struct iwlist_entry iwlist_cmds[] = {
-  { "scanning",		print_scanning_info,	-1, "[essid NNN] [last]" },
+  { "scanning",		print_scanning_info,	-1, "[essid NNN] [channel N,...] [freq F,...] [passive|active] [dwell MIN[:MAX]] [last] [listen] [capture FILE] [replay FILE] [--format=json|csv] [--snapshot FILE] [--delta FILE [--delta-level N] [--delta-channel N]]" },
   { "frequency",	print_freq_info,	0, NULL },
   { "channel",		print_freq_info,	0, NULL },
   { "bitrate",		print_bitrate_info,	0, NULL },
@@ -2159,6 +4326,7 @@ main(int	argc,
   char **args;			/* Command arguments */
   int count;			/* Number of arguments */
   const iwlist_cmd *iwcmd;
+  const char *env;		/* IW_TRANSPORT */
 
   if(argc < 2)
     iw_usage(1);
@@ -2204,11 +4372,21 @@ main(int	argc,
       return -1;
     }
 
+  /* The library silently ignores the transports it doesn't have */
+  env = getenv("IW_TRANSPORT");
+  if((env != NULL) && (iw_current_transport == NULL) && strcmp(env, "kernel"))
+    fprintf(stderr, "iwlist: unknown transport `%s', using the kernel\n",
+	    env);
+
   /* do the actual work */
   if (dev)
     (*iwcmd->fn)(skfd, dev, args, count);
   else
-    iw_enum_devices(skfd, iwcmd->fn, args, count);
+    if(iwcmd->fn == print_scanning_info)
+      /* Scan all devices in parallel, much faster */
+      print_scanning_all(skfd);
+    else
+      iw_enum_devices(skfd, iwcmd->fn, args, count);
 
   /* Close the socket. */
   iw_sockets_close(skfd);
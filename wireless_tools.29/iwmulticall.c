@@ -14,6 +14,9 @@
 
 /***************************** INCLUDES *****************************/
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	/* secure_getenv, in iwlib.c */
+#endif
 #include <libgen.h>	/* Basename */
 
 /**************************** PROTOTYPES ****************************/
@@ -57,6 +60,9 @@ extern int
 
 /* We need the library */
 #include "iwlib.c"
+#ifdef IW_SIM
+#include "iwsim.c"
+#endif	/* IW_SIM */
 
 /* Get iwconfig in there. Mandatory. */
 #define main(args...) main_iwconfig(args)
@@ -0,0 +1,524 @@
+/*
+ *	Wireless Tools
+ *
+ * Main code for "iwscangen". Generate synthetic scan results, to stress
+ * and benchmark the decoding of scan results without hardware.
+ *
+ * The results can be written in a capture file, to be decoded and
+ * displayed with "iwlist replay FILE", or decoded in place with
+ * increasing number of cells, to check that decoding scales linearly.
+ * The same generator backs the simulated driver (IW_TRANSPORT=sim).
+ *
+ * This file is released under the GPL license.
+ */
+
+/***************************** INCLUDES *****************************/
+
+#include "iwlib.h"		/* Header */
+
+#include <getopt.h>
+#include <sys/time.h>
+
+#ifndef WE_ESSENTIAL
+
+/************************ CONSTANTS & MACROS ************************/
+
+/* Number of events to decode for each measure, to get stable numbers */
+#define BENCH_EVENTS		2000000
+/* Per cell cost between the smallest and largest run that we tolerate
+ * before calling it non linear */
+#define BENCH_MAX_RATIO		4
+
+/************************ ALLOCATION COUNT ************************/
+/*
+ * To show what the iterator saves, we count the allocations done by
+ * the decoding (including those done inside libiw). With glibc, our
+ * malloc() replaces the one of the C library for the whole program,
+ * and just count calls before going to the real one.
+ */
+
+#ifdef __GLIBC__
+extern void *	__libc_malloc(size_t	size);
+extern void *	__libc_calloc(size_t	nmemb,
+			      size_t	size);
+extern void *	__libc_realloc(void *	ptr,
+			       size_t	size);
+
+/* Number of malloc(), calloc() and realloc() */
+static unsigned long	bench_allocs = 0;
+
+void *
+malloc(size_t	size)
+{
+  bench_allocs++;
+  return(__libc_malloc(size));
+}
+
+void *
+calloc(size_t	nmemb,
+       size_t	size)
+{
+  bench_allocs++;
+  return(__libc_calloc(nmemb, size));
+}
+
+void *
+realloc(void *	ptr,
+	size_t	size)
+{
+  bench_allocs++;
+  return(__libc_realloc(ptr, size));
+}
+
+#define BENCH_ALLOCS()		((double) bench_allocs)
+#else	/* __GLIBC__ */
+/* Not counted, printed as "nan" */
+#define BENCH_ALLOCS()		(0.0 / 0.0)
+#endif	/* __GLIBC__ */
+
+/*************************** BENCHMARK ***************************/
+
+/*------------------------------------------------------------------*/
+/*
+ * Time elapsed since start, in ns.
+ */
+static double
+bench_elapsed(struct timeval *	start)
+{
+  struct timeval	now;
+
+  gettimeofday(&now, NULL);
+  return(((now.tv_sec - start->tv_sec) * 1000000.0
+	  + (now.tv_usec - start->tv_usec)) * 1000.0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Decode the same results a few times, first with the raw event
+ * decoder, then into a list of wireless_scan, and finally decode the
+ * IEs of all the cells, or just look up a few of them in an index.
+ * Return the cost per cell of the list, in ns, or -1 on error.
+ */
+static double
+bench_run(iw_sim_scan_config *	config,
+	  int			we_version)
+{
+  wireless_scan_head	context;
+  struct stream_descr	stream;
+  struct iw_event	iwe;
+  struct timeval	start;
+  char *		buffer;
+  int			len;
+  int			events;
+  int			reps;
+  int			i;
+  double		stream_ns;
+  double		decode_ns;
+  double		ies_ns;
+  double		index_ns;
+  iw_ie_info		info;
+  iw_ie_index		index;
+  wireless_scan *	wscan;
+  int			found = 0;
+  int			j;
+
+  len = iw_sim_scan_generate(config, NULL, 0);
+  buffer = malloc(len > 0 ? len : 1);
+  if(buffer == NULL)
+    return(-1);
+  len = iw_sim_scan_generate(config, buffer, len);
+
+  /* Count the events, and check that they are all valid */
+  events = 0;
+  iw_init_event_stream(&stream, buffer, len);
+  while((i = iw_extract_event_stream(&stream, &iwe, we_version)) > 0)
+    events++;
+  if(i < 0)
+    {
+      fprintf(stderr, "%d cells : invalid event after %d events\n",
+	      config->num_cells, events);
+      free(buffer);
+      return(-1);
+    }
+  reps = (events > 0) ? 1 + BENCH_EVENTS / events : 1;
+
+  /* Raw events */
+  gettimeofday(&start, NULL);
+  for(i = 0; i < reps; i++)
+    {
+      iw_init_event_stream(&stream, buffer, len);
+      while(iw_extract_event_stream(&stream, &iwe, we_version) > 0)
+	;
+    }
+  stream_ns = bench_elapsed(&start) / reps;
+
+  /* List of cells, the memory is reused between runs */
+  iw_scan_init(&context);
+  gettimeofday(&start, NULL);
+  for(i = 0; i < reps; i++)
+    if(iw_scan_decode(&context, buffer, len, we_version) < 0)
+      {
+	perror("iw_scan_decode");
+	break;
+      }
+  decode_ns = bench_elapsed(&start) / reps;
+
+  /* IEs of the cells of the last run */
+  gettimeofday(&start, NULL);
+  for(i = 0; i < reps; i++)
+    for(wscan = context.result; wscan != NULL; wscan = wscan->next)
+      iw_scan_parse_ies(wscan, &info);
+  ies_ns = bench_elapsed(&start) / reps;
+
+  /* Index of the IEs, and what a roaming daemon would look for.
+   * Counting what we find keeps the compiler from dropping lookups */
+  gettimeofday(&start, NULL);
+  for(i = 0; i < reps; i++)
+    for(wscan = context.result; wscan != NULL; wscan = wscan->next)
+      for(j = 0; j < wscan->num_genie; j++)
+	{
+	  iw_ie_index_build(&index,
+			    (const unsigned char *) wscan->genie[j].data,
+			    wscan->genie[j].len);
+	  found += (iw_ie_find(&index, 0x30) != NULL)
+		   + (iw_ie_find(&index, 0x2d) != NULL)
+		   + (iw_ie_find_vendor(&index, 0x0050f2, 1) != NULL);
+	}
+  index_ns = bench_elapsed(&start) / reps;
+  iw_scan_release(&context);
+  free(buffer);
+
+  printf("%8d %10d %9d %12.1f %12.1f %12.1f %12.1f %12.1f\n",
+	 config->num_cells, len, events, stream_ns / events,
+	 stream_ns / config->num_cells, decode_ns / config->num_cells,
+	 ies_ns / config->num_cells, index_ns / config->num_cells);
+  return(decode_ns / config->num_cells);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Decode the same results with the iterator (cell views, every event
+ * of the cells decoded in place), and into a list of wireless_scan,
+ * with a new context each time and with a context that is reused.
+ * Print the time and the number of allocations per cell of each.
+ * Return the cost per cell of the iterator, in ns, or -1 on error.
+ */
+static double
+bench_iter_run(iw_sim_scan_config *	config,
+	       int			we_version)
+{
+  wireless_scan_head	context;
+  iw_scan_iter		iter;
+  iw_scan_cell		cell;
+  struct stream_descr	stream;
+  struct iw_event	iwe;
+  struct timeval	start;
+  char *		buffer;
+  int			len;
+  int			cells;
+  int			reps;
+  int			i;
+  double		allocs;
+  double		iter_ns;
+  double		iter_allocs;
+  double		list_ns;
+  double		list_allocs;
+  double		reuse_ns;
+  double		reuse_allocs;
+
+  len = iw_sim_scan_generate(config, NULL, 0);
+  buffer = malloc(len > 0 ? len : 1);
+  if(buffer == NULL)
+    return(-1);
+  len = iw_sim_scan_generate(config, buffer, len);
+  reps = 1 + BENCH_EVENTS / (config->num_cells * 20);
+
+  /* Iterator, all the events of each cell */
+  cells = 0;
+  allocs = BENCH_ALLOCS();
+  gettimeofday(&start, NULL);
+  for(i = 0; i < reps; i++)
+    {
+      iw_scan_iter_init(&iter, buffer, len, we_version);
+      while(iw_scan_iter_next_cell(&iter, &cell) > 0)
+	{
+	  iw_init_event_stream(&stream, cell.data, cell.len);
+	  while(iter.decode(&stream, &iwe, iter.we_version) > 0)
+	    ;
+	  cells++;
+	}
+    }
+  iter_ns = bench_elapsed(&start) / reps;
+  iter_allocs = (BENCH_ALLOCS() - allocs) / reps;
+  if(cells != reps * config->num_cells)
+    {
+      fprintf(stderr, "%d cells : iterator found %d cells\n",
+	      config->num_cells, cells / reps);
+      free(buffer);
+      return(-1);
+    }
+
+  /* List of cells, in a new context each time */
+  allocs = BENCH_ALLOCS();
+  gettimeofday(&start, NULL);
+  for(i = 0; i < reps; i++)
+    {
+      iw_scan_init(&context);
+      if(iw_scan_decode(&context, buffer, len, we_version) < 0)
+	perror("iw_scan_decode");
+      iw_scan_release(&context);
+    }
+  list_ns = bench_elapsed(&start) / reps;
+  list_allocs = (BENCH_ALLOCS() - allocs) / reps;
+
+  /* List of cells, the memory is reused between runs */
+  iw_scan_init(&context);
+  iw_scan_decode(&context, buffer, len, we_version);
+  allocs = BENCH_ALLOCS();
+  gettimeofday(&start, NULL);
+  for(i = 0; i < reps; i++)
+    if(iw_scan_decode(&context, buffer, len, we_version) < 0)
+      {
+	perror("iw_scan_decode");
+	break;
+      }
+  reuse_ns = bench_elapsed(&start) / reps;
+  reuse_allocs = (BENCH_ALLOCS() - allocs) / reps;
+  iw_scan_release(&context);
+  free(buffer);
+
+  printf("%8d %10d %12.1f %12.3f %12.1f %12.3f %12.1f %12.3f\n",
+	 config->num_cells, len,
+	 iter_ns / config->num_cells, iter_allocs / config->num_cells,
+	 list_ns / config->num_cells, list_allocs / config->num_cells,
+	 reuse_ns / config->num_cells, reuse_allocs / config->num_cells);
+  return(iter_ns / config->num_cells);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Benchmark decoding from 10 cells up to the requested number of
+ * cells, by decades. The cost per cell should stay flat, if it grows
+ * with the number of cells somebody introduced a quadratic algorithm.
+ * With iter, compare the iterator with the list of cells instead.
+ * Return 0 if decoding looks linear.
+ */
+static int
+bench_scaling(iw_sim_scan_config *	config,
+	      int			we_version,
+	      int			iter)
+{
+  int		max_cells = config->num_cells;
+  int		cells;
+  double	first = -1;
+  double	cost = -1;
+
+  if(iter)
+    printf("   cells      bytes ns/cell(iter) allocs/cell ns/cell(list) allocs/cell ns/cell(reuse) allocs/cell\n");
+  else
+    printf("   cells      bytes    events ns/event(raw) ns/cell(raw) ns/cell(list) ns/cell(IEs) ns/cell(idx)\n");
+  for(cells = 10; ; cells *= 10)
+    {
+      config->num_cells = (cells < max_cells) ? cells : max_cells;
+      if(iter)
+	cost = bench_iter_run(config, we_version);
+      else
+	cost = bench_run(config, we_version);
+      if(cost < 0)
+	return(-1);
+      if(first < 0)
+	first = cost;
+      if(config->num_cells == max_cells)
+	break;
+    }
+
+  if(cost > first * BENCH_MAX_RATIO)
+    {
+      fprintf(stderr, "Decoding doesn't scale : %.1f ns/cell for %d cells, %.1f ns/cell for %d cells\n",
+	      first, 10, cost, max_cells);
+      return(-1);
+    }
+  return(0);
+}
+
+/******************************* MAIN *******************************/
+
+/* ---------------------------------------------------------------- */
+/*
+ * helper ;-)
+ */
+static void
+iw_usage(int status)
+{
+  fputs("Usage: iwscangen [OPTIONS] [FILE]\n"
+	"   Generate synthetic scan results, and write them in FILE\n"
+	"   (see iwlist replay) or benchmark their decoding.\n"
+	"   Options are:\n"
+	"     -n,--cells N       Number of cells.\n"
+	"     -e,--essid-len N   Length of ESSIDs, -1 for a mix.\n"
+	"     -r,--rates N       Bitrates per cell.\n"
+	"     -c,--custom N      IWEVCUSTOM per cell.\n"
+	"     -l,--custom-len N  Length of IWEVCUSTOM.\n"
+	"     -i,--ies MASK      Information elements (0xFF for all).\n"
+	"     -p,--compat        32 bits userspace on 64 bits kernel layout.\n"
+	"     -b,--bench         Benchmark decoding, from 10 to N cells.\n"
+	"     -t,--iter          With --bench, time and count allocations\n"
+	"                        of the iterator and of the list of cells.\n"
+	"     -h,--help          Print this message.\n"
+	"     -v,--version       Show version of this program.\n",
+	status ? stderr : stdout);
+  exit(status);
+}
+/* Command line options */
+static const struct option long_opts[] = {
+  { "cells", required_argument, NULL, 'n' },
+  { "essid-len", required_argument, NULL, 'e' },
+  { "rates", required_argument, NULL, 'r' },
+  { "custom", required_argument, NULL, 'c' },
+  { "custom-len", required_argument, NULL, 'l' },
+  { "ies", required_argument, NULL, 'i' },
+  { "compat", no_argument, NULL, 'p' },
+  { "bench", no_argument, NULL, 'b' },
+  { "iter", no_argument, NULL, 't' },
+  { "help", no_argument, NULL, 'h' },
+  { "version", no_argument, NULL, 'v' },
+  { NULL, 0, NULL, 0 }
+};
+
+/* ---------------------------------------------------------------- */
+/*
+ * main body of the program
+ */
+int
+main(int	argc,
+     char *	argv[])
+{
+  iw_sim_scan_config	config;
+  struct iw_range	range;
+  int			has_range;
+  int			bench = 0;
+  int			iter = 0;
+  int			we_version;
+  char *		buffer;
+  int			len;
+  int			opt;
+
+  /* Defaults, from the environment (same as the simulated driver) */
+  iw_sim_scan_config_init(&config);
+
+  /* Check command line options */
+  while((opt = getopt_long(argc, argv, "n:e:r:c:l:i:pbthv",
+			   long_opts, NULL)) > 0)
+    {
+      switch(opt)
+	{
+	case 'n':
+	  config.num_cells = strtol(optarg, NULL, 0);
+	  break;
+	case 'e':
+	  config.essid_len = strtol(optarg, NULL, 0);
+	  break;
+	case 'r':
+	  config.num_bitrates = strtol(optarg, NULL, 0);
+	  break;
+	case 'c':
+	  config.num_custom = strtol(optarg, NULL, 0);
+	  break;
+	case 'l':
+	  config.custom_len = strtol(optarg, NULL, 0);
+	  break;
+	case 'i':
+	  config.ies = strtol(optarg, NULL, 0);
+	  break;
+	case 'p':
+	  config.compat = 1;
+	  break;
+	case 'b':
+	  bench = 1;
+	  break;
+	case 't':
+	  iter = 1;
+	  break;
+
+	case 'h':
+	  iw_usage(0);
+	  break;
+
+	case 'v':
+	  return(iw_print_version_info("iwscangen"));
+	  break;
+
+	default:
+	  iw_usage(1);
+	  break;
+	}
+    }
+  if((config.num_cells < 1) || (config.essid_len < -1)
+     || (config.essid_len > IW_ESSID_MAX_SIZE)
+     || (config.num_bitrates < 0) || (config.num_bitrates > IW_MAX_BITRATES)
+     || (config.num_custom < 0) || (config.num_custom > 8)
+     || (config.custom_len < 0) || (config.custom_len > IW_CUSTOM_MAX)
+     || (config.ies & ~IW_SIM_IE_ALL))
+    {
+      fputs("Invalid parameters.\n", stderr);
+      iw_usage(1);
+    }
+  if((bench && (optind != argc)) || (!bench && (optind != (argc - 1)))
+     || (iter && !bench))
+    iw_usage(1);
+
+  /* The 32-on-64 layout is the one of WE-21 */
+  we_version = config.compat ? 21 : WE_VERSION;
+
+  if(bench)
+    return(bench_scaling(&config, we_version, iter) < 0);
+
+  /* Take the range of the simulated driver, so that the results are
+   * displayed as they would be from the driver */
+  iw_set_transport(&iw_sim_transport);
+  iw_sim_set_scan_config(&config);
+  has_range = (iw_get_range_info(-1, "sim0", &range) >= 0);
+
+  /* Generate the results, and save them */
+  len = iw_sim_scan_generate(&config, NULL, 0);
+  buffer = malloc(len > 0 ? len : 1);
+  if(buffer == NULL)
+    {
+      perror("malloc");
+      return(1);
+    }
+  len = iw_sim_scan_generate(&config, buffer, len);
+  if(iw_scan_capture_write(argv[optind], "sim0",
+			   has_range ? &range : NULL, we_version,
+			   (unsigned char *) buffer, len) < 0)
+    {
+      fprintf(stderr, "Can't write `%s' : %s\n", argv[optind],
+	      strerror(errno));
+      free(buffer);
+      return(1);
+    }
+  fprintf(stderr, "%d cells, %d bytes, written to `%s'\n",
+	  config.num_cells, len, argv[optind]);
+  free(buffer);
+
+  return(0);
+}
+
+#else	/* WE_ESSENTIAL */
+
+/* ---------------------------------------------------------------- */
+/*
+ * The generator is not part of the essential library.
+ */
+int
+main(int	argc,
+     char *	argv[])
+{
+  /* Avoid "Unused parameter" warning */
+  argc = argc; argv = argv;
+
+  fputs("iwscangen : not available in WE_ESSENTIAL builds.\n", stderr);
+  return(1);
+}
+
+#endif	/* WE_ESSENTIAL */
@@ -0,0 +1,912 @@
+/*
+ *	Wireless Tools
+ *
+ * Simulated driver. It answers the Wireless Extension requests from
+ * within the process, so that the tools can be run and benchmarked
+ * without any wireless hardware (and without root).
+ *
+ * Select it with the environment variable IW_TRANSPORT=sim, or with
+ * iw_set_transport(&iw_sim_transport). The number of simulated
+ * interfaces (sim0, sim1...) is taken from IW_SIM_IFACES (default 1),
+ * and the shape of the scan results from IW_SIM_CELLS and friends
+ * (see iw_sim_scan_config_init()).
+ *
+ * The scan generator is also available on its own, to stress the
+ * decoding of scan results (see iwscangen).
+ *
+ * This file is released under the GPL license.
+ */
+
+/***************************** INCLUDES *****************************/
+
+#include "iwlib.h"		/* Header */
+#include <stddef.h>		/* offsetof */
+#include <limits.h>		/* INT_MAX */
+
+#ifndef WE_ESSENTIAL
+
+/************************ CONSTANTS & MACROS ************************/
+
+#define IW_SIM_MAX_IFACES	16
+#define IW_SIM_NUM_CHANNELS	13
+#define IW_SIM_NUM_BITRATES	12
+#define IW_SIM_MAX_IES		256	/* All IW_SIM_IE_XXX fit in there */
+#define IW_SIM_MAX_CELL		4096	/* Largest cell we can generate */
+
+/* Layout of events of a 64 bits kernel before WE-22, as seen by
+ * 32 bits userspace : header padded to 8, pointer in iw_point */
+#define IW_SIM_COMPAT_LCP_LEN	8
+#define IW_SIM_COMPAT_POINT_LEN	16
+
+/****************************** TYPES ******************************/
+
+/*
+ * State of a simulated interface. Whatever is set is read back.
+ */
+typedef struct iw_sim_iface
+{
+  char		name[IFNAMSIZ + 1];
+  char		essid[IW_ESSID_MAX_SIZE + 1];
+  int		essid_on;
+  char		nickname[IW_ESSID_MAX_SIZE + 1];
+  struct iw_freq	freq;
+  int		mode;
+  sockaddr	ap_addr;
+  iwparam	nwid;
+  iwparam	bitrate;
+  iwparam	txpower;
+  iwparam	sens;
+  iwparam	rts;
+  iwparam	frag;
+  iwparam	retry;
+  iwparam	power;
+  int		spy_number;
+  sockaddr	spy_addr[IW_MAX_SPY];
+  unsigned int	scan_seq;		/* Number of scans done */
+  unsigned int	scan_channels;		/* Bit n for channel n, 0 = all */
+} iw_sim_iface;
+
+/*
+ * Requests that just set/get an iwparam in the interface
+ */
+typedef struct iw_sim_param
+{
+  int		set;		/* SIOCSIWxxx */
+  int		get;		/* SIOCGIWxxx */
+  size_t	offset;		/* Offset in struct iw_sim_iface */
+} iw_sim_param;
+
+/**************************** VARIABLES ****************************/
+
+static iw_sim_iface	iw_sim_ifaces[IW_SIM_MAX_IFACES];
+static int		iw_sim_num_ifaces = -1;		/* Not initialised */
+static iw_sim_scan_config	iw_sim_config;
+
+static const iw_sim_param	iw_sim_params[] = {
+  { SIOCSIWNWID,	SIOCGIWNWID,	offsetof(iw_sim_iface, nwid) },
+  { SIOCSIWRATE,	SIOCGIWRATE,	offsetof(iw_sim_iface, bitrate) },
+  { SIOCSIWTXPOW,	SIOCGIWTXPOW,	offsetof(iw_sim_iface, txpower) },
+  { SIOCSIWSENS,	SIOCGIWSENS,	offsetof(iw_sim_iface, sens) },
+  { SIOCSIWRTS,		SIOCGIWRTS,	offsetof(iw_sim_iface, rts) },
+  { SIOCSIWFRAG,	SIOCGIWFRAG,	offsetof(iw_sim_iface, frag) },
+  { SIOCSIWRETRY,	SIOCGIWRETRY,	offsetof(iw_sim_iface, retry) },
+  { SIOCSIWPOWER,	SIOCGIWPOWER,	offsetof(iw_sim_iface, power) },
+};
+#define IW_SIM_NUM_PARAMS	(sizeof(iw_sim_params) / sizeof(iw_sim_params[0]))
+
+static const int	iw_sim_bitrates[IW_SIM_NUM_BITRATES] = {
+  1000000, 2000000, 5500000, 11000000, 6000000, 9000000,
+  12000000, 18000000, 24000000, 36000000, 48000000, 54000000,
+};
+
+/************************ SIMULATED INTERFACES ************************/
+
+/*------------------------------------------------------------------*/
+/*
+ * Read a number from the environment.
+ */
+static int
+iw_sim_getenv(const char *	name,
+	      int		defval,
+	      int		minval,
+	      int		maxval)
+{
+  char *	value = getenv(name);
+  int		num;
+
+  if(value == NULL)
+    return(defval);
+  num = strtol(value, NULL, 0);
+  if(num < minval)
+    return(defval);
+  return(num > maxval ? maxval : num);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Create the simulated interfaces, the first time we need them.
+ */
+static void
+iw_sim_init(void)
+{
+  iw_sim_iface *	iface;
+  int			i;
+
+  if(iw_sim_num_ifaces >= 0)
+    return;
+
+  iw_sim_num_ifaces = iw_sim_getenv("IW_SIM_IFACES", 1, 0,
+				     IW_SIM_MAX_IFACES);
+  iw_sim_scan_config_init(&iw_sim_config);
+
+  for(i = 0; i < iw_sim_num_ifaces; i++)
+    {
+      iface = &iw_sim_ifaces[i];
+      memset(iface, 0, sizeof(iw_sim_iface));
+      snprintf(iface->name, sizeof(iface->name), "sim%d", i);
+      strcpy(iface->essid, "simulated");
+      iface->essid_on = 1;
+      strcpy(iface->nickname, iface->name);
+      iface->freq.m = 2412 + 5 * (i % IW_SIM_NUM_CHANNELS);
+      iface->freq.e = 6;
+      iface->mode = IW_MODE_INFRA;
+      iface->ap_addr.sa_family = ARPHRD_ETHER;
+      iface->ap_addr.sa_data[0] = 0x02;
+      iface->ap_addr.sa_data[5] = i;
+      iface->nwid.disabled = 1;
+      iface->bitrate.value = 54000000;
+      iface->txpower.value = 20;
+      iface->txpower.flags = IW_TXPOW_DBM;
+      iface->sens.value = -85;
+      iface->rts.disabled = 1;
+      iface->rts.value = 2347;
+      iface->frag.disabled = 1;
+      iface->frag.value = 2346;
+      iface->retry.value = 7;
+      iface->retry.flags = IW_RETRY_LIMIT;
+      iface->power.disabled = 1;
+    }
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Find a simulated interface by name.
+ */
+static iw_sim_iface *
+iw_sim_get_iface(const char *	ifname)
+{
+  int	i;
+
+  iw_sim_init();
+  for(i = 0; i < iw_sim_num_ifaces; i++)
+    if(!strncmp(iw_sim_ifaces[i].name, ifname, IFNAMSIZ))
+      return(&iw_sim_ifaces[i]);
+  return(NULL);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Simulated signal level of a cell, it drift a little between scans.
+ */
+static inline int
+iw_sim_level(int		cell,
+	     unsigned int	seq)
+{
+  return(-35 - ((cell * 7) % 55) + (int) ((seq + cell) % 5));
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Fill the quality of a cell (or of the interface).
+ */
+static void
+iw_sim_quality(struct iw_quality *	qual,
+	       int			level)
+{
+  qual->level = (__u8) level;
+  qual->noise = (__u8) -95;
+  qual->qual = (level + 110 > 70) ? 70 : level + 110;
+  qual->updated = IW_QUAL_ALL_UPDATED | IW_QUAL_DBM;
+}
+
+/************************** SCAN RESULTS **************************/
+
+/*------------------------------------------------------------------*/
+/*
+ * Add an event to the simulated scan results. Return the end of the
+ * event, or NULL if it doesn't fit.
+ * Events are packed, like the kernel does since WE-22, unless we
+ * mimic a 64 bits kernel talking to 32 bits userspace, in which case
+ * the header is padded to 8 bytes.
+ */
+static char *
+iw_sim_add_event(char *		pos,
+		 char *		end,
+		 int		compat,
+		 int		cmd,
+		 const void *	data,
+		 int		len)
+{
+  int		hdr_len = compat ? IW_SIM_COMPAT_LCP_LEN : IW_EV_LCP_PK_LEN;
+  __u16		ev_len = hdr_len + len;
+  __u16		ev_cmd = cmd;
+
+  if((pos == NULL) || (pos + ev_len > end))
+    return(NULL);
+  memset(pos, 0, hdr_len);
+  memcpy(pos, &ev_len, sizeof(__u16));
+  memcpy(pos + sizeof(__u16), &ev_cmd, sizeof(__u16));
+  memcpy(pos + hdr_len, data, len);
+  return(pos + ev_len);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Add an iw_point event : length and flags, then the payload.
+ * With the 32-on-64 layout, there is also padding in place of the
+ * pointer (header) and after the flags.
+ */
+static char *
+iw_sim_add_point(char *		pos,
+		 char *		end,
+		 int		compat,
+		 int		cmd,
+		 const void *	data,
+		 int		len,
+		 int		flags)
+{
+  int		hdr_len = compat ? IW_SIM_COMPAT_LCP_LEN : IW_EV_LCP_PK_LEN;
+  int		point_len = compat ? IW_SIM_COMPAT_POINT_LEN : IW_EV_POINT_PK_LEN;
+  __u16		ev_len = point_len + len;
+  __u16		ev_cmd = cmd;
+  __u16		length = len;
+  __u16		ev_flags = flags;
+
+  if((pos == NULL) || (pos + ev_len > end))
+    return(NULL);
+  memset(pos, 0, point_len);
+  memcpy(pos, &ev_len, sizeof(__u16));
+  memcpy(pos + sizeof(__u16), &ev_cmd, sizeof(__u16));
+  memcpy(pos + hdr_len, &length, sizeof(__u16));
+  memcpy(pos + hdr_len + sizeof(__u16), &ev_flags, sizeof(__u16));
+  memcpy(pos + point_len, data, len);
+  return(pos + ev_len);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Build the information elements of a cell, as found in beacons.
+ * Return the length of the IEs.
+ */
+static int
+iw_sim_cell_ies(unsigned char *	buf,
+		int		cell,
+		int		ies)
+{
+  /* RSN : CCMP/CCMP/PSK */
+  static const unsigned char	rsn_ie[] = {
+    0x30, 0x14, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x04, 0x01, 0x00,
+    0x00, 0x0f, 0xac, 0x04, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x02,
+    0x00, 0x00 };
+  /* WPA : TKIP/TKIP/PSK */
+  static const unsigned char	wpa_ie[] = {
+    0xdd, 0x16, 0x00, 0x50, 0xf2, 0x01, 0x01, 0x00, 0x00, 0x50,
+    0xf2, 0x02, 0x01, 0x00, 0x00, 0x50, 0xf2, 0x02, 0x01, 0x00,
+    0x00, 0x50, 0xf2, 0x02 };
+  /* HT Capabilities : 20/40 MHz, SGI, 2 spatial streams */
+  static const unsigned char	ht_ie[] = {
+    0x2d, 0x1a, 0x6e, 0x11, 0x17, 0xff, 0xff, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+  /* VHT Capabilities : 2 spatial streams, MCS 0-9 */
+  static const unsigned char	vht_ie[] = {
+    0xbf, 0x0c, 0x32, 0x00, 0x80, 0x03, 0xfa, 0xff, 0x00, 0x00,
+    0xfa, 0xff, 0x00, 0x00 };
+  /* Country : US, channels 1 to 11, 30 dBm */
+  static const unsigned char	country_ie[] = {
+    0x07, 0x06, 0x55, 0x53, 0x20, 0x01, 0x0b, 0x1e };
+  /* Supported and extended rates */
+  static const unsigned char	rates_ie[] = {
+    0x01, 0x08, 0x82, 0x84, 0x8b, 0x96, 0x0c, 0x12, 0x18, 0x24,
+    0x32, 0x04, 0x30, 0x48, 0x60, 0x6c };
+  /* Vendor : WMM parameters and a Broadcom element */
+  static const unsigned char	vendor_ie[] = {
+    0xdd, 0x07, 0x00, 0x50, 0xf2, 0x02, 0x00, 0x01, 0x00,
+    0xdd, 0x06, 0x00, 0x10, 0x18, 0x02, 0x00, 0x00 };
+  int				len = 0;
+
+  /* Beacons start with the rates */
+  if(ies & IW_SIM_IE_RATES)
+    {
+      memcpy(buf + len, rates_ie, sizeof(rates_ie));
+      len += sizeof(rates_ie);
+    }
+  if(ies & IW_SIM_IE_COUNTRY)
+    {
+      memcpy(buf + len, country_ie, sizeof(country_ie));
+      len += sizeof(country_ie);
+    }
+  if(ies & IW_SIM_IE_BSS_LOAD)
+    {
+      /* Station count, channel utilisation, admission capacity */
+      buf[len++] = 0x0b;
+      buf[len++] = 5;
+      buf[len++] = cell % 40;
+      buf[len++] = 0;
+      buf[len++] = (cell * 37) % 256;
+      buf[len++] = 0;
+      buf[len++] = 0;
+    }
+  /* Only the encrypted cells have WPA/RSN */
+  if((ies & IW_SIM_IE_RSN) && (cell % 3))
+    {
+      memcpy(buf + len, rsn_ie, sizeof(rsn_ie));
+      len += sizeof(rsn_ie);
+    }
+  if(ies & IW_SIM_IE_HT)
+    {
+      memcpy(buf + len, ht_ie, sizeof(ht_ie));
+      len += sizeof(ht_ie);
+    }
+  if(ies & IW_SIM_IE_VHT)
+    {
+      memcpy(buf + len, vht_ie, sizeof(vht_ie));
+      len += sizeof(vht_ie);
+    }
+  if((ies & IW_SIM_IE_WPA) && ((cell % 3) == 1))
+    {
+      memcpy(buf + len, wpa_ie, sizeof(wpa_ie));
+      len += sizeof(wpa_ie);
+    }
+  if(ies & IW_SIM_IE_VENDOR)
+    {
+      memcpy(buf + len, vendor_ie, sizeof(vendor_ie));
+      len += sizeof(vendor_ie);
+    }
+  return(len);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Generate one cell of the scan results, between pos and end.
+ * id identify the interface, and seq the scan, so that each
+ * interface sees different cells and the levels drift between scans.
+ * Return the end of the cell, or NULL if it doesn't fit.
+ */
+static char *
+iw_sim_scan_cell(const iw_sim_scan_config *	config,
+		 int				id,
+		 unsigned int			seq,
+		 int				cell,
+		 char *				pos,
+		 char *				end)
+{
+  int			compat = config->compat;
+  sockaddr		ap_addr;
+  char			essid[IW_ESSID_MAX_SIZE + 1];
+  int			essid_len;
+  struct iw_freq	freq;
+  struct iw_quality	qual;
+  __u32			mode;
+  iwparam		rates[IW_MAX_BITRATES];
+  unsigned char		ies[IW_SIM_MAX_IES];
+  int			ies_len;
+  char			custom[IW_CUSTOM_MAX + 1];
+  int			custom_len;
+  int			j;
+
+  memset(&ap_addr, 0, sizeof(ap_addr));
+  ap_addr.sa_family = ARPHRD_ETHER;
+  ap_addr.sa_data[0] = 0x02;
+  ap_addr.sa_data[1] = 0x51;
+  ap_addr.sa_data[3] = id;
+  ap_addr.sa_data[4] = cell >> 8;
+  ap_addr.sa_data[5] = cell;
+  pos = iw_sim_add_event(pos, end, compat, SIOCGIWAP,
+			 &ap_addr, sizeof(ap_addr));
+
+  /* Natural names, fixed length, or mixed lengths (some hidden) */
+  essid_len = snprintf(essid, sizeof(essid), "sim-net-%d", cell % 64);
+  memset(essid + essid_len, 'x', IW_ESSID_MAX_SIZE - essid_len);
+  if(config->essid_len > 0)
+    essid_len = config->essid_len;
+  else if(config->essid_len < 0)
+    essid_len = (cell * 7) % (IW_ESSID_MAX_SIZE + 1);
+  pos = iw_sim_add_point(pos, end, compat, SIOCGIWESSID,
+			 essid, essid_len, essid_len ? 1 : 0);
+
+  mode = (cell % 10) ? IW_MODE_MASTER : IW_MODE_ADHOC;
+  pos = iw_sim_add_event(pos, end, compat, SIOCGIWMODE, &mode, sizeof(mode));
+
+  memset(&freq, 0, sizeof(freq));
+  freq.m = 2412 + 5 * (cell % IW_SIM_NUM_CHANNELS);
+  freq.e = 6;
+  pos = iw_sim_add_event(pos, end, compat, SIOCGIWFREQ, &freq, sizeof(freq));
+
+  memset(&qual, 0, sizeof(qual));
+  iw_sim_quality(&qual, iw_sim_level(cell, seq));
+  pos = iw_sim_add_event(pos, end, compat, IWEVQUAL, &qual, sizeof(qual));
+
+  pos = iw_sim_add_point(pos, end, compat, SIOCGIWENCODE, NULL, 0,
+			 (cell % 3) ? (IW_ENCODE_ENABLED | IW_ENCODE_NOKEY) :
+				      IW_ENCODE_DISABLED);
+
+  /* All the rates in a single event, like most drivers. Beyond the
+   * legacy rates, count by HT steps. */
+  if(config->num_bitrates > 0)
+    {
+      memset(rates, 0, sizeof(rates));
+      for(j = 0; j < config->num_bitrates; j++)
+	rates[j].value = (j < IW_SIM_NUM_BITRATES) ? iw_sim_bitrates[j] :
+			 6500000 * (j - IW_SIM_NUM_BITRATES + 9);
+      pos = iw_sim_add_event(pos, end, compat, SIOCGIWRATE, rates,
+			     config->num_bitrates * sizeof(iwparam));
+    }
+
+  ies_len = iw_sim_cell_ies(ies, cell, config->ies);
+  if(ies_len > 0)
+    pos = iw_sim_add_point(pos, end, compat, IWEVGENIE, ies, ies_len, 0);
+
+  /* Driver specific junk, padded (or cut) to the requested length */
+  for(j = 0; j < config->num_custom; j++)
+    {
+      if(j == 0)
+	custom_len = snprintf(custom, sizeof(custom), "Last beacon: %dms ago",
+			      (cell * 13) % 1000);
+      else
+	custom_len = snprintf(custom, sizeof(custom), "Extra %d: tsf=%08x",
+			      j, cell * 1024 + seq);
+      if(config->custom_len > 0)
+	{
+	  if(config->custom_len > custom_len)
+	    memset(custom + custom_len, '.', config->custom_len - custom_len);
+	  custom_len = config->custom_len;
+	}
+      pos = iw_sim_add_point(pos, end, compat, IWEVCUSTOM,
+			     custom, custom_len, 0);
+    }
+
+  return(pos);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Generate the scan results of an interface, only the cells of the
+ * channels of the mask (0 for all).
+ * Like real drivers, the cells that don't fit in the buffer are dropped.
+ * If buffer is NULL, only measure the results (up to buflen).
+ * Return the length of the results.
+ */
+static int
+iw_sim_scan_results(const iw_sim_scan_config *	config,
+		    int				id,
+		    unsigned int		seq,
+		    unsigned int		channels,
+		    char *			buffer,
+		    int				buflen)
+{
+  char		scratch[IW_SIM_MAX_CELL];
+  char *	pos;
+  char *	end;
+  char *	next;
+  int		len = 0;
+  int		i;
+
+  for(i = 0; i < config->num_cells; i++)
+    {
+      /* Same channel as in iw_sim_scan_cell() */
+      if(channels && !(channels & (1 << ((i % IW_SIM_NUM_CHANNELS) + 1))))
+	continue;
+      if(buffer != NULL)
+	{
+	  pos = buffer + len;
+	  end = buffer + buflen;
+	}
+      else
+	{
+	  pos = scratch;
+	  end = scratch + sizeof(scratch);
+	}
+
+      next = iw_sim_scan_cell(config, id, seq, i, pos, end);
+      /* Stop at the last complete cell */
+      if((next == NULL) || (len + (next - pos) > buflen))
+	break;
+      len += next - pos;
+    }
+
+  return(len);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Initialise the shape of the synthetic scan results with the default
+ * values, overriden by the environment :
+ *	IW_SIM_CELLS		number of cells (16)
+ *	IW_SIM_ESSID_LEN	length of ESSIDs, -1 for a mix (natural names)
+ *	IW_SIM_RATES		number of bitrates per cell (12)
+ *	IW_SIM_CUSTOM		number of IWEVCUSTOM per cell (1)
+ *	IW_SIM_CUSTOM_LEN	length of IWEVCUSTOM (natural)
+ *	IW_SIM_IES		mask of IW_SIM_IE_XXX in IWEVGENIE (RSN)
+ *	IW_SIM_COMPAT		1 for 32-on-64 layout, as in WE-21 (0)
+ */
+void
+iw_sim_scan_config_init(iw_sim_scan_config *	config)
+{
+  config->num_cells = iw_sim_getenv("IW_SIM_CELLS", 16, 0, 65535);
+  config->essid_len = iw_sim_getenv("IW_SIM_ESSID_LEN", 0, -1,
+				    IW_ESSID_MAX_SIZE);
+  config->num_bitrates = iw_sim_getenv("IW_SIM_RATES", IW_SIM_NUM_BITRATES,
+				       0, IW_MAX_BITRATES);
+  config->num_custom = iw_sim_getenv("IW_SIM_CUSTOM", 1, 0, 8);
+  config->custom_len = iw_sim_getenv("IW_SIM_CUSTOM_LEN", 0, 0,
+				     IW_CUSTOM_MAX);
+  config->ies = iw_sim_getenv("IW_SIM_IES", IW_SIM_IE_RSN, 0, IW_SIM_IE_ALL);
+  config->compat = iw_sim_getenv("IW_SIM_COMPAT", 0, 0, 1);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Generate synthetic scan results, as returned by SIOCGIWSCAN. This is
+ * used to test and benchmark the decoding of scan results, beyond what
+ * we can find in the field.
+ * The results of the 32-on-64 layout must be decoded as WE-21.
+ * If buffer is NULL, return the size needed for all the cells.
+ * Otherwise, return the length of the results ; the cells that don't
+ * fit in the buffer are dropped.
+ */
+int
+iw_sim_scan_generate(const iw_sim_scan_config *	config,
+		     char *			buffer,
+		     int			buflen)
+{
+  if(buffer == NULL)
+    buflen = INT_MAX;
+  return(iw_sim_scan_results(config, 0, 0, 0, buffer, buflen));
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Change the shape of the scan results of the simulated interfaces.
+ */
+void
+iw_sim_set_scan_config(const iw_sim_scan_config *	config)
+{
+  iw_sim_init();
+  memcpy(&iw_sim_config, config, sizeof(iw_sim_scan_config));
+}
+
+/*************************** RANGE & STATS ***************************/
+
+/*------------------------------------------------------------------*/
+/*
+ * Fill the range of a simulated interface.
+ */
+static void
+iw_sim_range(struct iw_range *	range)
+{
+  int	i;
+
+  memset(range, 0, sizeof(struct iw_range));
+  /* The 32-on-64 layout is the one of WE-21 */
+  range->we_version_compiled = iw_sim_config.compat ? 21 : WE_VERSION;
+  range->we_version_source = range->we_version_compiled;
+  range->throughput = 22000000;
+  range->min_nwid = 0x0000;
+  range->max_nwid = 0xFFFF;
+
+  range->num_channels = IW_SIM_NUM_CHANNELS;
+  range->num_frequency = IW_SIM_NUM_CHANNELS;
+  for(i = 0; i < IW_SIM_NUM_CHANNELS; i++)
+    {
+      range->freq[i].i = i + 1;
+      range->freq[i].m = 2412 + 5 * i;
+      range->freq[i].e = 6;
+    }
+
+  range->sensitivity = 3;
+  range->max_qual.qual = 70;
+  range->max_qual.level = 0;
+  range->max_qual.noise = 0;
+  range->max_qual.updated = IW_QUAL_DBM;
+  range->avg_qual.qual = 35;
+  range->avg_qual.level = (__u8) -70;
+  range->avg_qual.noise = (__u8) -95;
+  range->avg_qual.updated = IW_QUAL_DBM;
+
+  range->num_bitrates = IW_SIM_NUM_BITRATES;
+  for(i = 0; i < IW_SIM_NUM_BITRATES; i++)
+    range->bitrate[i] = iw_sim_bitrates[i];
+
+  range->min_rts = 0;
+  range->max_rts = 2347;
+  range->min_frag = 256;
+  range->max_frag = 2346;
+
+  range->num_encoding_sizes = 2;
+  range->encoding_size[0] = 5;
+  range->encoding_size[1] = 13;
+  range->max_encoding_tokens = 4;
+
+  range->txpower_capa = IW_TXPOW_DBM;
+  range->num_txpower = 3;
+  range->txpower[0] = 5;
+  range->txpower[1] = 10;
+  range->txpower[2] = 20;
+
+  range->retry_capa = IW_RETRY_LIMIT;
+  range->retry_flags = IW_RETRY_LIMIT;
+  range->min_retry = 1;
+  range->max_retry = 255;
+
+  range->enc_capa = IW_ENC_CAPA_WPA | IW_ENC_CAPA_WPA2 |
+		    IW_ENC_CAPA_CIPHER_TKIP | IW_ENC_CAPA_CIPHER_CCMP;
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Fill the statistics of a simulated interface.
+ */
+static void
+iw_sim_stats(iw_sim_iface *		iface,
+	     struct iw_statistics *	stats)
+{
+  memset(stats, 0, sizeof(struct iw_statistics));
+  iw_sim_quality(&stats->qual, iw_sim_level(iface - iw_sim_ifaces,
+					    iface->scan_seq));
+  stats->discard.retries = iface->scan_seq;
+}
+
+/************************** TRANSPORT **************************/
+
+/*------------------------------------------------------------------*/
+/*
+ * Copy a string to/from an iw_point request (ESSID, nickname).
+ */
+static int
+iw_sim_string(struct iwreq *	wrq,
+	      char *		string,
+	      int *		flags,
+	      int		set)
+{
+  int	len;
+
+  if(set)
+    {
+      len = wrq->u.data.length;
+      if(len > IW_ESSID_MAX_SIZE)
+	{
+	  errno = E2BIG;
+	  return(-1);
+	}
+      memset(string, '\0', IW_ESSID_MAX_SIZE + 1);
+      if((len > 0) && (wrq->u.data.pointer != NULL))
+	memcpy(string, wrq->u.data.pointer, len);
+      if(flags != NULL)
+	*flags = wrq->u.data.flags;
+    }
+  else
+    {
+      len = strlen(string);
+      if(wrq->u.data.pointer != NULL)
+	memcpy(wrq->u.data.pointer, string, len);
+      wrq->u.data.length = len;
+      wrq->u.data.flags = (flags != NULL) ? *flags : 0;
+    }
+  return(0);
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Process a Wireless Extension request for a simulated interface.
+ */
+static int
+iw_sim_ioctl(int		skfd,
+	     int		request,
+	     struct iwreq *	wrq)
+{
+  iw_sim_iface *	iface;
+  unsigned int		i;
+  int			len;
+
+  /* Avoid "Unused parameter" warning */
+  skfd = skfd;
+
+  iface = iw_sim_get_iface(wrq->ifr_name);
+  if(iface == NULL)
+    {
+      errno = ENODEV;
+      return(-1);
+    }
+
+  /* Simple parameters */
+  for(i = 0; i < IW_SIM_NUM_PARAMS; i++)
+    {
+      iwparam *	param = (iwparam *) (((char *) iface) +
+					  iw_sim_params[i].offset);
+      if(request == iw_sim_params[i].set)
+	{
+	  memcpy(param, &wrq->u.param, sizeof(iwparam));
+	  return(0);
+	}
+      if(request == iw_sim_params[i].get)
+	{
+	  memcpy(&wrq->u.param, param, sizeof(iwparam));
+	  return(0);
+	}
+    }
+
+  switch(request)
+    {
+    case SIOCGIWNAME:
+      strncpy(wrq->u.name, "IEEE 802.11bg", IFNAMSIZ);
+      return(0);
+
+    case SIOCGIWRANGE:
+      if(wrq->u.data.length < sizeof(struct iw_range))
+	{
+	  errno = E2BIG;
+	  return(-1);
+	}
+      iw_sim_range((struct iw_range *) wrq->u.data.pointer);
+      wrq->u.data.length = sizeof(struct iw_range);
+      return(0);
+
+    case SIOCGIWSTATS:
+      if(wrq->u.data.length < sizeof(struct iw_statistics))
+	{
+	  errno = E2BIG;
+	  return(-1);
+	}
+      iw_sim_stats(iface, (struct iw_statistics *) wrq->u.data.pointer);
+      wrq->u.data.length = sizeof(struct iw_statistics);
+      return(0);
+
+    case SIOCSIWESSID:
+      return(iw_sim_string(wrq, iface->essid, &iface->essid_on, 1));
+    case SIOCGIWESSID:
+      return(iw_sim_string(wrq, iface->essid, &iface->essid_on, 0));
+    case SIOCSIWNICKN:
+      return(iw_sim_string(wrq, iface->nickname, NULL, 1));
+    case SIOCGIWNICKN:
+      return(iw_sim_string(wrq, iface->nickname, NULL, 0));
+
+    case SIOCSIWFREQ:
+      memcpy(&iface->freq, &wrq->u.freq, sizeof(struct iw_freq));
+      return(0);
+    case SIOCGIWFREQ:
+      memcpy(&wrq->u.freq, &iface->freq, sizeof(struct iw_freq));
+      return(0);
+
+    case SIOCSIWMODE:
+      if(wrq->u.mode >= IW_NUM_OPER_MODE)
+	{
+	  errno = EINVAL;
+	  return(-1);
+	}
+      iface->mode = wrq->u.mode;
+      return(0);
+    case SIOCGIWMODE:
+      wrq->u.mode = iface->mode;
+      return(0);
+
+    case SIOCSIWAP:
+      memcpy(&iface->ap_addr, &wrq->u.ap_addr, sizeof(sockaddr));
+      return(0);
+    case SIOCGIWAP:
+      memcpy(&wrq->u.ap_addr, &iface->ap_addr, sizeof(sockaddr));
+      return(0);
+
+    case SIOCGIWENCODE:
+      /* No keys, encryption disabled */
+      wrq->u.data.length = 0;
+      wrq->u.data.flags = IW_ENCODE_DISABLED | 1;
+      return(0);
+
+    case SIOCSIWSPY:
+      if(wrq->u.data.length > IW_MAX_SPY)
+	{
+	  errno = E2BIG;
+	  return(-1);
+	}
+      iface->spy_number = wrq->u.data.length;
+      if(iface->spy_number > 0)
+	memcpy(iface->spy_addr, wrq->u.data.pointer,
+	       iface->spy_number * sizeof(sockaddr));
+      return(0);
+    case SIOCGIWSPY:
+      /* Addresses, followed by the quality of each of them */
+      wrq->u.data.length = iface->spy_number;
+      for(i = 0; i < (unsigned int) iface->spy_number; i++)
+	{
+	  struct iw_quality *	qual;
+	  memcpy(((char *) wrq->u.data.pointer) + i * sizeof(sockaddr),
+		 &iface->spy_addr[i], sizeof(sockaddr));
+	  qual = (struct iw_quality *) (((char *) wrq->u.data.pointer) +
+					iface->spy_number * sizeof(sockaddr) +
+					i * sizeof(struct iw_quality));
+	  iw_sim_quality(qual, iw_sim_level(i, iface->scan_seq));
+	}
+      return(0);
+
+    case SIOCGIWPRIV:
+      /* No private ioctls */
+      wrq->u.data.length = 0;
+      return(0);
+
+    case SIOCSIWSCAN:
+      /* The scan is instantaneous, only the channel list matters */
+      iface->scan_seq++;
+      iface->scan_channels = 0;
+      if((wrq->u.data.flags & IW_SCAN_THIS_FREQ)
+	 && (wrq->u.data.length == sizeof(struct iw_scan_req)))
+	{
+	  struct iw_scan_req *	req = (struct iw_scan_req *) wrq->u.data.pointer;
+	  int			channel;
+	  for(i = 0; (i < req->num_channels) && (i < IW_MAX_FREQUENCIES); i++)
+	    {
+	      /* A channel, or a frequency of the 2.4 GHz band */
+	      if(req->channel_list[i].e == 0)
+		channel = req->channel_list[i].m;
+	      else
+		channel = ((int) (iw_freq2float(&req->channel_list[i]) / MEGA)
+			   - 2407) / 5;
+	      if((channel >= 1) && (channel <= IW_SIM_NUM_CHANNELS))
+		iface->scan_channels |= 1 << channel;
+	    }
+	  /* None of ours, nothing to find */
+	  if(iface->scan_channels == 0)
+	    iface->scan_channels = 1;
+	}
+      return(0);
+    case SIOCGIWSCAN:
+      /* What fits in the 16 bit length of iw_point */
+      len = iw_sim_scan_results(&iw_sim_config, iface - iw_sim_ifaces,
+				iface->scan_seq, iface->scan_channels,
+				NULL, 0xFFFF);
+      /* Like WE-17 drivers, tell the caller the size we need */
+      if(len > wrq->u.data.length)
+	{
+	  wrq->u.data.length = len;
+	  errno = E2BIG;
+	  return(-1);
+	}
+      wrq->u.data.length = iw_sim_scan_results(&iw_sim_config,
+					       iface - iw_sim_ifaces,
+					       iface->scan_seq,
+					       iface->scan_channels,
+					       wrq->u.data.pointer,
+					       wrq->u.data.length);
+      return(0);
+
+    default:
+      errno = EOPNOTSUPP;
+      return(-1);
+    }
+}
+
+/*------------------------------------------------------------------*/
+/*
+ * Call the handler for each simulated interface.
+ */
+static void
+iw_sim_enum_devices(int			skfd,
+		    iw_enum_handler	fn,
+		    char *		args[],
+		    int			count)
+{
+  int	i;
+
+  iw_sim_init();
+  for(i = 0; i < iw_sim_num_ifaces; i++)
+    (*fn)(skfd, iw_sim_ifaces[i].name, args, count);
+}
+
+/* The simulated driver, as a transport */
+const iw_transport	iw_sim_transport = {
+  .name		= "sim",
+  .ioctl	= iw_sim_ioctl,
+  .enum_devices	= iw_sim_enum_devices,
+};
+
+#endif	/* WE_ESSENTIAL */